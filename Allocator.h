@@ -1,7 +1,11 @@
 #pragma once
 
+#include "Heap.h"
+
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <new>
 
 
 template <typename T>
@@ -16,8 +20,9 @@ public:
     using difference_type = std::ptrdiff_t;
 
     using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type; // memory can be freed via any allocator
 
-    using HeapID = std::size_t;
+    using HeapID = Heap::ID;
 
 public:
     constexpr SeparateHeapAllocator(const SeparateHeapAllocator& other) noexcept : m_heap(other.m_heap)
@@ -31,16 +36,33 @@ public:
 
     constexpr SeparateHeapAllocator& operator=(const SeparateHeapAllocator&) = default;
 
-    [[nodiscard]] constexpr T* allocate(const size_t count)
+    [[nodiscard]] T* allocate(const size_t count)
     {
-        // TODO: implement separate m_heap-based allocations. So users of different heaps do not block each other
-        return std::allocator<T>().allocate(count);
+        if constexpr (alignof(T) > Heap::BlockAlignment)
+        {
+            return std::allocator<T>().allocate(count);
+        }
+        else
+        {
+            if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+            {
+                throw std::bad_array_new_length();
+            }
+            return static_cast<T*>(Heap::from_id(m_heap)->allocate(count * sizeof(T)));
+        }
     }
 
-    constexpr void deallocate(T* const ptr, const size_t count)
+    void deallocate(T* const ptr, const size_t count)
     {
-        // TODO: implement separate m_heap-based allocations. So users of different heaps do not block each other
-        std::allocator<T>().deallocate(ptr, count);
+        if constexpr (alignof(T) > Heap::BlockAlignment)
+        {
+            std::allocator<T>().deallocate(ptr, count);
+        }
+        else
+        {
+            // Owner heap is found by the block address, it is not necessarily `m_heap`
+            Heap::deallocate(ptr, count * sizeof(T));
+        }
     }
 
 public:
@@ -53,5 +75,11 @@ protected:
     explicit constexpr SeparateHeapAllocator(const HeapID heap) noexcept : m_heap(heap) {}
 
 protected:
-    HeapID              m_heap = 0; // placement for future separate real heap handler
+    HeapID              m_heap = 0; // heap of the thread which created the allocator
 };
+
+template <typename T1, typename T2>
+constexpr bool operator==(const SeparateHeapAllocator<T1>&, const SeparateHeapAllocator<T2>&) noexcept
+{
+    return true;
+}
@@ -9,14 +9,13 @@ public:
     template <class T>
     static SeparateHeapAllocator<T> get_allocator()
     {
-        // TODO: implement selecting random allocator from a bunch of thread allocators
-        // or return lock-free global allocator
-        // or ...
+        // Allocations are served by the heap of the calling thread without contention;
+        // blocks freed by other threads go back to their owner heap
         return get_current_thread_allocator();
     }
 
 protected:
     using DefaultAllocator = SeparateHeapAllocator<char>;
 
-    static const DefaultAllocator& get_current_thread_allocator();
+    static DefaultAllocator get_current_thread_allocator();
 };
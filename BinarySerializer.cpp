@@ -0,0 +1,586 @@
+#include "BinarySerializer.h"
+
+#include "FileSync.h"
+#include "Logger.h"
+#include "Lz4.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <limits>
+#include <thread>
+#include <utility>
+
+
+#ifdef _MSC_VER
+#pragma warning( disable : 4996 ) // warning C4996: 'fopen': This function or variable may be unsafe.
+#endif
+
+
+static_assert(std::endian::native == std::endian::little, "Snapshot format is little-endian. Add byte swapping for other platforms");
+
+
+namespace
+{
+    constexpr size_t FileStreamBufferSize = 65536;
+}
+
+
+BinarySerializer::Writer::Writer() :
+    m_file(nullptr)
+{
+}
+
+BinarySerializer::Writer::~Writer() = default;
+
+bool BinarySerializer::Writer::open(const std::string& filename, const Compression compression, const size_t packingThreadCount)
+{
+    m_filename = filename;
+    m_compression = compression;
+    m_maxPackingBlockCount = compression != Compression::None ? packingThreadCount : 0;
+    m_block.reserve(BlockSize);
+
+    m_file.m_file = std::fopen(filename.c_str(), "wb");
+    if (m_file.m_file == nullptr)
+    {
+        LOG_ERROR << "Failed opening the file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    std::setvbuf(m_file.m_file, nullptr, _IOFBF, FileStreamBufferSize);
+
+    // Placeholder: real values are known after the last record
+    const FileHeader header = {};
+    return write(&header, sizeof(header));
+}
+
+bool BinarySerializer::Writer::open_delta(const std::string& filename, const SnapshotId baseId, const Compression compression,
+    const size_t packingThreadCount)
+{
+    m_kind = Kind::Delta;
+    m_baseId = baseId;
+    return open(filename, compression, packingThreadCount);
+}
+
+bool BinarySerializer::Writer::add(const std::string_view name, const std::string_view value)
+{
+    if (value.size() >= ErasedValueSize)
+    {
+        LOG_ERROR << "Record is too big for the snapshot format; name: " << name.substr(0, 64) << std::endl;
+        m_failed = true;
+        return false;
+    }
+
+    return add_record(name, static_cast<std::uint32_t>(value.size()), value);
+}
+
+bool BinarySerializer::Writer::add_erased(const std::string_view name)
+{
+    return add_record(name, ErasedValueSize, {});
+}
+
+bool BinarySerializer::Writer::add_record(const std::string_view name, const std::uint32_t valueSize, const std::string_view value)
+{
+    if (name.size() > std::numeric_limits<std::uint32_t>::max())
+    {
+        LOG_ERROR << "Record is too big for the snapshot format; name: " << name.substr(0, 64) << std::endl;
+        m_failed = true;
+        return false;
+    }
+
+    const RecordHeader recordHeader = { static_cast<std::uint32_t>(name.size()), valueSize };
+
+    append(&recordHeader, sizeof(recordHeader));
+    append(name.data(), name.size());
+    append(value.data(), value.size());
+
+    ++m_recordCount;
+
+    return !m_failed;
+}
+
+void BinarySerializer::Writer::append(const void* const data, const size_t size)
+{
+    const char* const bytes = static_cast<const char*>(data);
+
+    size_t offset = 0;
+    while (offset < size)
+    {
+        const size_t partSize = std::min(size - offset, BlockSize - m_block.size());
+        m_block.append(bytes + offset, partSize);
+        m_payloadSize += partSize;
+        offset += partSize;
+
+        if (m_block.size() == BlockSize)
+        {
+            submit_block();
+        }
+    }
+}
+
+void BinarySerializer::Writer::submit_block()
+{
+    if (m_maxPackingBlockCount == 0)
+    {
+        write_block(pack_block(std::move(m_block), m_compression));
+    }
+    else
+    {
+        // Blocks are written in order: wait for the oldest one when all threads are busy
+        if (m_packingBlocks.size() >= m_maxPackingBlockCount)
+        {
+            write_block(m_packingBlocks.front().get());
+            m_packingBlocks.pop_front();
+        }
+        m_packingBlocks.push_back(std::async(std::launch::async, pack_block, std::move(m_block), m_compression));
+    }
+
+    m_block = std::string();
+    m_block.reserve(BlockSize);
+}
+
+BinarySerializer::Writer::PackedBlock BinarySerializer::Writer::pack_block(std::string block, const Compression compression)
+{
+    PackedBlock packedBlock;
+
+    if (compression == Compression::Lz4 && !block.empty())
+    {
+        // Kept only if it is smaller than the block
+        std::string compressedBlock(block.size() - 1, '\0');
+        const size_t compressedSize = Lz4::compress(block.data(), block.size(), compressedBlock.data(), compressedBlock.size());
+        if (compressedSize != 0)
+        {
+            compressedBlock.resize(compressedSize);
+            block = std::move(compressedBlock);
+        }
+    }
+
+    packedBlock.m_entry.m_storedSize = static_cast<std::uint32_t>(block.size());
+    packedBlock.m_entry.m_checksum = Crc32c::calculate(block.data(), block.size());
+    packedBlock.m_bytes = std::move(block);
+    return packedBlock;
+}
+
+bool BinarySerializer::Writer::write_block(const PackedBlock& block)
+{
+    m_blockTable.push_back(block.m_entry);
+    return write(block.m_bytes.data(), block.m_bytes.size());
+}
+
+bool BinarySerializer::Writer::finish()
+{
+    if (m_file.m_file == nullptr || m_failed)
+    {
+        m_file.close();
+        return false;
+    }
+
+    if (!m_block.empty())
+    {
+        submit_block(); // the last block is shorter
+    }
+
+    for (; !m_packingBlocks.empty(); m_packingBlocks.pop_front())
+    {
+        write_block(m_packingBlocks.front().get());
+    }
+
+    const size_t blockTableSize = m_blockTable.size() * sizeof(BlockEntry);
+    if (!write(m_blockTable.data(), blockTableSize))
+    {
+        m_file.close();
+        return false;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.m_signature, Signature, sizeof(Signature));
+    header.m_version = Version;
+    header.m_headerSize = sizeof(FileHeader);
+    header.m_recordCount = m_recordCount;
+    header.m_payloadSize = m_payloadSize;
+    header.m_blockTableChecksum = Crc32c::calculate(m_blockTable.data(), blockTableSize);
+    header.m_kind = m_kind;
+    header.m_baseId = m_baseId;
+    header.m_compression = m_compression;
+    header.m_headerChecksum = Crc32c::calculate(&header, offsetof(FileHeader, m_headerChecksum));
+
+    // Synced before the file is renamed over the previous snapshot, so a crash never leaves a partial file in place
+    const bool ok = std::fseek(m_file.m_file, 0, SEEK_SET) == 0 && write(&header, sizeof(header)) && std::fflush(m_file.m_file) == 0
+        && FileSync::sync(m_file.m_file, m_filename);
+    m_file.close();
+
+    if (!ok)
+    {
+        LOG_ERROR << "Failed writing the file: " << m_filename << std::endl;
+    }
+    return ok;
+}
+
+size_t BinarySerializer::Writer::get_default_packing_thread_count()
+{
+    // Every core compresses a block while the caller fills the next one
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+bool BinarySerializer::Writer::write(const void* const data, const size_t size)
+{
+    if (m_failed)
+    {
+        return false;
+    }
+
+    if (size != 0 && std::fwrite(data, 1, size, m_file.m_file) != size)
+    {
+        LOG_ERROR << "Failed writing the file: " << m_filename << std::endl;
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool BinarySerializer::is_binary_file(const std::string& filename)
+{
+    stdlib_extra::FileOwner file(std::fopen(filename.c_str(), "rb"));
+    if (file.m_file == nullptr)
+    {
+        return false;
+    }
+
+    char signature[sizeof(Signature)] = {};
+    return std::fread(signature, 1, sizeof(signature), file.m_file) == sizeof(signature)
+        && std::memcmp(signature, Signature, sizeof(Signature)) == 0;
+}
+
+std::optional<BinarySerializer::SnapshotInfo> BinarySerializer::get_snapshot_info(const std::string& filename)
+{
+    stdlib_extra::FileOwner file(std::fopen(filename.c_str(), "rb"));
+    if (file.m_file == nullptr)
+    {
+        return std::nullopt;
+    }
+
+    char headerBytes[sizeof(FileHeader)] = {};
+    const size_t headerSize = std::fread(headerBytes, 1, sizeof(headerBytes), file.m_file);
+
+    FileHeader header = {};
+    if (!read_header(std::string_view(headerBytes, headerSize), header))
+    {
+        return std::nullopt;
+    }
+
+    SnapshotInfo info;
+    info.m_kind = header.m_kind;
+    info.m_id = header.m_headerChecksum;
+    info.m_baseId = header.m_baseId;
+    return info;
+}
+
+bool BinarySerializer::load(const std::string& filename, const std::function<ItemVisitorProc>& visitor, const size_t threadCount)
+{
+    if (!std::filesystem::exists(filename))
+    {
+        LOG_WARN << "Loading file was not found: " << filename << std::endl;
+        return true;
+    }
+
+    MappedFile mappedFile;
+    std::unique_ptr<char[]> payloadBuffer;
+    FileHeader header = {};
+    std::string_view payload;
+    if (!open_payload(filename, mappedFile, payloadBuffer, header, payload, std::max<size_t>(threadCount, 1)))
+    {
+        return false;
+    }
+
+    if (header.m_kind != Kind::Full)
+    {
+        LOG_ERROR << "Snapshot file is a delta, it can not be loaded alone: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<size_t> chunkOffsets;
+    if (!split_into_chunks(payload, header.m_recordCount, std::max<size_t>(threadCount, 1), false, chunkOffsets))
+    {
+        LOG_ERROR << "Snapshot file records are corrupted: " << filename << std::endl;
+        return false;
+    }
+
+    // Full snapshots have no erased records
+    const std::function<ErasedItemVisitorProc> erasedVisitor;
+
+    // The current thread visits the first chunk itself
+    std::vector<std::future<void>> chunkFutures;
+    for (size_t chunkIdx = 1; chunkIdx + 1 < chunkOffsets.size(); ++chunkIdx)
+    {
+        const std::string_view chunk = payload.substr(chunkOffsets[chunkIdx], chunkOffsets[chunkIdx + 1] - chunkOffsets[chunkIdx]);
+        chunkFutures.push_back(std::async(std::launch::async, visit_records, chunk, std::cref(erasedVisitor), std::cref(visitor)));
+    }
+
+    visit_records(payload.substr(0, chunkOffsets[1]), erasedVisitor, visitor);
+
+    for (std::future<void>& chunkFuture : chunkFutures)
+    {
+        chunkFuture.get(); // rethrows exceptions of the visitor
+    }
+
+    return true;
+}
+
+bool BinarySerializer::load_delta(const std::string& filename, const std::function<ErasedItemVisitorProc>& erasedVisitor,
+    const std::function<ItemVisitorProc>& visitor)
+{
+    MappedFile mappedFile;
+    std::unique_ptr<char[]> payloadBuffer;
+    FileHeader header = {};
+    std::string_view payload;
+    if (!open_payload(filename, mappedFile, payloadBuffer, header, payload, 1))
+    {
+        return false;
+    }
+
+    if (header.m_kind != Kind::Delta)
+    {
+        LOG_ERROR << "Snapshot file is not a delta: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<size_t> chunkOffsets;
+    if (!split_into_chunks(payload, header.m_recordCount, 1, true, chunkOffsets))
+    {
+        LOG_ERROR << "Snapshot file records are corrupted: " << filename << std::endl;
+        return false;
+    }
+
+    visit_records(payload, erasedVisitor, visitor);
+    return true;
+}
+
+bool BinarySerializer::read_header(const std::string_view data, FileHeader& header)
+{
+    if (data.size() < sizeof(FileHeader) || std::memcmp(data.data(), Signature, sizeof(Signature)) != 0)
+    {
+        return false;
+    }
+
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.m_version == Version && header.m_headerChecksum == Crc32c::calculate(&header, offsetof(FileHeader, m_headerChecksum));
+}
+
+bool BinarySerializer::open_payload(const std::string& filename, MappedFile& mappedFile, std::unique_ptr<char[]>& payloadBuffer,
+    FileHeader& header, std::string_view& payload, const size_t threadCount)
+{
+    if (!mappedFile.open(filename))
+    {
+        return false;
+    }
+
+    const std::string_view data = mappedFile.get_data();
+
+    if (!read_header(data, header))
+    {
+        LOG_ERROR << "Snapshot file header is corrupted or its version is not supported: " << filename << std::endl;
+        return false;
+    }
+
+    const size_t headerSize = sizeof(FileHeader);
+    if (header.m_headerSize != headerSize || (header.m_compression != Compression::None && header.m_compression != Compression::Lz4))
+    {
+        LOG_ERROR << "Unsupported snapshot file format; version: " << header.m_version << "; file: " << filename << std::endl;
+        return false;
+    }
+
+    const std::uint64_t blockCount = (header.m_payloadSize + BlockSize - 1) / BlockSize;
+    if (blockCount > (data.size() - headerSize) / sizeof(BlockEntry))
+    {
+        LOG_ERROR << "Snapshot file size does not match its header (truncated?): " << filename << std::endl;
+        return false;
+    }
+
+    const std::string_view blockTable = data.substr(data.size() - static_cast<size_t>(blockCount) * sizeof(BlockEntry));
+    if (Crc32c::calculate(blockTable.data(), blockTable.size()) != header.m_blockTableChecksum)
+    {
+        LOG_ERROR << "Snapshot file checksum mismatch: " << filename << std::endl;
+        return false;
+    }
+
+    // Locate stored blocks: they go one after another
+    std::vector<StoredBlock> blocks(static_cast<size_t>(blockCount));
+    const std::string_view storedData = data.substr(headerSize, data.size() - headerSize - blockTable.size());
+    size_t storedOffset = 0;
+    bool isCompressed = false;
+    for (size_t blockIdx = 0; blockIdx < blocks.size(); ++blockIdx)
+    {
+        StoredBlock& block = blocks[blockIdx];
+        block.m_size = static_cast<size_t>(std::min<std::uint64_t>(BlockSize, header.m_payloadSize - std::uint64_t(blockIdx) * BlockSize));
+
+        BlockEntry entry = {};
+        std::memcpy(&entry, blockTable.data() + blockIdx * sizeof(BlockEntry), sizeof(entry));
+
+        if (entry.m_storedSize > block.m_size || entry.m_storedSize > storedData.size() - storedOffset)
+        {
+            LOG_ERROR << "Snapshot file size does not match its header (truncated?): " << filename << std::endl;
+            return false;
+        }
+
+        block.m_bytes = storedData.substr(storedOffset, entry.m_storedSize);
+        block.m_checksum = entry.m_checksum;
+        storedOffset += entry.m_storedSize;
+        isCompressed = isCompressed || entry.m_storedSize != block.m_size;
+    }
+
+    if (storedOffset != storedData.size())
+    {
+        LOG_ERROR << "Snapshot file size does not match its header (truncated?): " << filename << std::endl;
+        return false;
+    }
+
+    // Blocks stored as is are used right from the mapping
+    char* payloadBytes = nullptr;
+    if (isCompressed)
+    {
+        payloadBuffer.reset(new char[static_cast<size_t>(header.m_payloadSize)]);
+        payloadBytes = payloadBuffer.get();
+        payload = std::string_view(payloadBytes, static_cast<size_t>(header.m_payloadSize));
+    }
+    else
+    {
+        payload = storedData;
+    }
+
+    // Verified before the first record is visited: a corrupted file is rejected as a whole.
+    // The current thread handles the first range of blocks itself.
+    const size_t rangeCount = std::min(threadCount, std::max<size_t>(blocks.size(), 1));
+    std::vector<std::future<size_t>> rangeFutures;
+    for (size_t rangeIdx = 1; rangeIdx < rangeCount; ++rangeIdx)
+    {
+        rangeFutures.push_back(std::async(std::launch::async, unpack_blocks, std::cref(blocks), payloadBytes,
+            blocks.size() * rangeIdx / rangeCount, blocks.size() * (rangeIdx + 1) / rangeCount));
+    }
+
+    std::vector<size_t> rangeResults(1, unpack_blocks(blocks, payloadBytes, 0, blocks.size() / rangeCount));
+    for (std::future<size_t>& rangeFuture : rangeFutures)
+    {
+        rangeResults.push_back(rangeFuture.get());
+    }
+
+    for (size_t rangeIdx = 0; rangeIdx < rangeCount; ++rangeIdx)
+    {
+        const size_t corruptedBlockIdx = rangeResults[rangeIdx];
+        if (corruptedBlockIdx != blocks.size() * (rangeIdx + 1) / rangeCount)
+        {
+            LOG_ERROR << "Snapshot file checksum mismatch: " << filename << "; offset: "
+                << static_cast<size_t>(blocks[corruptedBlockIdx].m_bytes.data() - data.data()) << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t BinarySerializer::unpack_blocks(const std::vector<StoredBlock>& blocks, char* const payload, const size_t firstBlock, const size_t lastBlock)
+{
+    for (size_t blockIdx = firstBlock; blockIdx < lastBlock; ++blockIdx)
+    {
+        const StoredBlock& block = blocks[blockIdx];
+        if (Crc32c::calculate(block.m_bytes.data(), block.m_bytes.size()) != block.m_checksum)
+        {
+            return blockIdx;
+        }
+
+        if (payload == nullptr)
+        {
+            continue; // verification only
+        }
+
+        char* const blockPayload = payload + blockIdx * BlockSize;
+        if (block.m_bytes.size() == block.m_size)
+        {
+            std::memcpy(blockPayload, block.m_bytes.data(), block.m_size);
+        }
+        else if (!Lz4::decompress(block.m_bytes.data(), block.m_bytes.size(), blockPayload, block.m_size))
+        {
+            return blockIdx;
+        }
+    }
+    return lastBlock;
+}
+
+bool BinarySerializer::split_into_chunks(const std::string_view payload, const std::uint64_t recordCount, const size_t chunkCount,
+    const bool allowErased, std::vector<size_t>& chunkOffsets)
+{
+    // Only record headers are read here, keys and values are skipped
+    const size_t chunkSize = payload.size() / chunkCount + 1;
+
+    chunkOffsets.assign(1, 0);
+
+    size_t offset = 0;
+    for (std::uint64_t recordIdx = 0; recordIdx < recordCount; ++recordIdx)
+    {
+        if (offset >= chunkOffsets.back() + chunkSize)
+        {
+            chunkOffsets.push_back(offset);
+        }
+
+        RecordHeader recordHeader = {};
+        if (payload.size() - offset < sizeof(recordHeader))
+        {
+            return false;
+        }
+        std::memcpy(&recordHeader, payload.data() + offset, sizeof(recordHeader));
+        offset += sizeof(recordHeader);
+
+        const bool isErased = recordHeader.m_valueSize == ErasedValueSize;
+        if (isErased && !allowErased)
+        {
+            return false;
+        }
+
+        const size_t dataSize = size_t(recordHeader.m_keySize) + (isErased ? 0 : recordHeader.m_valueSize);
+        if (payload.size() - offset < dataSize)
+        {
+            return false;
+        }
+        offset += dataSize;
+    }
+
+    if (offset != payload.size())
+    {
+        return false; // record count does not match the payload size
+    }
+
+    chunkOffsets.push_back(offset);
+    return true;
+}
+
+void BinarySerializer::visit_records(const std::string_view payload, const std::function<ErasedItemVisitorProc>& erasedVisitor,
+    const std::function<ItemVisitorProc>& visitor)
+{
+    // Bounds are already checked by `split_into_chunks()`
+    size_t offset = 0;
+    while (offset < payload.size())
+    {
+        RecordHeader recordHeader = {};
+        std::memcpy(&recordHeader, payload.data() + offset, sizeof(recordHeader));
+        offset += sizeof(recordHeader);
+
+        const std::string_view name = payload.substr(offset, recordHeader.m_keySize);
+        offset += recordHeader.m_keySize;
+
+        if (recordHeader.m_valueSize == ErasedValueSize)
+        {
+            erasedVisitor(name);
+            continue;
+        }
+
+        const std::string_view value = payload.substr(offset, recordHeader.m_valueSize);
+        offset += recordHeader.m_valueSize;
+
+        visitor(name, value);
+    }
+}
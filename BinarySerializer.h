@@ -0,0 +1,193 @@
+#pragma once
+
+#include "Crc32c.h"
+#include "utils/stdlib.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Binary snapshot format. All numbers are little-endian.
+//
+//   FileHeader
+//   blocks: the payload split into `BlockSize` parts (the last one may be shorter), each stored as is or LZ4-compressed
+//   block table: { uint32 stored size, uint32 CRC-32C of the stored bytes } * block count
+//
+//   payload: records: { uint32 key size, uint32 value size, key bytes, value bytes } * record count
+//
+// A block is stored as is unless the file is compressed and compression makes the block smaller.
+// The file is memory-mapped on load. Blocks are verified (and decompressed) in parallel before the first record
+// is visited. Records of an uncompressed file are passed to the visitor right from the mapping, without copying.
+// A delta snapshot has the same layout. It contains only changes made after its base snapshot:
+// erased keys are records with `ErasedValueSize` and no value bytes.
+class MappedFile;
+
+
+class BinarySerializer
+{
+public:
+    using ItemVisitorProc = void(const std::string_view name, const std::string_view value);
+    using ErasedItemVisitorProc = void(const std::string_view name);
+
+    // Identifies a full snapshot: delta snapshots refer to their base by it
+    using SnapshotId = Crc32c::Value;
+
+    enum class Kind : std::uint32_t
+    {
+        Full = 0,
+        Delta = 1,
+    };
+
+    enum class Compression : std::uint32_t
+    {
+        None = 0,
+        Lz4 = 1,    // blocks are compressed by several threads while records are added
+    };
+
+    struct SnapshotInfo
+    {
+        Kind            m_kind = Kind::Full;
+        SnapshotId      m_id = 0;
+        SnapshotId      m_baseId = 0;   // of a delta snapshot
+    };
+
+protected:
+    // Entry of the block table
+    struct BlockEntry
+    {
+        std::uint32_t               m_storedSize;       // equal to the block size if the block is not compressed
+        Crc32c::Value               m_checksum;         // of the stored bytes
+    };
+
+public:
+    // Writes records as they are added. Header is written by `finish()`.
+    class Writer
+    {
+    public:
+        Writer();
+        ~Writer();
+
+        // Blocks are compressed by up to `packingThreadCount` threads while records are added,
+        // or by the calling thread if it is 0
+        bool open(const std::string& filename, const Compression compression = Compression::None,
+            const size_t packingThreadCount = get_default_packing_thread_count());
+        bool open_delta(const std::string& filename, const SnapshotId baseId, const Compression compression = Compression::None,
+            const size_t packingThreadCount = get_default_packing_thread_count());
+        bool add(const std::string_view name, const std::string_view value);
+        // Delta snapshots only
+        bool add_erased(const std::string_view name);
+        bool finish();
+
+        // One per core
+        static size_t get_default_packing_thread_count();
+
+    protected:
+        struct PackedBlock
+        {
+            std::string             m_bytes;    // as stored in the file
+            BlockEntry              m_entry;
+        };
+
+        bool add_record(const std::string_view name, const std::uint32_t valueSize, const std::string_view value);
+        // Adds payload bytes to the current block
+        void append(const void* const data, const size_t size);
+        void submit_block();
+        static PackedBlock pack_block(std::string block, const Compression compression);
+        bool write_block(const PackedBlock& block);
+        bool write(const void* const data, const size_t size);
+
+    protected:
+        stdlib_extra::FileOwner     m_file;
+        std::string                 m_filename;
+        Kind                        m_kind = Kind::Full;
+        SnapshotId                  m_baseId = 0;
+        Compression                 m_compression = Compression::None;
+        std::uint64_t               m_recordCount = 0;
+        std::uint64_t               m_payloadSize = 0;
+        std::string                 m_block;            // current block of the payload
+        std::deque<std::future<PackedBlock>> m_packingBlocks; // in the file order
+        size_t                      m_maxPackingBlockCount = 0; // compressed in parallel
+        std::vector<BlockEntry>     m_blockTable;       // of written blocks
+        bool                        m_failed = false;
+    };
+
+    // True if the file starts with the binary snapshot signature
+    static bool is_binary_file(const std::string& filename);
+
+    // Reads only the header. Returns nothing if the file is not a valid snapshot.
+    static std::optional<SnapshotInfo> get_snapshot_info(const std::string& filename);
+
+    // Loads a full snapshot. Checksums are verified and records are split into `threadCount` chunks of similar size
+    // which are visited in parallel, so the visitor must be thread-safe if `threadCount` > 1
+    static bool load(const std::string& filename, const std::function<ItemVisitorProc>& visitor, const size_t threadCount = 1);
+
+    // Visits records of a delta snapshot in the order they were added
+    static bool load_delta(const std::string& filename, const std::function<ErasedItemVisitorProc>& erasedVisitor,
+        const std::function<ItemVisitorProc>& visitor);
+
+protected:
+    static constexpr char Signature[8] = { 'K', 'V', 'S', 'N', 'A', 'P', '\r', '\n' };
+    static constexpr std::uint32_t Version = 1;
+
+    static constexpr size_t BlockSize = 1 << 20;
+
+    static constexpr std::uint32_t ErasedValueSize = 0xFFFFFFFF;
+
+    struct FileHeader
+    {
+        char                        m_signature[sizeof(Signature)];
+        std::uint32_t               m_version;
+        std::uint32_t               m_headerSize;
+        std::uint64_t               m_recordCount;
+        std::uint64_t               m_payloadSize;
+        Crc32c::Value               m_blockTableChecksum;   // of the block table
+        Kind                        m_kind;
+        SnapshotId                  m_baseId;           // of a delta snapshot
+        Compression                 m_compression;
+        std::uint32_t               m_reserved;
+        Crc32c::Value               m_headerChecksum;   // of the previous fields; it is the id of a full snapshot
+    };
+
+    // Block located in the mapped file
+    struct StoredBlock
+    {
+        std::string_view            m_bytes;
+        size_t                      m_size;             // decompressed
+        Crc32c::Value               m_checksum;
+    };
+
+    struct RecordHeader
+    {
+        std::uint32_t               m_keySize;
+        std::uint32_t               m_valueSize;
+    };
+
+    // Validates the signature, the version and the checksum of the header
+    static bool read_header(const std::string_view data, FileHeader& header);
+
+    // Maps the file and verifies its header and checksums; blocks are verified and decompressed by `threadCount` threads.
+    // A compressed payload is decompressed into `payloadBuffer`, otherwise the payload points into the mapping.
+    static bool open_payload(const std::string& filename, MappedFile& mappedFile, std::unique_ptr<char[]>& payloadBuffer,
+        FileHeader& header, std::string_view& payload, const size_t threadCount);
+    // Verifies blocks in [firstBlock, lastBlock) and decompresses them into `payload` unless it is nullptr.
+    // Returns index of the first corrupted block, or `lastBlock`.
+    static size_t unpack_blocks(const std::vector<StoredBlock>& blocks, char* const payload, const size_t firstBlock, const size_t lastBlock);
+
+    // Checks bounds of all records and returns offsets of `chunkCount` + 1 chunk boundaries
+    static bool split_into_chunks(const std::string_view payload, const std::uint64_t recordCount, const size_t chunkCount,
+        const bool allowErased, std::vector<size_t>& chunkOffsets);
+    static void visit_records(const std::string_view payload, const std::function<ErasedItemVisitorProc>& erasedVisitor,
+        const std::function<ItemVisitorProc>& visitor);
+
+    static_assert(sizeof(FileHeader) == 56);
+    static_assert(sizeof(BlockEntry) == 8);
+    static_assert(sizeof(RecordHeader) == 8);
+};
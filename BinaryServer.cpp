@@ -0,0 +1,443 @@
+#include "BinaryServer.h"
+
+#include "DataEngine.h"
+#include "Logger.h"
+#include "WriteAheadLog.h"
+
+#ifdef _MSC_VER
+#  include <SDKDDKVer.h>
+#endif
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+static_assert(std::endian::native == std::endian::little, "Binary protocol is little-endian. Add byte swapping for other platforms");
+
+
+namespace
+{
+    constexpr size_t ReadBufferSize = 65536;
+    // Pipelined requests are not parsed further until this much of responses is sent
+    constexpr size_t MaxOutputSize = 1024 * 1024;
+
+    // Reading, writing and committing alternate, so handlers of a connection never run concurrently
+    class Connection : public std::enable_shared_from_this<Connection>
+    {
+    public:
+        Connection(boost::asio::ip::tcp::socket socket, DataEngine& engine, WriteAheadLog* const ptrLog,
+            boost::asio::thread_pool* const ptrWritePool) :
+            m_socket(std::move(socket)),
+            m_engine(engine),
+            m_ptrLog(ptrLog),
+            m_ptrWritePool(ptrWritePool),
+            m_input(ReadBufferSize)
+        {
+        }
+
+        void start()
+        {
+            read();
+        }
+
+    protected:
+        using Status = BinaryServer::Status;
+        using RequestHeader = BinaryServer::RequestHeader;
+
+        void read()
+        {
+            m_socket.async_read_some(boost::asio::buffer(m_input.data() + m_inputSize, m_input.size() - m_inputSize),
+                [self = shared_from_this()](const boost::system::error_code& error, const size_t size)
+                {
+                    if (error)
+                    {
+                        return; // the connection is closed by the client
+                    }
+                    self->m_inputSize += size;
+                    self->process();
+                }
+            );
+        }
+
+        void write()
+        {
+            boost::asio::async_write(m_socket, boost::asio::buffer(m_output),
+                [self = shared_from_this()](const boost::system::error_code& error, const size_t)
+                {
+                    if (error)
+                    {
+                        return;
+                    }
+                    self->m_output.clear();
+                    self->process();
+                }
+            );
+        }
+
+        // Logging waits for the disk: it runs in the write pool, then the connection continues in the io threads
+        void commit_changes()
+        {
+            boost::asio::post(*m_ptrWritePool, [self = shared_from_this()]()
+                {
+                    bool ok = false;
+                    try
+                    {
+                        ok = self->m_ptrLog->apply(self->m_engine, self->m_changes);
+                    }
+                    catch (...)
+                    {
+                    }
+
+                    boost::asio::post(self->m_socket.get_executor(), [self, ok]() { self->finish_changes(ok); });
+                }
+            );
+        }
+
+        void finish_changes(const bool ok)
+        {
+            for (const WriteAheadLog::Change& change : m_changes)
+            {
+                const bool found = change.m_operation == WriteAheadLog::Operation::Set || change.m_erased;
+                add_response(!ok ? Status::InternalError : found ? Status::Ok : Status::NotFound);
+            }
+            m_changes.clear();
+
+            process();
+        }
+
+        // Responds to complete requests received so far, or waits for more of them
+        void process()
+        {
+            if (!handle_requests())
+            {
+                return;
+            }
+
+            if (!m_changes.empty())
+            {
+                commit_changes();
+            }
+            else if (m_output.empty())
+            {
+                read();
+            }
+            else
+            {
+                write();
+            }
+        }
+
+        // Returns false if the connection must be closed
+        bool handle_requests()
+        {
+            while (m_output.size() < MaxOutputSize && m_inputSize - m_inputOffset >= sizeof(RequestHeader))
+            {
+                size_t requestSize = 0;
+                if (!get_request_size(m_inputOffset, requestSize))
+                {
+                    return false;
+                }
+
+                if (m_inputSize - m_inputOffset < requestSize)
+                {
+                    break;
+                }
+
+                RequestHeader header = {};
+                std::memcpy(&header, m_input.data() + m_inputOffset, sizeof(header));
+
+                const char* const key = m_input.data() + m_inputOffset + sizeof(header);
+                const std::string_view keyView(key, header.m_keySize);
+                const std::string_view valueView(key + header.m_keySize, header.m_valueSize);
+
+                // Consecutive modifications are logged with a single commit. Other requests wait for them:
+                // a `get` must see the modifications sent before it.
+                if (is_logged_write(header.m_command, keyView, valueView))
+                {
+                    m_changes.push_back({ header.m_command == BinaryServer::Command::Set ? WriteAheadLog::Operation::Set : WriteAheadLog::Operation::Erase,
+                        keyView, valueView });
+                }
+                else if (!m_changes.empty())
+                {
+                    break;
+                }
+                else
+                {
+                    handle_request(header.m_command, keyView, valueView);
+                }
+
+                m_inputOffset += requestSize;
+            }
+
+            // Keys and values of the changes point to the input buffer
+            if (!m_changes.empty())
+            {
+                return true;
+            }
+
+            // An incomplete request is moved to the beginning, the buffer is grown if the request does not fit
+            std::memmove(m_input.data(), m_input.data() + m_inputOffset, m_inputSize - m_inputOffset);
+            m_inputSize -= m_inputOffset;
+            m_inputOffset = 0;
+
+            if (m_inputSize >= sizeof(RequestHeader))
+            {
+                size_t requestSize = 0;
+                if (!get_request_size(0, requestSize))
+                {
+                    return false;
+                }
+                m_input.resize(std::max(m_input.size(), requestSize));
+            }
+            else if (m_input.size() > ReadBufferSize)
+            {
+                m_input.resize(ReadBufferSize);
+                m_input.shrink_to_fit();
+            }
+
+            return true;
+        }
+
+        // Size of the request with a complete header at `offset`. False if it breaks the size limit.
+        bool get_request_size(const size_t offset, size_t& requestSize) const
+        {
+            RequestHeader header = {};
+            std::memcpy(&header, m_input.data() + offset, sizeof(header));
+
+            requestSize = sizeof(header) + size_t(header.m_keySize) + header.m_valueSize;
+            if (requestSize > BinaryServer::MaxRequestSize)
+            {
+                LOG_WARN << "BinaryServer: request is too big: " << requestSize << " bytes; the connection is closed" << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        bool is_logged_write(const BinaryServer::Command command, const std::string_view key, const std::string_view value) const
+        {
+            using Command = BinaryServer::Command;
+
+            return m_ptrLog != nullptr && !key.empty() && (command == Command::Set || (command == Command::Erase && value.empty()));
+        }
+
+        void handle_request(const BinaryServer::Command command, const std::string_view key, const std::string_view value)
+        {
+            using Command = BinaryServer::Command;
+
+            const size_t responseOffset = m_output.size();
+            try
+            {
+                if (key.empty() || (command != Command::Set && !value.empty()))
+                {
+                    add_response(Status::BadRequest);
+                    return;
+                }
+
+                // Logged modifications are committed by `commit_changes()`
+                switch (command)
+                {
+                case Command::Get:
+                {
+                    // The value is written straight into the output buffer
+                    add_response(Status::Ok);
+                    const bool found = m_engine.read(key, [this](const std::string_view foundValue) { m_output.append(foundValue); });
+
+                    const size_t valueSize = m_output.size() - responseOffset - sizeof(BinaryServer::ResponseHeader);
+                    if (valueSize > std::numeric_limits<std::uint32_t>::max())
+                    {
+                        m_output.resize(responseOffset);
+                        add_response(Status::InternalError);
+                        return;
+                    }
+                    set_response(responseOffset, found ? Status::Ok : Status::NotFound, valueSize);
+                    return;
+                }
+
+                case Command::Set:
+                    m_engine.set(key, value);
+                    add_response(Status::Ok);
+                    return;
+
+                case Command::Erase:
+                    add_response(m_engine.erase(key) ? Status::Ok : Status::NotFound);
+                    return;
+
+                default:
+                    add_response(Status::BadRequest);
+                    return;
+                }
+            }
+            catch (...)
+            {
+                m_output.resize(responseOffset);
+                add_response(Status::InternalError);
+            }
+        }
+
+        void add_response(const Status status)
+        {
+            m_output.resize(m_output.size() + sizeof(BinaryServer::ResponseHeader));
+            set_response(m_output.size() - sizeof(BinaryServer::ResponseHeader), status, 0);
+        }
+
+        void set_response(const size_t responseOffset, const Status status, const size_t valueSize)
+        {
+            const BinaryServer::ResponseHeader header = { status, {}, static_cast<std::uint32_t>(valueSize) };
+            std::memcpy(m_output.data() + responseOffset, &header, sizeof(header));
+        }
+
+    protected:
+        boost::asio::ip::tcp::socket    m_socket;
+        DataEngine&                     m_engine;
+        WriteAheadLog* const            m_ptrLog;
+        boost::asio::thread_pool* const m_ptrWritePool;     // not null with the log
+
+        std::vector<char>               m_input;
+        size_t                          m_inputSize = 0;    // received bytes
+        size_t                          m_inputOffset = 0;  // received bytes handled
+        std::string                     m_output;           // responses not sent yet
+        std::vector<WriteAheadLog::Change> m_changes;       // being committed
+    };
+}
+
+
+class BinaryServerContext
+{
+public:
+    BinaryServerContext(DataEngine& engine, WriteAheadLog* const ptrLog, const size_t writeThreadCount) :
+        m_acceptor(m_ioContext),
+        m_engine(engine),
+        m_ptrLog(ptrLog)
+    {
+        if (m_ptrLog != nullptr)
+        {
+            m_ptrWritePool = std::make_unique<boost::asio::thread_pool>(writeThreadCount);
+        }
+    }
+
+    void accept()
+    {
+        m_acceptor.async_accept(
+            [this](const boost::system::error_code& error, boost::asio::ip::tcp::socket socket)
+            {
+                if (error == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+
+                if (error)
+                {
+                    LOG_WARN << "BinaryServer: failed accepting a connection: " << error.message() << std::endl;
+                }
+                else
+                {
+                    // Responses are small: they must not wait for more data to fill a packet
+                    boost::system::error_code optionError;
+                    socket.set_option(boost::asio::ip::tcp::no_delay(true), optionError);
+
+                    std::make_shared<Connection>(std::move(socket), m_engine, m_ptrLog, m_ptrWritePool.get())->start();
+                }
+
+                accept();
+            }
+        );
+    }
+
+public:
+    boost::asio::io_context         m_ioContext;
+    boost::asio::ip::tcp::acceptor  m_acceptor;
+    std::vector<std::thread>        m_threads;
+
+    DataEngine&                     m_engine;
+    WriteAheadLog* const            m_ptrLog;
+
+    // Commits logged modifications, so io threads do not wait for the disk. Destroyed before the io context:
+    // its queued handlers own connections.
+    std::unique_ptr<boost::asio::thread_pool> m_ptrWritePool;
+};
+
+
+BinaryServer::BinaryServer() = default;
+
+BinaryServer::~BinaryServer()
+{
+    stop();
+}
+
+bool BinaryServer::start(const std::string& host, const std::uint16_t port, DataEngine& engine, WriteAheadLog* const ptrLog,
+    const size_t threadCount)
+{
+    stop();
+
+    m_ptrContext = std::make_unique<BinaryServerContext>(engine, ptrLog, std::max<size_t>(threadCount, 1));
+    boost::asio::ip::tcp::acceptor& acceptor = m_ptrContext->m_acceptor;
+
+    boost::system::error_code error;
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address(host, error), port);
+    if (!error)
+    {
+        acceptor.open(endpoint.protocol(), error);
+    }
+    if (!error)
+    {
+        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), error);
+    }
+    if (!error)
+    {
+        acceptor.bind(endpoint, error);
+    }
+    if (!error)
+    {
+        acceptor.listen(boost::asio::socket_base::max_listen_connections, error);
+    }
+
+    if (error)
+    {
+        LOG_ERROR << "BinaryServer: failed listening " << host << ":" << port << "; " << error.message() << std::endl;
+        m_ptrContext.reset();
+        return false;
+    }
+
+    m_ptrContext->accept();
+
+    for (size_t threadIdx = 0; threadIdx < std::max<size_t>(threadCount, 1); ++threadIdx)
+    {
+        m_ptrContext->m_threads.emplace_back([&ioContext = m_ptrContext->m_ioContext]() { ioContext.run(); });
+    }
+
+    LOG_INFO << "BinaryServer: listening " << host << ":" << port << std::endl;
+    return true;
+}
+
+void BinaryServer::stop()
+{
+    if (!m_ptrContext)
+    {
+        return;
+    }
+
+    m_ptrContext->m_ioContext.stop();
+    for (std::thread& thread : m_ptrContext->m_threads)
+    {
+        thread.join();
+    }
+
+    // Commits in progress are finished before the log is closed; queued ones are dropped with their connections
+    if (m_ptrContext->m_ptrWritePool)
+    {
+        m_ptrContext->m_ptrWritePool->stop();
+        m_ptrContext->m_ptrWritePool->join();
+    }
+
+    // Connections are closed with their pending handlers
+    m_ptrContext.reset();
+
+    LOG_INFO << "BinaryServer: stopped" << std::endl;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+class BinaryServerContext;
+class DataEngine;
+class WriteAheadLog;
+
+
+// Compact length-prefixed protocol on a separate port: requests go to the engine without HTTP parsing,
+// routing and JSON. All numbers are little-endian.
+//
+//   request:  RequestHeader, key bytes, value bytes (`set` only)
+//   response: ResponseHeader, value bytes (`get` only)
+//
+// Requests may be pipelined: a client sends many of them without waiting for responses,
+// which come in the request order. Consecutive pipelined modifications are logged with a single commit.
+// A request breaking the size limits closes the connection.
+class BinaryServer
+{
+public:
+    enum class Command : std::uint8_t
+    {
+        Get = 1,
+        Set = 2,
+        Erase = 3,
+    };
+
+    enum class Status : std::uint8_t
+    {
+        Ok = 0,
+        NotFound = 1,
+        BadRequest = 2,     // unknown command, empty key, or a value in a `get` or `erase` request
+        InternalError = 3,  // including a failed write-ahead log write
+    };
+
+    struct RequestHeader
+    {
+        Command                     m_command;
+        std::uint8_t                m_reserved[3];
+        std::uint32_t               m_keySize;
+        std::uint32_t               m_valueSize;
+    };
+
+    struct ResponseHeader
+    {
+        Status                      m_status;
+        std::uint8_t                m_reserved[3];
+        std::uint32_t               m_valueSize;
+    };
+
+    static constexpr size_t MaxRequestSize = 64 * 1024 * 1024; // including the header
+
+public:
+    BinaryServer();
+    ~BinaryServer();
+
+    // Accepts connections in `threadCount` background threads. Modifications are logged to `ptrLog`
+    // before they are acknowledged, if it is not null, by `threadCount` more threads.
+    // Returns false if the port can not be listened.
+    bool start(const std::string& host, const std::uint16_t port, DataEngine& engine, WriteAheadLog* const ptrLog,
+        const size_t threadCount);
+
+    // Closes connections and waits for the threads
+    void stop();
+
+protected:
+    std::unique_ptr<BinaryServerContext> m_ptrContext;
+
+    static_assert(sizeof(RequestHeader) == 12);
+    static_assert(sizeof(ResponseHeader) == 8);
+};
@@ -0,0 +1,87 @@
+#include "BloomFilter.h"
+#include "Logger.h"
+#include "utils/bit.h"
+
+#include <algorithm>
+#include <iterator>
+
+
+namespace
+{
+    // Odd constants for deriving bit positions inside a block, as in "split block Bloom filters"
+    constexpr std::uint32_t BlockSalts[] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+    };
+
+    // The engine uses low hash bits for buckets, so spread all hash bits before using them here
+    std::uint64_t mix_hash(const size_t hash)
+    {
+        return static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+    }
+
+    std::uint32_t get_bit_mask(const std::uint64_t mixedHash, const size_t wordIdx)
+    {
+        const std::uint32_t key = static_cast<std::uint32_t>(mixedHash);
+        return std::uint32_t(1) << ((key * BlockSalts[wordIdx]) >> 27);
+    }
+}
+
+
+BloomFilter::BloomFilter(const size_t expectedItemCount) :
+    m_blockMask(bit_extra::round_up_to_power_of_2(std::max<size_t>(expectedItemCount * BitsPerItem / (sizeof(Block) * 8), 1)) - 1),
+    m_blocks(std::make_unique<Block[]>(m_blockMask + 1)),
+    m_maxCountedItemCount(std::max<size_t>(expectedItemCount * MaxLoadFactor / (CountedHashMask + 1), 1))
+{
+    static_assert(std::size(BlockSalts) == WordsPerBlock);
+}
+
+size_t BloomFilter::get_block_index(const std::uint64_t mixedHash) const
+{
+    return static_cast<size_t>(mixedHash >> 32) & m_blockMask;
+}
+
+void BloomFilter::insert(const size_t hash)
+{
+    const std::uint64_t mixedHash = mix_hash(hash);
+    Block& block = m_blocks[get_block_index(mixedHash)];
+
+    bool isNewItem = false;
+    for (size_t wordIdx = 0; wordIdx < WordsPerBlock; ++wordIdx)
+    {
+        const Word bit = get_bit_mask(mixedHash, wordIdx);
+        std::atomic<Word>& word = block.m_words[wordIdx];
+
+        // Do not dirty the cache line if the bit is already set: keys are often set repeatedly
+        if ((word.load(std::memory_order_relaxed) & bit) == 0)
+        {
+            word.fetch_or(bit, std::memory_order_release);
+            isNewItem = true;
+        }
+    }
+
+    // Block index and bit positions use other hash bits
+    if (isNewItem && ((mixedHash >> 20) & CountedHashMask) == 0
+        && m_countedItemCount.fetch_add(1, std::memory_order_relaxed) + 1 == m_maxCountedItemCount)
+    {
+        m_full.store(true, std::memory_order_relaxed);
+        LOG_WARN << "BloomFilter: about " << m_maxCountedItemCount * (CountedHashMask + 1)
+            << " keys are inserted, the filter is full and is not used any more" << std::endl;
+    }
+}
+
+bool BloomFilter::may_contain(const size_t hash) const
+{
+    const std::uint64_t mixedHash = mix_hash(hash);
+    const Block& block = m_blocks[get_block_index(mixedHash)];
+
+    for (size_t wordIdx = 0; wordIdx < WordsPerBlock; ++wordIdx)
+    {
+        if ((block.m_words[wordIdx].load(std::memory_order_acquire) & get_bit_mask(mixedHash, wordIdx)) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+// Concurrent blocked Bloom filter. Every key sets 8 bits inside a single 32-byte block,
+// so a check touches one cache line. Bits are only ever set, so updates are lock-free
+// and elements cannot be removed.
+// The size is fixed. Distinct inserted keys are counted approximately; past `MaxLoadFactor` times
+// the expected count false positives exceed 10%, and the filter reports that it is full.
+class BloomFilter
+{
+public:
+    static constexpr size_t DefaultExpectedItemCount = 1 << 20;
+    static constexpr size_t MaxLoadFactor = 2;
+
+public:
+    explicit BloomFilter(const size_t expectedItemCount);
+
+    void insert(const size_t hash);
+
+    // False means the key was never inserted. True may be a false positive.
+    bool may_contain(const size_t hash) const;
+
+    // Once true, the filter stays full: reads should not check it any more. Keys are still inserted correctly.
+    bool is_full() const
+    {
+        return m_full.load(std::memory_order_relaxed);
+    }
+
+protected:
+    using Word = std::uint32_t;
+
+    static constexpr size_t WordsPerBlock = 8; // one bit per word is set for every key
+    static constexpr size_t BitsPerItem = 10;  // about 1% of false positives at the expected item count
+    // Only keys with these hash bits equal to zero are counted, so inserts rarely touch the shared counter
+    static constexpr std::uint64_t CountedHashMask = 1023;
+
+    struct alignas(WordsPerBlock * sizeof(Word)) Block
+    {
+        std::atomic<Word>       m_words[WordsPerBlock] = {};
+    };
+
+    size_t get_block_index(const std::uint64_t mixedHash) const;
+
+protected:
+    const size_t                m_blockMask;
+    std::unique_ptr<Block[]>    m_blocks;
+    const size_t                m_maxCountedItemCount;
+    std::atomic<size_t>         m_countedItemCount = 0; // about 1/1024 of the distinct inserted keys
+    std::atomic<bool>           m_full = false;
+
+    static_assert(std::atomic<Word>::is_always_lock_free);
+};
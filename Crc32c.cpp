@@ -0,0 +1,142 @@
+#include "Crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define CRC32C_HARDWARE_X64
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+#  include <nmmintrin.h>
+#endif
+
+
+namespace
+{
+    constexpr Crc32c::Value Polynomial = 0x82F63B78; // reversed 0x1EDC6F41
+
+    constexpr size_t SliceCount = 8;
+
+    using Table = std::array<std::array<Crc32c::Value, 256>, SliceCount>;
+
+    // Slicing-by-8: `Tables[n][byte]` is the checksum of `byte` followed by `n` zero bytes,
+    // so 8 bytes are processed by 8 independent lookups instead of a chain of 8
+    constexpr Table make_tables()
+    {
+        Table tables = {};
+        for (Crc32c::Value byte = 0; byte < 256; ++byte)
+        {
+            Crc32c::Value crc = byte;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? Polynomial : 0);
+            }
+            tables[0][byte] = crc;
+        }
+
+        for (size_t slice = 1; slice < SliceCount; ++slice)
+        {
+            for (size_t byte = 0; byte < 256; ++byte)
+            {
+                const Crc32c::Value previous = tables[slice - 1][byte];
+                tables[slice][byte] = tables[0][previous & 0xFF] ^ (previous >> 8);
+            }
+        }
+        return tables;
+    }
+
+    constexpr Table Tables = make_tables();
+
+    Crc32c::Value update_software(Crc32c::Value value, const unsigned char* bytes, size_t size)
+    {
+        for (; size >= SliceCount; size -= SliceCount, bytes += SliceCount)
+        {
+            std::uint32_t low = 0;
+            std::uint32_t high = 0;
+            std::memcpy(&low, bytes, sizeof(low)); // little-endian is checked by the file formats
+            std::memcpy(&high, bytes + sizeof(low), sizeof(high));
+            low ^= value;
+
+            value = Tables[7][low & 0xFF] ^ Tables[6][(low >> 8) & 0xFF] ^ Tables[5][(low >> 16) & 0xFF] ^ Tables[4][low >> 24]
+                ^ Tables[3][high & 0xFF] ^ Tables[2][(high >> 8) & 0xFF] ^ Tables[1][(high >> 16) & 0xFF] ^ Tables[0][high >> 24];
+        }
+
+        for (; size != 0; --size, ++bytes)
+        {
+            value = Tables[0][(value ^ *bytes) & 0xFF] ^ (value >> 8);
+        }
+        return value;
+    }
+
+#ifdef CRC32C_HARDWARE_X64
+
+#  ifndef _MSC_VER
+    __attribute__((target("sse4.2")))
+#  endif
+    Crc32c::Value update_hardware(Crc32c::Value value, const unsigned char* bytes, size_t size)
+    {
+        std::uint64_t value64 = value;
+        for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t), bytes += sizeof(std::uint64_t))
+        {
+            std::uint64_t word = 0;
+            std::memcpy(&word, bytes, sizeof(word));
+            value64 = _mm_crc32_u64(value64, word);
+        }
+
+        value = static_cast<Crc32c::Value>(value64);
+        for (; size != 0; --size, ++bytes)
+        {
+            value = _mm_crc32_u8(value, *bytes);
+        }
+        return value;
+    }
+
+    bool is_hardware_supported()
+    {
+#  ifdef _MSC_VER
+        int cpuInfo[4] = {};
+        __cpuid(cpuInfo, 1);
+        return (cpuInfo[2] & (1 << 20)) != 0; // ECX bit 20: SSE4.2
+#  else
+        return __builtin_cpu_supports("sse4.2");
+#  endif
+    }
+
+#endif
+
+    using UpdateProc = Crc32c::Value(Crc32c::Value value, const unsigned char* bytes, size_t size);
+
+    UpdateProc* select_update()
+    {
+#ifdef CRC32C_HARDWARE_X64
+        if (is_hardware_supported())
+        {
+            return update_hardware;
+        }
+#endif
+        return update_software;
+    }
+
+    // Selected on first use, so checksums may be calculated during static initialization too
+    UpdateProc* get_update()
+    {
+        static UpdateProc* const update = select_update();
+        return update;
+    }
+}
+
+
+Crc32c::Value Crc32c::update(const Value crc, const void* const data, const size_t size)
+{
+    return ~get_update()(~crc, static_cast<const unsigned char*>(data), size);
+}
+
+bool Crc32c::is_hardware_accelerated()
+{
+#ifdef CRC32C_HARDWARE_X64
+    return get_update() == update_hardware;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// CRC-32C (Castagnoli) checksum of snapshot and write-ahead log files.
+// Uses the SSE4.2 `crc32` instruction if the CPU supports it, a slicing-by-8 table otherwise.
+class Crc32c
+{
+public:
+    using Value = std::uint32_t;
+
+    // Continues the checksum of previous data. Start with `crc` = 0.
+    static Value update(const Value crc, const void* const data, const size_t size);
+
+    static Value calculate(const void* const data, const size_t size)
+    {
+        return update(0, data, size);
+    }
+
+    static bool is_hardware_accelerated();
+};
@@ -1,161 +1,222 @@
 #include "DataEngine.h"
 #include "AllocatorFactory.h"
+#include "KeyValueNode.h"
 
-#include "utils/stl.h"
+#include "MappedDataEngine.h"
+#include "OpenAddressingDataEngine.h"
+#include "SplitOrderedDataEngine.h"
 
-#include <assert.h>
+#include <algorithm>
+#include <utility>
 
 
-DataEngine::DataEngine(const size_t bucketCount):
-    m_buckets(bucketCount)
+std::unique_ptr<DataEngine> DataEngine::create(const Implementation implementation, const size_t initialCapacity, const std::string& mappedFilename)
 {
+    switch (implementation)
+    {
+    case Implementation::SplitOrderedList:
+        return std::make_unique<SplitOrderedDataEngine>(initialCapacity);
+    case Implementation::OpenAddressing:
+        return std::make_unique<OpenAddressingDataEngine>(initialCapacity);
+    case Implementation::Mapped:
+    {
+        auto ptrEngine = std::make_unique<MappedDataEngine>(initialCapacity);
+        if (!ptrEngine->open(mappedFilename))
+        {
+            return nullptr;
+        }
+        return ptrEngine;
+    }
+    }
+
+    return nullptr;
 }
 
 DataEngine::~DataEngine()
 {
-    for (const AtomicNodePtr& bucket : m_buckets)
+    ErasedKey* erasedKey = m_erasedKeyStack.load(std::memory_order_relaxed);
+    while (erasedKey != nullptr)
     {
-        ListNode* node = bucket.load(std::memory_order_relaxed);
+        delete std::exchange(erasedKey, erasedKey->m_next);
+    }
+}
 
-        while (node != nullptr)
+bool DataEngine::is_restored() const
+{
+    return false;
+}
+
+std::optional<DataEngine::String> DataEngine::get(const std::string_view key) const
+{
+    std::optional<String> value;
+
+    read(key, [&value](const std::string_view valueView)
         {
-            ListNode* current = node;
-            node = node->m_next.load(std::memory_order_relaxed);
-            current->delete_self();
+            value.emplace(valueView, AllocatorFactory::get_allocator<char>());
         }
-    }
-    m_buckets.clear();
+    );
+
+    return value;
 }
 
-bool DataEngine::is_lock_free() const
+void DataEngine::enable_bloom_filter(const size_t expectedItemCount)
 {
-    if (!m_successReads.is_lock_free())
+    // Keys of a restored engine may be more than expected: the filter must have room for new ones too
+    size_t restoredItemCount = 0;
+    if (is_restored())
     {
-        return false;
+        enumerate_values([&restoredItemCount](const std::string_view /*key*/, const ValueBuffer& /*value*/)
+            {
+                ++restoredItemCount;
+            }
+        );
     }
 
-    AtomicNodePtr ptrNode;
-    if (!ptrNode.is_lock_free())
+    auto ptrBloomFilter = std::make_unique<BloomFilter>(std::max(expectedItemCount, restoredItemCount * BloomFilter::MaxLoadFactor));
+
+    if (is_restored())
     {
-        return false;
+        enumerate_values([&ptrBloomFilter](const std::string_view key, const ValueBuffer& /*value*/)
+            {
+                ptrBloomFilter->insert(Hash()(key));
+            }
+        );
     }
 
-    std::atomic<ListNode*> ptrNode2;
-    if (!ptrNode2.is_lock_free())
+    m_ptrBloomFilter = std::move(ptrBloomFilter);
+}
+
+bool DataEngine::read(const std::string_view key, const std::function<ReadVisitorProc>& visitor) const
+{
+    const size_t hash = Hash()(key);
+
+    if (m_ptrBloomFilter && !m_ptrBloomFilter->is_full() && !m_ptrBloomFilter->may_contain(hash))
     {
+        m_bloomFilterRejectedReads.increment();
+        m_failedReads.increment();
         return false;
     }
 
-    ListNode::AtomicSharedConstStringPtr ptrValue;
-    if (!ptrValue.is_lock_free())
+    const bool found = lookup(key, hash, visitor);
+
+    if (found)
     {
-        return false;
+        m_successReads.increment();
+    }
+    else
+    {
+        m_failedReads.increment();
+        if (m_ptrBloomFilter && !m_ptrBloomFilter->is_full())
+        {
+            m_bloomFilterFalsePositiveReads.increment(); // or the key was erased: erased keys stay in the filter
+        }
     }
 
-    return true;
+    return found;
 }
 
-std::optional<DataEngine::String> DataEngine::get(const std::string_view key) const
+void DataEngine::set(const std::string_view key, const std::string_view value)
 {
-    const size_t buckedIdx = Hash()(key) % m_buckets.size();
-    const ListNode* node = m_buckets[buckedIdx].load(std::memory_order_relaxed);
+    const size_t hash = Hash()(key);
 
-    while (node != nullptr)
+    // The filter is updated first, so readers never miss a key which is already stored.
+    // It is updated when it is full too: readers may still check it until they see that.
+    if (m_ptrBloomFilter)
     {
-        if (node->m_key == key)
-        {
-            m_successReads.fetch_add(1, std::memory_order_relaxed);
-
-            const auto ptrValueCopy = node->get_value_const_ref();
-            return *ptrValueCopy;
-        }
-
-        node = node->m_next.load(std::memory_order_relaxed);
+        m_ptrBloomFilter->insert(hash);
     }
 
-    m_failedReads.fetch_add(1, std::memory_order_relaxed);
-    return {};
+    store(key, hash, value, m_changeEpoch.load(std::memory_order_relaxed));
 }
 
-DataEngine::NodeUniquePtr DataEngine::create_node(const std::string_view key, const std::string_view value)
+bool DataEngine::erase(const std::string_view key)
 {
-    ListNode::NodeAllocator allocator = AllocatorFactory::get_allocator<ListNode>();
+    const bool erased = remove(key, Hash()(key));
 
-    NodeDeleter* deleter = [](ListNode* const ptr)
+    // Read after the removal: the epoch is not older than the one `get_erased_keys()` may need
+    if (erased && m_trackErasedKeys)
     {
-        ptr->delete_self();
-        return;
-    };
-
-    ListNode* raw_ptr = std_extra::allocate_new(
-        allocator,
-        allocator,
-        String(key, allocator),
-        std::allocate_shared<const String>(allocator, String(value, allocator))
+        ErasedKey* const erasedKey = new ErasedKey{ nullptr, m_changeEpoch.load(std::memory_order_relaxed), std::string(key) };
+
+        erasedKey->m_next = m_erasedKeyStack.load(std::memory_order_relaxed);
+        while (!m_erasedKeyStack.compare_exchange_weak(erasedKey->m_next, erasedKey, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    return erased;
+}
+
+void DataEngine::enumerate(const std::function<EnumerateVisitorProc>& visitor) const
+{
+    enumerate_values([&visitor](const std::string_view key, const ValueBuffer& value)
+        {
+            visitor(key, value.get_view());
+        }
     );
+}
 
-    NodeUniquePtr ptrNewNode = std::unique_ptr<ListNode, NodeDeleter*>(raw_ptr, deleter);
-    return ptrNewNode;
+void DataEngine::enable_change_tracking()
+{
+    m_trackErasedKeys = true;
 }
 
-void DataEngine::set(const std::string_view key, const std::string_view value)
+DataEngine::ChangeEpoch DataEngine::advance_change_epoch()
+{
+    return m_changeEpoch.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+std::vector<std::string> DataEngine::get_erased_keys(const ChangeEpoch sinceEpoch)
 {
-    NodeUniquePtr ptrNewNode = create_node(key, value);
+    std::vector<std::string> erasedKeys;
 
-    const size_t buckedIdx = Hash()(key) % m_buckets.size();
-    ListNode* node = nullptr;
+    std::lock_guard<std::mutex> lock(m_erasedKeysProtect);
 
-    const bool exchangedFirst = m_buckets[buckedIdx].compare_exchange_strong(node, ptrNewNode.get(), std::memory_order_relaxed, std::memory_order_relaxed);
-    if (exchangedFirst)
+    // The stack is newest first: keys are appended in the order they were erased
+    const size_t takenIdx = m_erasedKeys.size();
+    ErasedKey* erasedKey = m_erasedKeyStack.exchange(nullptr, std::memory_order_acquire);
+    while (erasedKey != nullptr)
     {
-        // we have put the first element in the bucket
-        assert(node == nullptr);
-        ptrNewNode.release(); // do not own the node any more. Its owner is the bucket list now.
-        return;
+        m_erasedKeys.emplace_back(erasedKey->m_changeEpoch, std::move(erasedKey->m_key));
+        delete std::exchange(erasedKey, erasedKey->m_next);
     }
-    assert(node != nullptr);
+    std::reverse(m_erasedKeys.begin() + static_cast<std::ptrdiff_t>(takenIdx), m_erasedKeys.end());
 
-    while (true)
-    {
-        if (node->m_key == key)
+    // Older keys were erased before the previous snapshot: they are not needed any more
+    std::erase_if(m_erasedKeys, [sinceEpoch](const auto& erasedKey)
         {
-            node->m_ptrValue.store(ptrNewNode->m_ptrValue, std::memory_order_relaxed);
-            return; // ptrNewNode is deallocated automatically here
+            return erasedKey.first < sinceEpoch;
         }
+    );
 
-        ListNode* nextNode = nullptr;
-        const bool exchanged = node->m_next.compare_exchange_strong(nextNode, ptrNewNode.get(), std::memory_order_relaxed, std::memory_order_relaxed);
-        if (exchanged)
-        {
-            // we have put the element at the end of the bucket list
-            assert(nextNode == nullptr);
-            ptrNewNode.release(); // do not own the node any more. Its owner is the bucket list now.
-            return;
-        }
-        assert(nextNode != nullptr);
-        node = nextNode;
+    erasedKeys.reserve(m_erasedKeys.size());
+    for (const auto& [changeEpoch, key] : m_erasedKeys)
+    {
+        erasedKeys.push_back(key);
     }
+    return erasedKeys;
 }
 
-void DataEngine::enumerate(const std::function<EnumerateVisitorProc>& visitor) const
+void DataEngine::enumerate_changes(const ChangeEpoch sinceEpoch, const std::function<EnumerateVisitorProc>& visitor) const
 {
-    for (const AtomicNodePtr& bucket : m_buckets)
-    {
-        const ListNode* node = bucket.load(std::memory_order_relaxed);
-
-        while (node != nullptr)
+    enumerate_values([sinceEpoch, &visitor](const std::string_view key, const ValueBuffer& value)
         {
-            const auto ptrValueCopy = node->get_value_const_ref();
-
-            visitor(node->m_key, *ptrValueCopy);
-
-            node = node->m_next.load(std::memory_order_relaxed);
+            if (value.get_change_epoch() >= sinceEpoch)
+            {
+                visitor(key, value.get_view());
+            }
         }
-    }
+    );
 }
 
 DataEngine::AccessStatistics DataEngine::get_read_statistics() const
 {
     // No need in full consistency here
-    return { m_successReads.load(std::memory_order_relaxed), m_failedReads.load(std::memory_order_relaxed) };
+    return { m_successReads.load(), m_failedReads.load() };
+}
+
+DataEngine::BloomFilterStatistics DataEngine::get_bloom_filter_statistics() const
+{
+    const bool enabled = m_ptrBloomFilter != nullptr && !m_ptrBloomFilter->is_full();
+    return { enabled, m_bloomFilterRejectedReads.load(), m_bloomFilterFalsePositiveReads.load() };
 }
@@ -1,24 +1,35 @@
 #pragma once
 
 #include "Allocator.h"
+#include "BloomFilter.h"
+#include "ShardedCounter.h"
 
 #include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-#include "utils/stl.h" // for std::atomic<std::shared_ptr> in non-compatible compilers
 
+class ValueBuffer;
 
+
+// Interface of the key-value storage. Implementation is selected at startup.
 class DataEngine
 {
 public:
     using IntegerCounter = std::uint64_t;
 
+    // Every value is stamped with the epoch current when it was set. It is used to find values
+    // changed since the last snapshot.
+    using ChangeEpoch = std::uint32_t;
+
     template<typename T>
     using Allocator = SeparateHeapAllocator<T>;
     using String = std::basic_string<char, std::char_traits<char>, Allocator<char>>;
@@ -29,72 +40,115 @@ public:
         IntegerCounter  m_failedOperations  = 0;
     };
 
+    struct BloomFilterStatistics
+    {
+        bool            m_enabled           = false;
+        IntegerCounter  m_rejectedReads     = 0; // reads answered by the filter alone
+        IntegerCounter  m_falsePositiveReads = 0; // reads passed by the filter but not found
+    };
+
+    enum class Implementation
+    {
+        SplitOrderedList,   // buckets over a single lock-free sorted linked list
+        OpenAddressing,     // cache-line grouped open-addressing table with hash fingerprints
+        Mapped,             // chained table in a memory-mapped file, reused by the next start
+    };
+
+    // Initial capacity is only a hint. Storage grows automatically.
+    static constexpr size_t DefaultInitialCapacity = 1024;
+
 public:
-    DataEngine(const size_t bucketCount);
-    ~DataEngine();
+    // `mappedFilename` is used by `Implementation::Mapped` only. Returns nullptr if the engine can not be created.
+    static std::unique_ptr<DataEngine> create(const Implementation implementation, const size_t initialCapacity = DefaultInitialCapacity,
+        const std::string& mappedFilename = {});
 
-    bool is_lock_free() const;
+    virtual ~DataEngine();
 
+    virtual bool is_lock_free() const = 0;
+
+    // True if the data of the previous run was kept by the engine itself, so it must not be loaded again
+    virtual bool is_restored() const;
+
+    // Negative lookups are answered without touching the storage. Must be called before the engine is used;
+    // keys of a restored engine are added to the filter. The filter is not used any more once it is full
+    // (see `BloomFilter::MaxLoadFactor`), so `expectedItemCount` should cover the keys the engine will hold.
+    void enable_bloom_filter(const size_t expectedItemCount = BloomFilter::DefaultExpectedItemCount);
+
+    // Returns a copy of the value
     std::optional<String> get(const std::string_view key) const;
 
+    using ReadVisitorProc = void(const std::string_view value);
+
+    // Calls `visitor` with the value stored in the engine, without copying it.
+    // The view is valid only inside the visitor. Returns false if the key was not found.
+    bool read(const std::string_view key, const std::function<ReadVisitorProc>& visitor) const;
+
     void set(const std::string_view key, const std::string_view value);
 
+    // Returns false if the key was not found
+    bool erase(const std::string_view key);
+
     using EnumerateVisitorProc = void(const std::string_view key, const std::string_view value);
 
     void enumerate(const std::function<EnumerateVisitorProc>& visitor) const;
 
+    // Erased keys are remembered for `get_erased_keys()`. Must be called before the engine is used.
+    void enable_change_tracking();
+
+    // Values set from now on are stamped with the returned epoch
+    ChangeEpoch advance_change_epoch();
+
+    // Keys erased since `sinceEpoch` was returned by `advance_change_epoch()`; keys erased before it are forgotten.
+    // Apply them before values of `enumerate_changes()`: a key erased and set again is returned by both.
+    std::vector<std::string> get_erased_keys(const ChangeEpoch sinceEpoch);
+
+    // Visits values set since `sinceEpoch`. Changes made during the enumeration may be visited or not.
+    // All values are walked to find them: it costs as much as `enumerate()`, whatever the number of changes.
+    void enumerate_changes(const ChangeEpoch sinceEpoch, const std::function<EnumerateVisitorProc>& visitor) const;
+
     AccessStatistics get_read_statistics() const;
 
-protected:
-    class ListNode
-    {
-    public:
-        using NodeAllocator = Allocator<ListNode>;
-        using AtomicSharedConstStringPtr = std::atomic<std::shared_ptr<const String>>;
-
-    public:
-        const String                    m_key;
-        AtomicSharedConstStringPtr      m_ptrValue;
-        std::atomic<ListNode*>          m_next = nullptr;
-        NodeAllocator                   m_allocator;
-
-        //static_assert(AtomicSharedConstStringPtr::is_always_lock_free);
-        static_assert(std::atomic<ListNode*>::is_always_lock_free);
-
-    public:
-        ListNode(const NodeAllocator& allocator, String&& key, std::shared_ptr<const String>&& ptrValue) :
-            m_key(key), m_ptrValue(ptrValue), m_allocator(allocator)
-        {
-        }
-
-        void delete_self()
-        {
-            NodeAllocator alloc(m_allocator);
-            std::allocator_traits<NodeAllocator>::destroy(alloc, std::to_address(this));
-            std::allocator_traits<NodeAllocator>::deallocate(alloc, this, 1);
-        }
-
-        std::shared_ptr<const String> get_value_const_ref() const
-        {
-            return m_ptrValue.load(std::memory_order_relaxed);
-        }
-    };
+    BloomFilterStatistics get_bloom_filter_statistics() const;
 
-    using AtomicNodePtr = std::atomic<ListNode*>;
+protected:
     using Hash = std::hash<std::string_view>;
-    using NodeDeleter = void(ListNode* const ptr);
-    using NodeUniquePtr = std::unique_ptr<ListNode, NodeDeleter*>;
 
-protected:
-    NodeUniquePtr create_node(const std::string_view key, const std::string_view value);
+    // `hash` is `Hash()(key)`, it is calculated only once per operation
+
+    // Calls `visitor` if the key is found. It must not be called more than once.
+    virtual bool lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const = 0;
+
+    virtual void store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch) = 0;
+
+    // Returns false if the key was not found
+    virtual bool remove(const std::string_view key, const size_t hash) = 0;
+
+    using EnumerateValuesVisitorProc = void(const std::string_view key, const ValueBuffer& value);
+
+    virtual void enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const = 0;
 
 protected:
-    std::vector<AtomicNodePtr>          m_buckets;
+    // Global statistics. Counters are sharded: every reader thread bumps its own cache line.
+    mutable ShardedCounter              m_successReads;
+    mutable ShardedCounter              m_failedReads;
+
+    std::unique_ptr<BloomFilter>        m_ptrBloomFilter; // optional
+    mutable ShardedCounter              m_bloomFilterRejectedReads;
+    mutable ShardedCounter              m_bloomFilterFalsePositiveReads;
+
+    // Erasing threads push keys to a lock-free stack, `get_erased_keys()` takes them all at once
+    struct ErasedKey
+    {
+        ErasedKey*                  m_next = nullptr;
+        ChangeEpoch                 m_changeEpoch = 0;
+        std::string                 m_key;
+    };
 
-    // Global statistics:
-    mutable std::atomic<IntegerCounter> m_successReads = 0;
-    mutable std::atomic<IntegerCounter> m_failedReads  = 0;
+    std::atomic<ChangeEpoch>            m_changeEpoch = 1;
+    bool                                m_trackErasedKeys = false;
+    std::atomic<ErasedKey*>             m_erasedKeyStack = nullptr; // newest first
+    std::mutex                          m_erasedKeysProtect; // taken by `get_erased_keys()` only
+    std::vector<std::pair<ChangeEpoch, std::string>> m_erasedKeys; // taken from the stack, protected by m_erasedKeysProtect
 
-    static_assert(AtomicNodePtr::is_always_lock_free);
-    static_assert(std::atomic<IntegerCounter>::is_always_lock_free);
+    static_assert(std::is_same_v<ShardedCounter::Value, IntegerCounter>);
 };
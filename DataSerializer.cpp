@@ -1,15 +1,17 @@
 #include "DataSerializer.h"
 
+#include "FileSync.h"
 #include "Logger.h"
 #include "utils/stdlib.h"
 
-#include "rapidjson/document.h"
 #include "rapidjson/filereadstream.h"
 #include "rapidjson/filewritestream.h"
+#include "rapidjson/reader.h"
 #include "rapidjson/writer.h"
 
 #include <cstdio>
 #include <filesystem>
+#include <string>
 
 
 #ifdef _MSC_VER
@@ -23,31 +25,160 @@ namespace
 }
 
 
-class DataSerializerDocument : public rapidjson::Document
+// SAX handler: every item is passed to the visitor as soon as it is parsed,
+// so memory usage does not depend on the file size
+class DataSerializerLoadHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, DataSerializerLoadHandler>
 {
+public:
+    explicit DataSerializerLoadHandler(const std::function<DataSerializer::ItemVisitorProc>& visitor) :
+        m_visitor(visitor)
+    {
+    }
+
+    bool StartObject()
+    {
+        if (m_state != State::Root)
+        {
+            return fail("JSON object element value is not a string. Type: object");
+        }
+
+        m_state = State::Name;
+        return true;
+    }
+
+    bool Key(const char* const str, const rapidjson::SizeType length, const bool /*copy*/)
+    {
+        m_name.assign(str, length); // parser reuses the string buffer for the value
+        m_state = State::Value;
+        return true;
+    }
+
+    bool String(const char* const str, const rapidjson::SizeType length, const bool /*copy*/)
+    {
+        if (m_state != State::Value)
+        {
+            return fail("JSON root element is not an object. Type: string");
+        }
+
+        m_visitor(m_name, std::string_view(str, length));
+        ++m_itemCount;
+        m_state = State::Name;
+        return true;
+    }
+
+    bool EndObject(const rapidjson::SizeType /*memberCount*/)
+    {
+        m_state = State::Done;
+        return true;
+    }
+
+    // All other value types
+    bool Default()
+    {
+        return fail(m_state == State::Root ? "JSON root element is not an object" : "JSON object element value is not a string");
+    }
+
+    const std::string& get_error() const
+    {
+        return m_error;
+    }
+
+    size_t get_item_count() const
+    {
+        return m_itemCount;
+    }
+
+protected:
+    enum class State
+    {
+        Root,
+        Name,
+        Value,
+        Done,
+    };
+
+    bool fail(const char* const message)
+    {
+        m_error = message;
+        if (m_state == State::Value)
+        {
+            m_error += "; name: " + m_name;
+        }
+        return false;
+    }
+
+protected:
+    const std::function<DataSerializer::ItemVisitorProc>&   m_visitor;
+    State                                                   m_state = State::Root;
+    std::string                                             m_name;
+    std::string                                             m_error;
+    size_t                                                  m_itemCount = 0;
 };
 
 
-DataSerializer::Document::Document() :
-    m_ptrDocument(std::make_unique<DataSerializerDocument>())
+class DataSerializerWriter
+{
+public:
+    explicit DataSerializerWriter(std::FILE* const file) :
+        m_stream(file, m_buffer, sizeof(m_buffer)),
+        m_writer(m_stream)
+    {
+    }
+
+public:
+    char                                            m_buffer[FileStreamBufferSize];
+    rapidjson::FileWriteStream                      m_stream;
+    rapidjson::Writer<rapidjson::FileWriteStream>   m_writer;
+};
+
+
+DataSerializer::Writer::Writer() :
+    m_file(nullptr)
 {
-    m_ptrDocument->SetObject();
 }
 
-DataSerializer::Document::~Document() = default;
+DataSerializer::Writer::~Writer() = default;
 
-void DataSerializer::Document::add(const std::string_view name, const std::string_view value)
+bool DataSerializer::Writer::open(const std::string& filename)
 {
-    const rapidjson::Document::StringRefType nameRef(name.data(), static_cast<rapidjson::SizeType>(name.size()));
-    const rapidjson::Document::StringRefType valueRef(value.data(), static_cast<rapidjson::SizeType>(value.size()));
-    auto& allocator = m_ptrDocument->GetAllocator();
+    m_filename = filename;
+    m_file.m_file = std::fopen(filename.c_str(), "wb");
+    if (m_file.m_file == nullptr)
+    {
+        LOG_ERROR << "Failed opening the file for writing: " << filename << std::endl;
+        return false;
+    }
 
-    m_ptrDocument->AddMember(nameRef, valueRef, allocator);
+    m_ptrWriter = std::make_unique<DataSerializerWriter>(m_file.m_file);
+    return m_ptrWriter->m_writer.StartObject();
+}
+
+bool DataSerializer::Writer::add(const std::string_view name, const std::string_view value)
+{
+    auto& writer = m_ptrWriter->m_writer;
+    return writer.Key(name.data(), static_cast<rapidjson::SizeType>(name.size()))
+        && writer.String(value.data(), static_cast<rapidjson::SizeType>(value.size()));
 }
 
-const DataSerializerDocument& DataSerializer::Document::get_internal_document() const
+bool DataSerializer::Writer::finish()
 {
-    return *m_ptrDocument;
+    if (m_ptrWriter == nullptr)
+    {
+        return false;
+    }
+
+    const bool completed = m_ptrWriter->m_writer.EndObject();
+    m_ptrWriter->m_stream.Flush();
+
+    const bool ok = completed && std::fflush(m_file.m_file) == 0 && std::ferror(m_file.m_file) == 0 && FileSync::sync(m_file.m_file, m_filename);
+    m_ptrWriter.reset();
+    m_file.close();
+
+    if (!ok)
+    {
+        LOG_ERROR << "Failed writing the file: " << m_filename << std::endl;
+    }
+    return ok;
 }
 
 bool DataSerializer::load(const std::string& filename, const std::function<ItemVisitorProc>& visitor)
@@ -68,68 +199,24 @@ bool DataSerializer::load(const std::string& filename, const std::function<ItemV
     char readBuffer[FileStreamBufferSize];
     rapidjson::FileReadStream stream(file.m_file, readBuffer, sizeof(readBuffer));
 
-    rapidjson::Document doc;
-    doc.ParseStream(stream);
+    DataSerializerLoadHandler handler(visitor);
+    rapidjson::Reader reader;
+    reader.Parse(stream, handler);
 
     file.close();
 
-    if (doc.HasParseError())
-    {
-        LOG_ERROR << "File parsing failed: " << filename << std::endl;
-        return false;
-    }
-
-    if (!doc.IsObject())
-    {
-        LOG_ERROR << "JSON root element is not an object. Type: " << static_cast<int>(doc.GetType()) << std::endl;
-        return false;
-    }
-
-    const auto iterEnd = doc.MemberEnd();
-    for (auto iter = doc.MemberBegin(); iter != iterEnd; ++iter)
+    if (reader.HasParseError())
     {
-        const auto& name = iter->name;
-        if (!name.IsString())
+        if (!handler.get_error().empty())
         {
-            LOG_ERROR << "JSON object element name is not a string. Type: "
-                << static_cast<int>(name.GetType()) << std::endl;
-            return false;
+            LOG_ERROR << handler.get_error() << std::endl;
         }
 
-        const auto& value = iter->value;
-        if (!value.IsString())
-        {
-            LOG_ERROR << "JSON object element value is not a string. Type: "
-                << static_cast<int>(value.GetType()) << "; name: " << name.GetString() << std::endl;
-            return false;
-        }
-
-        const std::string_view nameView = { name.GetString(), name.GetStringLength() };
-        const std::string_view valueView = { value.GetString(), value.GetStringLength() };
-
-        visitor(nameView, valueView);
-    }
-
-    return true;
-}
-
-bool DataSerializer::save(const std::string& filename, const Document& document)
-{
-    stdlib_extra::FileOwner file(std::fopen(filename.c_str(), "wb"));
-    if (file.m_file == nullptr)
-    {
-        LOG_ERROR << "Failed opening the file for writing: " << filename << std::endl;
+        // Items parsed before the error are already passed to the visitor
+        LOG_ERROR << "File parsing failed: " << filename << "; offset: " << reader.GetErrorOffset()
+            << "; loaded items: " << handler.get_item_count() << std::endl;
         return false;
     }
 
-    char writeBuffer[FileStreamBufferSize];
-    rapidjson::FileWriteStream stream(file.m_file, writeBuffer, sizeof(writeBuffer));
-
-    rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
-    const auto& internalDocument = document.get_internal_document();
-    internalDocument.Accept(writer);
-
-    file.close();
-
     return true;
 }
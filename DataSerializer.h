@@ -1,12 +1,14 @@
 #pragma once
 
+#include "utils/stdlib.h"
+
 #include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
 
 
-class DataSerializerDocument;
+class DataSerializerWriter;
 
 
 class DataSerializer
@@ -14,21 +16,22 @@ class DataSerializer
 public:
     using ItemVisitorProc = void(const std::string_view name, const std::string_view value);
 
-    class Document
+    // Writes every item to the file right away, so memory usage does not depend on the number of items
+    class Writer
     {
     public:
-        Document();
-        ~Document();
-
-        void add(const std::string_view name, const std::string_view value);
+        Writer();
+        ~Writer();
 
-        const DataSerializerDocument& get_internal_document() const;
+        bool open(const std::string& filename);
+        bool add(const std::string_view name, const std::string_view value);
+        bool finish();
 
     protected:
-        std::unique_ptr<DataSerializerDocument> m_ptrDocument;
+        stdlib_extra::FileOwner                 m_file;
+        std::string                             m_filename;
+        std::unique_ptr<DataSerializerWriter>   m_ptrWriter;
     };
 
     static bool load(const std::string& filename, const std::function<ItemVisitorProc>& visitor);
-
-    static bool save(const std::string& filename, const Document& document);
 };
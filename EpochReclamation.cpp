@@ -0,0 +1,233 @@
+#include "EpochReclamation.h"
+
+#include <array>
+#include <vector>
+
+#include <assert.h>
+
+
+namespace
+{
+    using Epoch = std::uint64_t;
+
+    // Try advancing the global epoch after this number of retired objects in a thread
+    constexpr size_t RetireCountBetweenAdvances = 64;
+
+    // Objects retired in epoch E are safe to delete when the global epoch reaches E + 2
+    constexpr size_t LimboListCount = 3;
+
+    // Local epoch value format: (epoch << 1) | 1 when the thread is inside a guard; 0 otherwise
+    constexpr Epoch InactiveEpoch = 0;
+
+    struct RetiredObject
+    {
+        void*                           m_ptr = nullptr;
+        EpochReclamation::Deleter*      m_deleter = nullptr;
+    };
+
+    struct LimboList
+    {
+        Epoch                           m_epoch = 0;
+        std::vector<RetiredObject>      m_objects;
+
+        void delete_objects()
+        {
+            // Deleters are allowed to retire other objects, so iterate over a detached list
+            std::vector<RetiredObject> objects;
+            objects.swap(m_objects);
+
+            for (const RetiredObject& object : objects)
+            {
+                object.m_deleter(object.m_ptr);
+            }
+        }
+    };
+
+    // Records are never deleted while the process is running. A record of a finished thread
+    // is reused by a new thread, together with its not yet deleted retired objects.
+    struct ThreadRecord
+    {
+        std::atomic<Epoch>              m_localEpoch = InactiveEpoch;
+        std::atomic<bool>               m_inUse = true;
+        ThreadRecord*                   m_next = nullptr;
+
+        // Fields below are accessed only by the owner thread:
+        size_t                          m_guardDepth = 0;
+        size_t                          m_retireCount = 0;
+        std::array<LimboList, LimboListCount> m_limbo;
+    };
+
+    class Registry
+    {
+    public:
+        ~Registry()
+        {
+            // No threads are running here. Everything may be deleted.
+            ThreadRecord* record = m_records.load(std::memory_order_acquire);
+            while (record != nullptr)
+            {
+                ThreadRecord* current = record;
+                record = record->m_next;
+
+                for (LimboList& limbo : current->m_limbo)
+                {
+                    limbo.delete_objects();
+                }
+                delete current;
+            }
+        }
+
+        ThreadRecord* acquire_record()
+        {
+            for (ThreadRecord* record = m_records.load(std::memory_order_acquire); record != nullptr; record = record->m_next)
+            {
+                bool inUse = false;
+                if (record->m_inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return record;
+                }
+            }
+
+            ThreadRecord* const newRecord = new ThreadRecord();
+            ThreadRecord* head = m_records.load(std::memory_order_relaxed);
+            do
+            {
+                newRecord->m_next = head;
+            } while (!m_records.compare_exchange_weak(head, newRecord, std::memory_order_release, std::memory_order_relaxed));
+
+            return newRecord;
+        }
+
+        static void release_record(ThreadRecord* const record)
+        {
+            assert(record->m_guardDepth == 0);
+            record->m_inUse.store(false, std::memory_order_release);
+        }
+
+        bool try_advance_epoch(const Epoch epoch)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            for (ThreadRecord* record = m_records.load(std::memory_order_acquire); record != nullptr; record = record->m_next)
+            {
+                const Epoch localEpoch = record->m_localEpoch.load(std::memory_order_relaxed);
+                if (localEpoch != InactiveEpoch && (localEpoch >> 1) != epoch)
+                {
+                    return false; // some thread is still inside the previous epoch
+                }
+            }
+
+            Epoch expected = epoch;
+            return m_globalEpoch.compare_exchange_strong(expected, epoch + 1, std::memory_order_acq_rel, std::memory_order_relaxed);
+        }
+
+    public:
+        std::atomic<Epoch>              m_globalEpoch = LimboListCount; // avoid underflow in epoch arithmetic
+        std::atomic<ThreadRecord*>      m_records = nullptr;
+    };
+
+    Registry& get_registry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    class ThreadRecordOwner
+    {
+    public:
+        ThreadRecordOwner() :
+            m_record(get_registry().acquire_record())
+        {
+        }
+
+        ~ThreadRecordOwner()
+        {
+            Registry::release_record(m_record);
+        }
+
+    public:
+        ThreadRecord* const m_record;
+    };
+
+    ThreadRecord& get_thread_record()
+    {
+        // Make sure the registry outlives all thread records
+        get_registry();
+
+        thread_local ThreadRecordOwner owner;
+        return *owner.m_record;
+    }
+
+    void delete_expired_objects(ThreadRecord& record, const Epoch globalEpoch)
+    {
+        for (LimboList& limbo : record.m_limbo)
+        {
+            if (limbo.m_epoch + 2 <= globalEpoch && !limbo.m_objects.empty())
+            {
+                limbo.delete_objects();
+            }
+        }
+    }
+}
+
+
+EpochReclamation::Guard::Guard()
+{
+    ThreadRecord& record = get_thread_record();
+    if (record.m_guardDepth++ != 0)
+    {
+        return; // nested guard
+    }
+
+    const Epoch epoch = get_registry().m_globalEpoch.load(std::memory_order_relaxed);
+    record.m_localEpoch.store((epoch << 1) | 1, std::memory_order_relaxed);
+
+    // Epoch announcement must be visible to other threads before we start reading shared data
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+EpochReclamation::Guard::~Guard()
+{
+    ThreadRecord& record = get_thread_record();
+    assert(record.m_guardDepth != 0);
+    if (--record.m_guardDepth != 0)
+    {
+        return; // nested guard
+    }
+
+    record.m_localEpoch.store(InactiveEpoch, std::memory_order_release);
+}
+
+void EpochReclamation::retire(void* const ptr, Deleter* const deleter)
+{
+    Registry& registry = get_registry();
+    ThreadRecord& record = get_thread_record();
+
+    // Object was unlinked before this point. The fence makes sure it is tagged
+    // with an epoch not older than the epochs of threads which still may see it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Epoch epoch = registry.m_globalEpoch.load(std::memory_order_relaxed);
+
+    if (++record.m_retireCount % RetireCountBetweenAdvances == 0)
+    {
+        if (registry.try_advance_epoch(epoch))
+        {
+            ++epoch;
+        }
+    }
+
+    delete_expired_objects(record, epoch);
+
+    LimboList& limbo = record.m_limbo[epoch % LimboListCount];
+    if (limbo.m_epoch != epoch)
+    {
+        assert(limbo.m_objects.empty());
+        limbo.m_epoch = epoch;
+    }
+    limbo.m_objects.push_back({ ptr, deleter });
+}
+
+bool EpochReclamation::is_lock_free()
+{
+    return get_registry().m_globalEpoch.is_lock_free();
+}
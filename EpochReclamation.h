@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+
+// Epoch-based safe memory reclamation for lock-free data structures.
+// Readers hold a `Guard` while they walk shared data. Writers `retire()` unlinked objects
+// and they are deleted only when all threads have left the epochs in which those objects were reachable.
+class EpochReclamation
+{
+public:
+    using Deleter = void(void* const ptr);
+
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // Object must be already unreachable for new readers
+    static void retire(void* const ptr, Deleter* const deleter);
+
+    static bool is_lock_free();
+
+protected:
+    using Epoch = std::uint64_t;
+
+    static_assert(std::atomic<Epoch>::is_always_lock_free);
+};
@@ -0,0 +1,70 @@
+#include "FileSync.h"
+
+#include "Logger.h"
+
+#include <filesystem>
+#include <system_error>
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+
+bool FileSync::sync(std::FILE* const file, const std::string& filename)
+{
+#ifdef _WIN32
+    const bool ok = ::_commit(::_fileno(file)) == 0;
+#else
+    const bool ok = ::fsync(::fileno(file)) == 0;
+#endif
+    if (!ok)
+    {
+        LOG_ERROR << "Failed syncing the file: " << filename << std::endl;
+    }
+    return ok;
+}
+
+bool FileSync::sync_directory(const std::string& filename)
+{
+#ifdef _WIN32
+    // NTFS journals directory changes itself, and directories can not be opened by `_open()`
+    (void)filename;
+    return true;
+#else
+    std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+    if (directory.empty())
+    {
+        directory = ".";
+    }
+
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    const bool ok = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    if (!ok)
+    {
+        LOG_ERROR << "Failed syncing the directory: " << directory.string() << std::endl;
+    }
+    return ok;
+#endif
+}
+
+bool FileSync::replace(const std::string& temporaryFilename, const std::string& filename)
+{
+    std::error_code error;
+    std::filesystem::rename(temporaryFilename, filename, error);
+    if (error)
+    {
+        LOG_ERROR << "Failed replacing the file: " << filename << "; error: " << error.message() << std::endl;
+        return false;
+    }
+
+    // The new file is in place already; a failure here only means the rename may be lost on a power failure
+    return sync_directory(filename);
+}
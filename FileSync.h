@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+
+// Makes written files survive a power failure, not only a process crash
+class FileSync
+{
+public:
+    // Writes data of the file from the OS cache to the disk. The stream buffer must be flushed already.
+    static bool sync(std::FILE* const file, const std::string& filename);
+
+    // Makes creation, rename or removal of files in the directory of `filename` durable
+    static bool sync_directory(const std::string& filename);
+
+    // Atomically renames a complete and synced temporary file over `filename`, then syncs the directory.
+    // After a crash either the old or the new file is found, never a partial one.
+    static bool replace(const std::string& temporaryFilename, const std::string& filename);
+};
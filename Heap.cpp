@@ -0,0 +1,215 @@
+#include "Heap.h"
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
+
+namespace
+{
+    // Trivially destructible, so it stays valid while other thread_local objects are destroyed
+    thread_local Heap* t_currentThreadHeap = nullptr;
+    thread_local bool t_isThreadExiting = false;
+}
+
+class Heap::ThreadExitHook
+{
+public:
+    ~ThreadExitHook()
+    {
+        t_isThreadExiting = true;
+        abandon(t_currentThreadHeap);
+        t_currentThreadHeap = nullptr; // blocks of the heap freed later by this thread become remote frees
+    }
+};
+
+Heap* Heap::get_current_thread_heap()
+{
+    if (t_currentThreadHeap == nullptr) [[unlikely]]
+    {
+        t_currentThreadHeap = acquire();
+
+        if (!t_isThreadExiting)
+        {
+            thread_local ThreadExitHook hook; // registers the destructor for the current thread
+        }
+        // else: allocation from a thread_local destructor. The heap is not handed over then, it is lost.
+    }
+
+    return t_currentThreadHeap;
+}
+
+bool Heap::is_owned_by_current_thread() const
+{
+    return t_currentThreadHeap == this;
+}
+
+// Thread start and exit are rare, a lock is fine here
+static std::mutex& get_abandoned_heaps_protect()
+{
+    static std::mutex& protect = *new std::mutex(); // never destroyed: threads may exit during static destruction
+    return protect;
+}
+
+static std::vector<Heap*>& get_abandoned_heaps()
+{
+    static std::vector<Heap*>& heaps = *new std::vector<Heap*>();
+    return heaps;
+}
+
+#ifndef _WIN32
+namespace
+{
+    // A forked child process (snapshot) takes a heap from the pool if its thread has none yet. Another thread
+    // can not hold the lock at the fork: it would never be released in the child, where only the forking thread exists.
+    // Heaps themselves need no handlers: the child uses only the heap of its thread, and frees to other heaps are lock-free.
+    const int g_atForkRegistered = ::pthread_atfork(
+        []() { get_abandoned_heaps_protect().lock(); },
+        []() { get_abandoned_heaps_protect().unlock(); },
+        []() { get_abandoned_heaps_protect().unlock(); });
+}
+#endif
+
+Heap* Heap::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(get_abandoned_heaps_protect());
+        std::vector<Heap*>& heaps = get_abandoned_heaps();
+        if (!heaps.empty())
+        {
+            Heap* const heap = heaps.back();
+            heaps.pop_back();
+            return heap; // the mutex makes all writes of the previous owner visible
+        }
+    }
+
+    return new Heap();
+}
+
+void Heap::abandon(Heap* const heap)
+{
+    if (heap == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(get_abandoned_heaps_protect());
+    get_abandoned_heaps().push_back(heap);
+}
+
+void* Heap::allocate(const size_t size)
+{
+    if (size > MaxBlockSize)
+    {
+        return ::operator new(size);
+    }
+
+    if (!is_owned_by_current_thread())
+    {
+        // Allocators are copied freely, e.g. inside nodes. Only the owner may touch the free lists.
+        return get_current_thread_heap()->allocate(size);
+    }
+
+    const size_t sizeClassIdx = SizeClassMap::get_size_class(size);
+    SizeClass& sizeClass = m_sizeClasses[sizeClassIdx];
+
+    if (sizeClass.m_freeList == nullptr && m_remoteFrees.load(std::memory_order_relaxed) != nullptr)
+    {
+        collect_remote_frees();
+    }
+
+    if (FreeBlock* const block = sizeClass.m_freeList)
+    {
+        sizeClass.m_freeList = block->m_next;
+        return block;
+    }
+
+    return allocate_new_block(sizeClassIdx);
+}
+
+void Heap::deallocate(void* const ptr, const size_t size)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    if (size > MaxBlockSize)
+    {
+        ::operator delete(ptr, size);
+        return;
+    }
+
+    const PageHeader* const page = get_page(ptr);
+    Heap* const heap = page->m_heap;
+    FreeBlock* const block = ::new (ptr) FreeBlock{ nullptr };
+
+    if (heap->is_owned_by_current_thread())
+    {
+        SizeClass& sizeClass = heap->m_sizeClasses[page->m_sizeClass];
+        block->m_next = sizeClass.m_freeList;
+        sizeClass.m_freeList = block;
+        return;
+    }
+
+    // Multiple producers push, the owner takes the whole stack at once: no ABA problem here
+    FreeBlock* head = heap->m_remoteFrees.load(std::memory_order_relaxed);
+    do
+    {
+        block->m_next = head;
+    }
+    while (!heap->m_remoteFrees.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void* Heap::allocate_new_block(const size_t sizeClassIdx)
+{
+    SizeClass& sizeClass = m_sizeClasses[sizeClassIdx];
+    const size_t blockSize = SizeClassMap::get_block_size(sizeClassIdx);
+
+    if (static_cast<size_t>(sizeClass.m_bumpEnd - sizeClass.m_bumpCursor) < blockSize)
+    {
+        // The unused tail of the previous page is lost: it is smaller than one block
+        char* const memory = allocate_page();
+        ::new (memory) PageHeader{ this, sizeClassIdx };
+
+        sizeClass.m_bumpCursor = memory + sizeof(PageHeader);
+        sizeClass.m_bumpEnd = memory + PageSize;
+    }
+
+    void* const block = sizeClass.m_bumpCursor;
+    sizeClass.m_bumpCursor += blockSize;
+    return block;
+}
+
+char* Heap::allocate_page()
+{
+    if (m_segmentCursor == m_segmentEnd)
+    {
+        // Allocating every page separately with such an alignment would waste up to a page of address space each time
+        m_segmentCursor = static_cast<char*>(::operator new(SegmentSize, std::align_val_t(PageSize)));
+        m_segmentEnd = m_segmentCursor + SegmentSize;
+    }
+
+    char* const page = m_segmentCursor;
+    m_segmentCursor += PageSize;
+    return page;
+}
+
+void Heap::collect_remote_frees()
+{
+    FreeBlock* block = m_remoteFrees.exchange(nullptr, std::memory_order_acquire);
+    while (block != nullptr)
+    {
+        FreeBlock* const next = block->m_next;
+
+        SizeClass& sizeClass = m_sizeClasses[get_page(block)->m_sizeClass];
+        block->m_next = sizeClass.m_freeList;
+        sizeClass.m_freeList = block;
+
+        block = next;
+    }
+}
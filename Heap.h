@@ -0,0 +1,107 @@
+#pragma once
+
+#include "utils/bit.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+// Heap owned by a single thread. Small blocks are carved from pages of the same size class,
+// so allocations of different threads never touch shared state.
+// A block may be freed by any thread: the owner puts it to its free list directly, other threads
+// push it to the lock-free remote-free stack of the owner heap. The owner collects those blocks
+// when its free list of the needed size class is empty.
+// Pages are never returned to the system: freed blocks are reused by the same heap.
+// Heap of an exited thread is handed over to the next thread which needs a heap, together with all its blocks.
+class Heap
+{
+public:
+    using ID = std::size_t;
+
+    static constexpr size_t BlockAlignment = 16;
+    static constexpr size_t MaxBlockSize = 8 * 1024; // larger blocks are allocated with `operator new`
+    static constexpr size_t PageSize = 64 * 1024;
+    static constexpr size_t SegmentSize = 16 * PageSize; // pages are reserved in bigger chunks
+
+public:
+    // Heap owned by the current thread. It is bound to the thread on the first call, so later calls
+    // cost a single thread_local read. Heaps are never deleted.
+    static Heap* get_current_thread_heap();
+
+    static Heap* from_id(const ID id)
+    {
+        return reinterpret_cast<Heap*>(id);
+    }
+
+    ID get_id() const
+    {
+        return reinterpret_cast<ID>(this);
+    }
+
+    // Allocates from the current thread heap if this heap belongs to another thread
+    void* allocate(const size_t size);
+
+    // Size must be the same as passed to `allocate()`. Can be called by any thread.
+    static void deallocate(void* const ptr, const size_t size);
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+protected:
+    static constexpr size_t CacheLineSize = 64;
+    // Size classes: multiples of 16 bytes up to 1 KiB, then 4 classes per power of 2,
+    // so a block never wastes more than 25% of its size (values and keys are mostly small)
+    using SizeClassMap = bit_extra::SizeClasses<BlockAlignment, 1024, 4>;
+    static constexpr size_t SizeClassCount = SizeClassMap::get_class_count(MaxBlockSize);
+
+    struct FreeBlock
+    {
+        FreeBlock*              m_next;
+    };
+
+    // Placed at the beginning of every page. Pages are aligned by their size,
+    // so the header of a block is found by masking the block address.
+    struct alignas(BlockAlignment) PageHeader
+    {
+        Heap*                   m_heap;
+        size_t                  m_sizeClass;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock*              m_freeList = nullptr;
+        char*                   m_bumpCursor = nullptr; // unused tail of the last page
+        char*                   m_bumpEnd = nullptr;
+    };
+
+protected:
+    Heap() = default;
+
+    // Takes a heap abandoned by an exited thread or creates a new one
+    static Heap* acquire();
+    // Called on thread exit
+    static void abandon(Heap* const heap);
+    class ThreadExitHook;
+
+    static PageHeader* get_page(void* const ptr)
+    {
+        return reinterpret_cast<PageHeader*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(PageSize - 1));
+    }
+
+    bool is_owned_by_current_thread() const;
+
+    void* allocate_new_block(const size_t sizeClass);
+    char* allocate_page();
+    void collect_remote_frees();
+
+protected:
+    SizeClass                           m_sizeClasses[SizeClassCount];
+    char*                               m_segmentCursor = nullptr; // unused pages of the last segment
+    char*                               m_segmentEnd = nullptr;
+
+    // Blocks freed by other threads
+    alignas(CacheLineSize) std::atomic<FreeBlock*> m_remoteFrees = nullptr;
+
+    static_assert(std::atomic<FreeBlock*>::is_always_lock_free);
+};
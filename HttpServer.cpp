@@ -3,6 +3,8 @@
 #include "DataEngine.h"
 #include "HttpServerHelpers.h"
 #include "Logger.h"
+#include "SnapshotScheduler.h"
+#include "WriteAheadLog.h"
 
 #ifdef _MSC_VER
 #  include <SDKDDKVer.h>
@@ -43,7 +45,8 @@ HttpServer::HttpServer() :
 HttpServer::~HttpServer() = default;
 
 
-void HttpServer::run(const std::string& host, const std::uint16_t port, DataEngine& engine, const bool logEachRequest)
+void HttpServer::run(const std::string& host, const std::uint16_t port, DataEngine& engine, WriteAheadLog* const ptrLog,
+    const SnapshotScheduler& snapshotScheduler, const bool logEachRequest)
 {
     LOG_INFO << "HttpServer: run: begin" << std::endl;
 
@@ -52,7 +55,7 @@ void HttpServer::run(const std::string& host, const std::uint16_t port, DataEngi
 
     m_ptrApp->loglevel(logEachRequest ? crow::LogLevel::Info : crow::LogLevel::Warning);
 
-    setup_routing(engine);
+    setup_routing(engine, ptrLog, snapshotScheduler);
 
     m_ptrApp->bindaddr(host).port(port);
 
@@ -70,13 +73,13 @@ void HttpServer::stop_notify()
     LOG_INFO << "HttpServer: stop_notify: end" << std::endl;
 }
 
-void HttpServer::setup_routing(DataEngine& engine)
+void HttpServer::setup_routing(DataEngine& engine, WriteAheadLog* const ptrLog, const SnapshotScheduler& snapshotScheduler)
 {
     crow::SimpleApp& app = *m_ptrApp;
 
     // Get value
     CROW_ROUTE(app, "/api/records/<string>").methods(crow::HTTPMethod::GET)(
-        [&engine](const crow::request& req, const std::string& nameRaw)
+        [&engine](const crow::request& /*req*/, const std::string& nameRaw)
         {
             using namespace std::literals;
             HttpServerHelpers::JsonBody body;
@@ -91,15 +94,22 @@ void HttpServer::setup_routing(DataEngine& engine)
                     return crow::response(crow::status::BAD_REQUEST, body);
                 }
 
-                const std::optional<DataEngine::String> value = engine.get(name);
-                if (!value.has_value())
+                // The value is escaped straight from the engine into the response body, like in `BinaryServer`
+                crow::response response(crow::status::OK);
+                const bool found = engine.read(name, [&name, &response](const std::string_view value)
+                    {
+                        HttpServerHelpers::append_json_record(response.body, name, value); // the value view is valid only here
+                    }
+                );
+
+                if (!found)
                 {
                     body.add("error"sv, "Item not found"sv);
                     return crow::response(crow::status::NOT_FOUND, body);
                 }
 
-                body.add("value"sv, std::string_view(*value));
-                return crow::response(crow::status::OK, body);
+                response.set_header("Content-Type", HttpServerHelpers::JsonContentType);
+                return response;
             }
             catch (...)
             {
@@ -111,7 +121,7 @@ void HttpServer::setup_routing(DataEngine& engine)
 
     // Set value
     CROW_ROUTE(app, "/api/records/<string>").methods(crow::HTTPMethod::POST)(
-        [&engine](const crow::request& req, const std::string& nameRaw)
+        [&engine, ptrLog](const crow::request& req, const std::string& nameRaw)
         {
             using namespace std::literals;
             HttpServerHelpers::JsonBody body;
@@ -156,7 +166,59 @@ void HttpServer::setup_routing(DataEngine& engine)
                     return crow::response(crow::status::BAD_REQUEST, body);
                 }
 
-                engine.set(name, std::string_view(value.GetString(), value.GetStringLength()));
+                const std::string_view valueView(value.GetString(), value.GetStringLength());
+                if (ptrLog == nullptr)
+                {
+                    engine.set(name, valueView);
+                }
+                else if (!ptrLog->set(engine, name, valueView))
+                {
+                    body.add("error"sv, "Failed writing the write-ahead log"sv);
+                    return crow::response(crow::status::INTERNAL_SERVER_ERROR, body);
+                }
+
+                return crow::response(crow::status::OK, body);
+            }
+            catch (...)
+            {
+                body.add("error"sv, "Server internal error"sv);
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, body);
+            }
+        }
+    );
+
+    // Delete value
+    CROW_ROUTE(app, "/api/records/<string>").methods(crow::HTTPMethod::Delete)(
+        [&engine, ptrLog](const crow::request& /*req*/, const std::string& nameRaw)
+        {
+            using namespace std::literals;
+            HttpServerHelpers::JsonBody body;
+            try
+            {
+                const std::string name = HttpServerHelpers::url_decode(nameRaw);
+                body.add("name"sv, name);
+
+                if (name.empty())
+                {
+                    body.add("error"sv, "Item name cannot be empty"sv);
+                    return crow::response(crow::status::BAD_REQUEST, body);
+                }
+
+                bool erased = false;
+                if (ptrLog == nullptr)
+                {
+                    erased = engine.erase(name);
+                }
+                else if (!ptrLog->erase(engine, name, erased))
+                {
+                    body.add("error"sv, "Failed writing the write-ahead log"sv);
+                    return crow::response(crow::status::INTERNAL_SERVER_ERROR, body);
+                }
+                if (!erased)
+                {
+                    body.add("error"sv, "Item not found"sv);
+                    return crow::response(crow::status::NOT_FOUND, body);
+                }
 
                 return crow::response(crow::status::OK, body);
             }
@@ -187,6 +249,38 @@ void HttpServer::setup_routing(DataEngine& engine)
                 body.add("succeeded"sv, reads.m_successOperations);
                 body.add("failed"sv, reads.m_failedOperations);
 
+                const auto bloomFilter = engine.get_bloom_filter_statistics();
+                if (bloomFilter.m_enabled)
+                {
+                    body.add("bloom_filter_rejected"sv, bloomFilter.m_rejectedReads);
+                    body.add("bloom_filter_false_positives"sv, bloomFilter.m_falsePositiveReads);
+                }
+
+                return crow::response(crow::status::OK, body);
+            }
+            catch (...)
+            {
+                body.add("error"sv, "Server internal error"sv);
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, body);
+            }
+        }
+    );
+
+    CROW_ROUTE(app, "/api/statistics/snapshots")(
+        [&snapshotScheduler]()
+        {
+            using namespace std::literals;
+            HttpServerHelpers::JsonBody body;
+            try
+            {
+                const auto snapshots = snapshotScheduler.get_statistics();
+                body.add("saved"sv, snapshots.m_savedSnapshots);
+                body.add("saved_deltas"sv, snapshots.m_savedDeltas);
+                body.add("failed"sv, snapshots.m_failedSnapshots);
+                body.add("last_duration_ms"sv, snapshots.m_lastDurationMs);
+                body.add("last_size_bytes"sv, snapshots.m_lastFileSize);
+                body.add("last_records"sv, snapshots.m_lastRecordCount);
+
                 return crow::response(crow::status::OK, body);
             }
             catch (...)
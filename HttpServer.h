@@ -7,6 +7,8 @@
 
 class DataEngine;
 class HttpServerApp;
+class SnapshotScheduler;
+class WriteAheadLog;
 
 
 class HttpServer
@@ -15,12 +17,14 @@ public:
     HttpServer();
     ~HttpServer();
 
-    void run(const std::string& host, const std::uint16_t port, DataEngine& engine, const bool logEachRequest);
+    // Modifications are logged to `ptrLog` before they are acknowledged, if it is not null
+    void run(const std::string& host, const std::uint16_t port, DataEngine& engine, WriteAheadLog* const ptrLog,
+        const SnapshotScheduler& snapshotScheduler, const bool logEachRequest);
 
     void stop_notify();
 
 protected:
-    void setup_routing(DataEngine& engine);
+    void setup_routing(DataEngine& engine, WriteAheadLog* const ptrLog, const SnapshotScheduler& snapshotScheduler);
 
     std::unique_ptr<HttpServerApp> m_ptrApp;
 };
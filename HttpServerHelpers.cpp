@@ -40,6 +40,23 @@ std::string HttpServerHelpers::url_decode(const std::string& value)
     return result;
 }
 
+void HttpServerHelpers::append_json_record(std::string& output, const std::string_view name, const std::string_view value)
+{
+    constexpr std::string_view NameKey = "name";
+    constexpr std::string_view ValueKey = "value";
+
+    output.reserve(output.size() + name.size() + value.size() + 20); // escaped characters may still grow it
+
+    StringOutputStream stream(output);
+    rapidjson::Writer<StringOutputStream> writer(stream);
+    writer.StartObject();
+    writer.Key(NameKey.data(), static_cast<rapidjson::SizeType>(NameKey.size()));
+    writer.String(name.data(), static_cast<rapidjson::SizeType>(name.size()));
+    writer.Key(ValueKey.data(), static_cast<rapidjson::SizeType>(ValueKey.size()));
+    writer.String(value.data(), static_cast<rapidjson::SizeType>(value.size()));
+    writer.EndObject();
+}
+
 void HttpServerHelpers::LogHandler::log(std::string message, crow::LogLevel level)
 {
     Logger::LogLevel newLevel = Logger::LogLevel::Critical;
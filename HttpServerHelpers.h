@@ -2,27 +2,57 @@
 #include "crow/returnable.h"
 
 #include "rapidjson/document.h"
-#include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 
+#include <string>
 #include <string_view>
 
 
 namespace HttpServerHelpers
 {
+    constexpr const char* JsonContentType = "application/json; charset=utf-8";
+
     std::string url_decode(const std::string& value);
 
+    // Appends `{"name":<name>,"value":<value>}` to `output`: the strings are escaped straight into it, no document is built
+    void append_json_record(std::string& output, const std::string_view name, const std::string_view value);
+
     class LogHandler : public crow::ILogHandler
     {
     public:
         virtual void log(std::string message, crow::LogLevel level) override;
     };
 
+    // RapidJSON output stream appending to std::string
+    class StringOutputStream
+    {
+    public:
+        using Ch = char;
+
+    public:
+        explicit StringOutputStream(std::string& output) :
+            m_output(output)
+        {
+        }
+
+        void Put(const Ch ch)
+        {
+            m_output.push_back(ch);
+        }
+
+        void Flush()
+        {
+        }
+
+    protected:
+        std::string& m_output;
+    };
+
     class JsonBody : public crow::returnable
     {
     public:
         JsonBody() :
-            crow::returnable("application/json; charset=utf-8"),
+            crow::returnable(JsonContentType),
             m_document(rapidjson::Type::kObjectType)
         {
         }
@@ -53,10 +83,12 @@ namespace HttpServerHelpers
 
         virtual std::string dump() const override
         {
-            rapidjson::StringBuffer buffer;
-            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+            // Serialize directly into the resulting string, no intermediate buffer copy
+            std::string result;
+            StringOutputStream stream(result);
+            rapidjson::Writer<StringOutputStream> writer(stream);
             m_document.Accept(writer);
-            return { buffer.GetString() , buffer.GetLength() };
+            return result;
         }
 
     protected:
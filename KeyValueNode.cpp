@@ -0,0 +1,39 @@
+#include "KeyValueNode.h"
+#include "EpochReclamation.h"
+
+
+ValueBuffer* ValueBuffer::create(const std::string_view value, const std::uint32_t changeEpoch)
+{
+    ByteAllocator allocator = AllocatorFactory::get_allocator<char>();
+    char* const memory = allocator.allocate(get_allocation_size(value.size()));
+    return construct_at(memory, value, changeEpoch, true);
+}
+
+void ValueBuffer::destroy(ValueBuffer* const buffer)
+{
+    if (buffer == nullptr || !buffer->m_isSeparate)
+    {
+        return;
+    }
+
+    const size_t allocationSize = get_allocation_size(buffer->m_size);
+
+    buffer->~ValueBuffer();
+    AllocatorFactory::get_allocator<char>().deallocate(reinterpret_cast<char*>(buffer), allocationSize);
+}
+
+void ValueBuffer::retire(ValueBuffer* const buffer)
+{
+    if (buffer == nullptr || !buffer->m_isSeparate)
+    {
+        return; // freed together with its node
+    }
+
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        destroy(static_cast<ValueBuffer*>(ptr));
+        return;
+    };
+
+    EpochReclamation::retire(buffer, deleter);
+}
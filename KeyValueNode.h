@@ -0,0 +1,168 @@
+#pragma once
+
+#include "Allocator.h"
+#include "AllocatorFactory.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+
+// Immutable value bytes stored right after the header.
+// It is either placed inside a node allocation or allocated separately when the value is replaced.
+// Allocators are always equal, so buffers and nodes do not keep them: any allocator can free them.
+class ValueBuffer
+{
+public:
+    using ByteAllocator = SeparateHeapAllocator<char>;
+
+public:
+    // Separate allocation. Must be freed with `destroy()`.
+    static ValueBuffer* create(const std::string_view value, const std::uint32_t changeEpoch);
+    // Frees only separately allocated buffers. Buffers inside nodes are freed together with nodes.
+    static void destroy(ValueBuffer* const buffer);
+    // For deferred deletion of replaced values
+    static void retire(ValueBuffer* const buffer);
+
+    static size_t get_allocation_size(const size_t valueSize)
+    {
+        return sizeof(ValueBuffer) + valueSize;
+    }
+
+    static ValueBuffer* construct_at(char* const place, const std::string_view value, const std::uint32_t changeEpoch, const bool isSeparate)
+    {
+        ValueBuffer* const buffer = ::new (place) ValueBuffer(static_cast<std::uint32_t>(value.size()), changeEpoch, isSeparate);
+        std::memcpy(place + sizeof(ValueBuffer), value.data(), value.size());
+        return buffer;
+    }
+
+    std::string_view get_view() const
+    {
+        return { reinterpret_cast<const char*>(this + 1), m_size };
+    }
+
+    // `DataEngine::ChangeEpoch` when the value was set
+    std::uint32_t get_change_epoch() const
+    {
+        return m_changeEpoch;
+    }
+
+    ValueBuffer(const std::uint32_t size, const std::uint32_t changeEpoch, const bool isSeparate) :
+        m_size(size), m_changeEpoch(changeEpoch), m_isSeparate(isSeparate)
+    {
+    }
+
+protected:
+    const std::uint32_t         m_size;
+    const std::uint32_t         m_changeEpoch;
+    const bool                  m_isSeparate;
+};
+
+
+// Base class of engine nodes. Key bytes and the initial value (if it is small) are stored
+// in the same allocation right after the node, so a new element costs a single allocation.
+// Replaced values are allocated separately and old ones are retired via EpochReclamation.
+template<typename Node>
+class KeyValueNode
+{
+public:
+    using ByteAllocator = ValueBuffer::ByteAllocator;
+    using AtomicValuePtr = std::atomic<ValueBuffer*>;
+
+    // Larger initial values are allocated separately, so the node does not keep their space forever
+    static constexpr size_t MaxInlineValueSize = 64;
+
+    // Arguments passed to the base class constructor by `create()`
+    struct Layout
+    {
+        std::uint32_t           m_keySize = 0;
+        std::uint32_t           m_allocationSize = 0;
+        ValueBuffer*            m_value = nullptr;
+    };
+
+public:
+    // Node constructor must take `const Layout&` as its first argument
+    template<typename... Args>
+    static Node* create(const std::string_view key, const std::string_view value, const std::uint32_t changeEpoch, Args&&... args)
+    {
+        static_assert(alignof(Node) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+        const bool isInlineValue = value.size() <= MaxInlineValueSize;
+
+        const size_t valueOffset = align_up(sizeof(Node) + key.size(), alignof(ValueBuffer));
+        const size_t allocationSize = isInlineValue ? valueOffset + ValueBuffer::get_allocation_size(value.size()) : sizeof(Node) + key.size();
+
+        ByteAllocator allocator = AllocatorFactory::get_allocator<char>();
+
+        Layout layout;
+        layout.m_keySize = static_cast<std::uint32_t>(key.size());
+        layout.m_allocationSize = static_cast<std::uint32_t>(allocationSize);
+
+        char* const memory = allocator.allocate(allocationSize);
+        std::memcpy(memory + sizeof(Node), key.data(), key.size());
+
+        try
+        {
+            layout.m_value = isInlineValue
+                ? ValueBuffer::construct_at(memory + valueOffset, value, changeEpoch, false)
+                : ValueBuffer::create(value, changeEpoch);
+
+            return ::new (memory) Node(layout, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            // A separate value buffer is freed too, an inline one is a part of `memory`
+            ValueBuffer::destroy(layout.m_value);
+            allocator.deallocate(memory, allocationSize);
+            throw;
+        }
+    }
+
+    // Deletes the node and its current value immediately
+    static void destroy(Node* const node)
+    {
+        const size_t allocationSize = node->m_allocationSize;
+
+        ValueBuffer::destroy(node->m_value.load(std::memory_order_relaxed));
+
+        node->~Node();
+        AllocatorFactory::get_allocator<char>().deallocate(reinterpret_cast<char*>(node), allocationSize);
+    }
+
+    std::string_view get_key() const
+    {
+        return { reinterpret_cast<const char*>(static_cast<const Node*>(this) + 1), m_keySize };
+    }
+
+    // Pointer is valid until the end of the current EpochReclamation::Guard
+    ValueBuffer* load_value() const
+    {
+        return m_value.load(std::memory_order_acquire);
+    }
+
+protected:
+    explicit KeyValueNode(const Layout& layout) :
+        m_value(layout.m_value),
+        m_keySize(layout.m_keySize),
+        m_allocationSize(layout.m_allocationSize)
+    {
+    }
+
+    static constexpr size_t align_up(const size_t value, const size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+public:
+    AtomicValuePtr              m_value;
+
+protected:
+    const std::uint32_t         m_keySize;
+    const std::uint32_t         m_allocationSize;
+
+    static_assert(AtomicValuePtr::is_always_lock_free);
+};
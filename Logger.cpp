@@ -5,10 +5,29 @@
 #include <iostream>
 #include <string_view>
 
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
 
 Logger::LogLevel Logger::m_minLogLevel = Logger::LogLevel::Debug;
 
 
+namespace
+{
+    std::mutex g_protect;
+
+#ifndef _WIN32
+    // A forked child process (snapshot) may log too. Another thread can not hold the lock at the fork:
+    // it would never be released in the child, where only the forking thread exists.
+    const int g_atForkRegistered = ::pthread_atfork(
+        []() { g_protect.lock(); },
+        []() { g_protect.unlock(); },
+        []() { g_protect.unlock(); });
+#endif
+}
+
+
 
 void Logger::log(const std::string& message, const LogLevel logLevel)
 {
@@ -52,8 +71,7 @@ void Logger::log(const std::string& message, const LogLevel logLevel)
     gmtime_r(&tNow, &tmNow);
 #endif
 
-    static std::mutex protect;
-    std::lock_guard lock(protect);
+    std::lock_guard lock(g_protect);
 
     stream
         << std::put_time(&tmNow, "%Y-%m-%d %H:%M:%S") << '.' << std::setw(3) << std::setfill('0') << std::right << milliseconds
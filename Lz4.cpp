@@ -0,0 +1,290 @@
+#include "Lz4.h"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace
+{
+    // A block is a chain of sequences: token (literal count : 4 bits, match length - MinMatch : 4 bits),
+    // extra literal count bytes, literals, 16-bit match offset, extra match length bytes.
+    // The last sequence has literals only.
+    constexpr size_t MinMatch = 4;
+    constexpr size_t LastLiterals = 5;      // the last bytes of a block are always literals
+    constexpr size_t MatchFindLimit = 12;   // a match starts this far from the end of a block at least
+    constexpr size_t MaxOffset = 65535;
+    constexpr size_t TokenLengthLimit = 15; // longer lengths continue in the next bytes
+
+    constexpr std::ptrdiff_t FastCopySize = 16; // short literal runs are copied by a fixed size
+
+    constexpr int HashBits = 16;
+    // The search step grows by one for every 64 bytes without a match: incompressible data is skipped fast
+    constexpr int SkipStrength = 6;
+
+    std::uint32_t read_32(const unsigned char* const bytes)
+    {
+        std::uint32_t value = 0;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    std::uint64_t read_64(const unsigned char* const bytes)
+    {
+        std::uint64_t value = 0;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    size_t hash_sequence(const std::uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HashBits);
+    }
+
+    // Number of equal bytes, `first` is not compared beyond `firstLimit`; `second` precedes `first`
+    size_t count_equal_bytes(const unsigned char* first, const unsigned char* second, const unsigned char* const firstLimit)
+    {
+        const unsigned char* const start = first;
+        while (firstLimit - first >= 8)
+        {
+            const std::uint64_t difference = read_64(first) ^ read_64(second);
+            if (difference != 0)
+            {
+                return static_cast<size_t>(first - start) + std::countr_zero(difference) / 8; // little-endian
+            }
+            first += 8;
+            second += 8;
+        }
+
+        while (first < firstLimit && *first == *second)
+        {
+            ++first;
+            ++second;
+        }
+        return static_cast<size_t>(first - start);
+    }
+
+    unsigned char* write_length(unsigned char* output, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            *output++ = 255;
+        }
+        *output++ = static_cast<unsigned char>(length);
+        return output;
+    }
+
+    bool read_length(const unsigned char*& input, const unsigned char* const inputEnd, size_t& length)
+    {
+        unsigned char byte = 0;
+        do
+        {
+            if (input == inputEnd)
+            {
+                return false;
+            }
+            byte = *input++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    // `matchLength` = 0 writes the last sequence
+    bool write_sequence(unsigned char*& output, unsigned char* const outputEnd, const unsigned char* const literals, const size_t literalCount,
+        const size_t offset, const size_t matchLength)
+    {
+        const size_t maxSize = 1 + literalCount / 255 + 1 + literalCount + (matchLength != 0 ? 2 + (matchLength - MinMatch) / 255 + 1 : 0);
+        if (static_cast<size_t>(outputEnd - output) < maxSize)
+        {
+            return false;
+        }
+
+        unsigned char* const token = output++;
+        if (literalCount >= TokenLengthLimit)
+        {
+            *token = TokenLengthLimit << 4;
+            output = write_length(output, literalCount - TokenLengthLimit);
+        }
+        else
+        {
+            *token = static_cast<unsigned char>(literalCount << 4);
+        }
+
+        std::memcpy(output, literals, literalCount);
+        output += literalCount;
+
+        if (matchLength == 0)
+        {
+            return true;
+        }
+
+        *output++ = static_cast<unsigned char>(offset);
+        *output++ = static_cast<unsigned char>(offset >> 8);
+
+        const size_t storedLength = matchLength - MinMatch;
+        if (storedLength >= TokenLengthLimit)
+        {
+            *token |= TokenLengthLimit;
+            output = write_length(output, storedLength - TokenLengthLimit);
+        }
+        else
+        {
+            *token |= static_cast<unsigned char>(storedLength);
+        }
+        return true;
+    }
+}
+
+
+size_t Lz4::compress(const void* const source, const size_t sourceSize, void* const destination, const size_t capacity)
+{
+    const unsigned char* const input = static_cast<const unsigned char*>(source);
+    unsigned char* const output = static_cast<unsigned char*>(destination);
+    unsigned char* const outputEnd = output + capacity;
+    unsigned char* outputPosition = output;
+
+    size_t anchor = 0; // the first byte not written yet
+
+    // Shorter blocks are stored as literals only
+    if (sourceSize > MatchFindLimit)
+    {
+        // Last positions of 4-byte sequences. Candidates are verified, so stale or zero entries are harmless.
+        std::vector<std::uint32_t> table(size_t(1) << HashBits);
+
+        const size_t matchFindLimit = sourceSize - MatchFindLimit;
+        const unsigned char* const matchLimit = input + sourceSize - LastLiterals;
+
+        size_t position = 0;
+        while (position <= matchFindLimit)
+        {
+            const std::uint32_t sequence = read_32(input + position);
+            std::uint32_t& slot = table[hash_sequence(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<std::uint32_t>(position);
+
+            if (candidate >= position || position - candidate > MaxOffset || read_32(input + candidate) != sequence)
+            {
+                position += 1 + ((position - anchor) >> SkipStrength);
+                continue;
+            }
+
+            // The match may start before the position where it was found
+            size_t matchStart = position;
+            while (matchStart > anchor && candidate > 0 && input[matchStart - 1] == input[candidate - 1])
+            {
+                --matchStart;
+                --candidate;
+            }
+
+            const size_t matchLength = position - matchStart + MinMatch
+                + count_equal_bytes(input + position + MinMatch, input + candidate + (position - matchStart) + MinMatch, matchLimit);
+
+            if (!write_sequence(outputPosition, outputEnd, input + anchor, matchStart - anchor, matchStart - candidate, matchLength))
+            {
+                return 0;
+            }
+
+            position = matchStart + matchLength;
+            anchor = position;
+
+            // A position inside the match is indexed too, so the next repeat of it is found
+            table[hash_sequence(read_32(input + position - 2))] = static_cast<std::uint32_t>(position - 2);
+        }
+    }
+
+    if (!write_sequence(outputPosition, outputEnd, input + anchor, sourceSize - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return static_cast<size_t>(outputPosition - output);
+}
+
+bool Lz4::decompress(const void* const source, const size_t sourceSize, void* const destination, const size_t size)
+{
+    const unsigned char* input = static_cast<const unsigned char*>(source);
+    const unsigned char* const inputEnd = input + sourceSize;
+    unsigned char* const output = static_cast<unsigned char*>(destination);
+    unsigned char* const outputEnd = output + size;
+    unsigned char* outputPosition = output;
+
+    // Every length and offset is checked against both buffers before it is used
+    while (true)
+    {
+        if (input == inputEnd)
+        {
+            return false;
+        }
+        const unsigned char token = *input++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == TokenLengthLimit && !read_length(input, inputEnd, literalCount))
+        {
+            return false;
+        }
+        if (literalCount > static_cast<size_t>(inputEnd - input) || literalCount > static_cast<size_t>(outputEnd - outputPosition))
+        {
+            return false;
+        }
+        if (literalCount <= FastCopySize && inputEnd - input >= FastCopySize && outputEnd - outputPosition >= FastCopySize)
+        {
+            std::memcpy(outputPosition, input, FastCopySize); // a fixed size copy is a couple of instructions
+        }
+        else
+        {
+            std::memcpy(outputPosition, input, literalCount);
+        }
+        input += literalCount;
+        outputPosition += literalCount;
+
+        if (input == inputEnd)
+        {
+            return outputPosition == outputEnd; // the last sequence
+        }
+
+        if (inputEnd - input < 2)
+        {
+            return false;
+        }
+        const size_t offset = size_t(input[0]) | (size_t(input[1]) << 8);
+        input += 2;
+        if (offset == 0 || offset > static_cast<size_t>(outputPosition - output))
+        {
+            return false;
+        }
+
+        size_t matchLength = token & TokenLengthLimit;
+        if (matchLength == TokenLengthLimit && !read_length(input, inputEnd, matchLength))
+        {
+            return false;
+        }
+        matchLength += MinMatch;
+        if (matchLength > static_cast<size_t>(outputEnd - outputPosition))
+        {
+            return false;
+        }
+
+        const unsigned char* const match = outputPosition - offset;
+        if (offset >= 8 && static_cast<size_t>(outputEnd - outputPosition) >= matchLength + 8)
+        {
+            // Copies 8 bytes at a time, so it may write up to 7 bytes past the match: they are overwritten later
+            for (size_t byteIdx = 0; byteIdx < matchLength; byteIdx += 8)
+            {
+                std::memcpy(outputPosition + byteIdx, match + byteIdx, 8);
+            }
+        }
+        else if (offset >= matchLength)
+        {
+            std::memcpy(outputPosition, match, matchLength);
+        }
+        else
+        {
+            // Overlapping match repeats the last `offset` bytes
+            for (size_t byteIdx = 0; byteIdx < matchLength; ++byteIdx)
+            {
+                outputPosition[byteIdx] = match[byteIdx];
+            }
+        }
+        outputPosition += matchLength;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+
+// LZ4 block format compression: a fast byte-oriented LZ77 without entropy coding.
+// Blocks are compatible with the reference library (`LZ4_compress_default()` / `LZ4_decompress_safe()`),
+// frames and dictionaries are not supported. Blocks are independent, so they may be processed in parallel.
+class Lz4
+{
+public:
+    // Output of `compress()` never exceeds it
+    static size_t get_max_compressed_size(const size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    // Returns the compressed size, or 0 if it does not fit into `capacity`
+    static size_t compress(const void* const source, const size_t sourceSize, void* const destination, const size_t capacity);
+
+    // Fails unless the block is valid and decompresses to exactly `size` bytes. Corrupted input is safe.
+    static bool decompress(const void* const source, const size_t sourceSize, void* const destination, const size_t size);
+};
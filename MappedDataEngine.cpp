@@ -0,0 +1,401 @@
+#include "MappedDataEngine.h"
+#include "EpochReclamation.h"
+#include "KeyValueNode.h"
+#include "Logger.h"
+#include "utils/bit.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+MappedDataEngine::MappedDataEngine(const size_t initialCapacity) :
+    m_initialBucketCount(bit_extra::round_up_to_power_of_2(std::max(initialCapacity / MaxLoadFactor, StripeCount)))
+{
+}
+
+MappedDataEngine::~MappedDataEngine()
+{
+    // Nodes are not deleted: they stay in the file for the next start
+    if (m_region.is_open())
+    {
+        m_region.get_root(ChangeEpochRoot).store(m_changeEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_region.close();
+    }
+}
+
+bool MappedDataEngine::open(const std::string& filename)
+{
+    if (!m_region.open(filename))
+    {
+        return false;
+    }
+
+    AtomicOffset& bucketArrayRoot = m_region.get_root(BucketArrayRoot);
+
+    if (m_region.is_restored() && bucketArrayRoot.load(std::memory_order_relaxed) != 0)
+    {
+        // Values keep their epochs, so new ones must not be older
+        m_changeEpoch.store(static_cast<ChangeEpoch>(m_region.get_root(ChangeEpochRoot).load(std::memory_order_relaxed)), std::memory_order_relaxed);
+
+        AtomicOffset& hashProbeRoot = m_region.get_root(HashProbeRoot);
+        if (hashProbeRoot.load(std::memory_order_relaxed) != get_hash_probe())
+        {
+            // Another standard library hashes keys differently: nobody uses the engine yet, so the old array is freed at once
+            LOG_WARN << "MappedDataEngine: key hash function has changed, rehashing keys of " << filename << std::endl;
+
+            BucketArray& oldBuckets = *get_bucket_array();
+            const Offset newBuckets = create_bucket_array(oldBuckets.m_bucketCount);
+            relink_nodes(oldBuckets, *m_region.get<BucketArray>(newBuckets), true);
+
+            bucketArrayRoot.store(newBuckets, std::memory_order_relaxed);
+            m_region.deallocate(m_region.get_offset(&oldBuckets), get_bucket_array_size(oldBuckets.m_bucketCount));
+            hashProbeRoot.store(get_hash_probe(), std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bucketArrayRoot.store(create_bucket_array(m_initialBucketCount), std::memory_order_relaxed);
+    m_region.get_root(ItemCountRoot).store(0, std::memory_order_relaxed);
+    m_region.get_root(HashProbeRoot).store(get_hash_probe(), std::memory_order_relaxed);
+    return true;
+}
+
+bool MappedDataEngine::is_lock_free() const
+{
+    return false; // writers lock stripes
+}
+
+bool MappedDataEngine::is_restored() const
+{
+    return m_region.is_restored();
+}
+
+std::uint64_t MappedDataEngine::get_hash_probe()
+{
+    return Hash()("MappedDataEngine hash probe");
+}
+
+MappedDataEngine::BucketArray* MappedDataEngine::get_bucket_array() const
+{
+    return m_region.get<BucketArray>(m_region.get_root(BucketArrayRoot).load(std::memory_order_acquire));
+}
+
+size_t MappedDataEngine::get_bucket_array_size(const size_t bucketCount)
+{
+    return sizeof(BucketArray) + bucketCount * sizeof(AtomicOffset);
+}
+
+MappedDataEngine::Offset MappedDataEngine::create_bucket_array(const size_t bucketCount)
+{
+    const Offset offset = m_region.allocate(get_bucket_array_size(bucketCount));
+
+    BucketArray* const buckets = ::new (m_region.get<void>(offset)) BucketArray{ bucketCount };
+    AtomicOffset* const heads = buckets->get_buckets();
+    for (size_t bucketIdx = 0; bucketIdx < bucketCount; ++bucketIdx)
+    {
+        ::new (&heads[bucketIdx]) AtomicOffset(0);
+    }
+    return offset;
+}
+
+MappedDataEngine::Offset MappedDataEngine::create_value(const std::string_view value, const ChangeEpoch changeEpoch)
+{
+    const Offset offset = m_region.allocate(ValueBuffer::get_allocation_size(value.size()));
+    ValueBuffer::construct_at(m_region.get<char>(offset), value, changeEpoch, true);
+    return offset;
+}
+
+MappedDataEngine::Offset MappedDataEngine::create_node(const std::string_view key, const size_t hash, const Offset value)
+{
+    const Offset offset = m_region.allocate(sizeof(Node) + key.size());
+
+    char* const memory = m_region.get<char>(offset);
+    std::memcpy(memory + sizeof(Node), key.data(), key.size());
+    ::new (memory) Node{ {0}, {value}, hash, static_cast<std::uint32_t>(key.size()), 0 };
+    return offset;
+}
+
+MappedDataEngine::Node* MappedDataEngine::find_node(const BucketArray& buckets, const std::string_view key, const size_t hash) const
+{
+    const AtomicOffset& head = buckets.get_buckets()[hash & (buckets.m_bucketCount - 1)];
+
+    for (Offset offset = head.load(std::memory_order_acquire); offset != 0;)
+    {
+        Node* const node = m_region.get<Node>(offset);
+        if (node->m_hash == hash && node->get_key() == key)
+        {
+            return node;
+        }
+        offset = node->m_next.load(std::memory_order_acquire);
+    }
+    return nullptr;
+}
+
+void MappedDataEngine::retire_value(ValueBuffer* const value)
+{
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        // A closed region keeps the block: it is lost space in the file, not a dangling pointer
+        MappedRegion* const region = MappedRegion::from_address(ptr);
+        if (region != nullptr)
+        {
+            const ValueBuffer* const buffer = static_cast<const ValueBuffer*>(ptr);
+            region->deallocate(region->get_offset(ptr), ValueBuffer::get_allocation_size(buffer->get_view().size()));
+        }
+        return;
+    };
+
+    EpochReclamation::retire(value, deleter);
+}
+
+void MappedDataEngine::retire_node(Node* const node)
+{
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        MappedRegion* const region = MappedRegion::from_address(ptr);
+        if (region != nullptr)
+        {
+            const Node* const node = static_cast<const Node*>(ptr);
+            const ValueBuffer* const value = region->get<ValueBuffer>(node->m_value.load(std::memory_order_relaxed));
+            region->deallocate(region->get_offset(value), ValueBuffer::get_allocation_size(value->get_view().size()));
+            region->deallocate(region->get_offset(ptr), sizeof(Node) + node->m_keySize);
+        }
+        return;
+    };
+
+    EpochReclamation::retire(node, deleter);
+}
+
+void MappedDataEngine::retire_bucket_array(BucketArray* const buckets)
+{
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        MappedRegion* const region = MappedRegion::from_address(ptr);
+        if (region != nullptr)
+        {
+            region->deallocate(region->get_offset(ptr), get_bucket_array_size(static_cast<const BucketArray*>(ptr)->m_bucketCount));
+        }
+        return;
+    };
+
+    EpochReclamation::retire(buckets, deleter);
+}
+
+void MappedDataEngine::grow_bucket_array()
+{
+    std::unique_lock<std::shared_mutex> lock(m_growProtect);
+
+    BucketArray& oldBuckets = *get_bucket_array();
+    if (m_region.get_root(ItemCountRoot).load(std::memory_order_relaxed) <= oldBuckets.m_bucketCount * MaxLoadFactor)
+    {
+        return; // grown by another thread
+    }
+
+    Offset newBuckets = 0;
+    try
+    {
+        newBuckets = create_bucket_array(oldBuckets.m_bucketCount * 2);
+    }
+    catch (const std::bad_alloc&)
+    {
+        LOG_WARN << "MappedDataEngine: the file is full, bucket array is not grown" << std::endl;
+        return; // lists just get longer
+    }
+
+    // Readers which miss a key while nodes are moved search again
+    m_growSequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    relink_nodes(oldBuckets, *m_region.get<BucketArray>(newBuckets), false);
+    m_region.get_root(BucketArrayRoot).store(newBuckets, std::memory_order_release);
+
+    m_growSequence.fetch_add(1, std::memory_order_release);
+
+    retire_bucket_array(&oldBuckets); // readers may still walk it
+}
+
+void MappedDataEngine::relink_nodes(BucketArray& oldBuckets, BucketArray& newBuckets, const bool rehash)
+{
+    AtomicOffset* const oldHeads = oldBuckets.get_buckets();
+    AtomicOffset* const newHeads = newBuckets.get_buckets();
+    const size_t newMask = newBuckets.m_bucketCount - 1;
+
+    // Nodes are moved one by one from the head of an old list to the head of a new one.
+    // A reader walking an old list may jump to a new one, but it never loops: it fails and searches again.
+    for (size_t bucketIdx = 0; bucketIdx < oldBuckets.m_bucketCount; ++bucketIdx)
+    {
+        Offset offset = oldHeads[bucketIdx].load(std::memory_order_relaxed);
+        while (offset != 0)
+        {
+            Node* const node = m_region.get<Node>(offset);
+            const Offset next = node->m_next.load(std::memory_order_relaxed);
+
+            if (rehash)
+            {
+                node->m_hash = Hash()(node->get_key());
+            }
+
+            AtomicOffset& newHead = newHeads[node->m_hash & newMask];
+            node->m_next.store(newHead.load(std::memory_order_relaxed), std::memory_order_release);
+            newHead.store(offset, std::memory_order_release);
+            oldHeads[bucketIdx].store(next, std::memory_order_release);
+
+            offset = next;
+        }
+    }
+}
+
+bool MappedDataEngine::lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const
+{
+    EpochReclamation::Guard guard;
+
+    while (true)
+    {
+        const std::uint64_t sequence = m_growSequence.load(std::memory_order_acquire);
+        if ((sequence & 1) != 0)
+        {
+            std::shared_lock<std::shared_mutex> lock(m_growProtect); // waits for the end of growing
+            continue;
+        }
+
+        const Node* const node = find_node(*get_bucket_array(), key, hash);
+        if (node != nullptr)
+        {
+            visitor(m_region.get<ValueBuffer>(node->m_value.load(std::memory_order_acquire))->get_view());
+            return true;
+        }
+
+        // A miss is trusted only if no node was moved during the search
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_growSequence.load(std::memory_order_relaxed) == sequence)
+        {
+            return false;
+        }
+    }
+}
+
+void MappedDataEngine::store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch)
+{
+    EpochReclamation::Guard guard;
+
+    std::uint64_t itemCount = 0;
+    size_t bucketCount = 0;
+    {
+        std::shared_lock<std::shared_mutex> growLock(m_growProtect);
+        std::lock_guard<std::mutex> stripeLock(m_stripeLocks[hash % StripeCount]);
+
+        BucketArray& buckets = *get_bucket_array();
+        const Offset newValue = create_value(value, changeEpoch);
+
+        Node* const node = find_node(buckets, key, hash);
+        if (node != nullptr)
+        {
+            const Offset oldValue = node->m_value.exchange(newValue, std::memory_order_acq_rel);
+            retire_value(m_region.get<ValueBuffer>(oldValue)); // somebody may still read it
+            return;
+        }
+
+        Offset newNode = 0;
+        try
+        {
+            newNode = create_node(key, hash, newValue);
+        }
+        catch (...)
+        {
+            m_region.deallocate(newValue, ValueBuffer::get_allocation_size(value.size()));
+            throw;
+        }
+
+        AtomicOffset& head = buckets.get_buckets()[hash & (buckets.m_bucketCount - 1)];
+        m_region.get<Node>(newNode)->m_next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        head.store(newNode, std::memory_order_release);
+
+        itemCount = m_region.get_root(ItemCountRoot).fetch_add(1, std::memory_order_relaxed) + 1;
+        bucketCount = buckets.m_bucketCount;
+    }
+
+    if (itemCount > bucketCount * MaxLoadFactor)
+    {
+        grow_bucket_array();
+    }
+}
+
+bool MappedDataEngine::remove(const std::string_view key, const size_t hash)
+{
+    EpochReclamation::Guard guard;
+
+    std::shared_lock<std::shared_mutex> growLock(m_growProtect);
+    std::lock_guard<std::mutex> stripeLock(m_stripeLocks[hash % StripeCount]);
+
+    BucketArray& buckets = *get_bucket_array();
+
+    // Readers standing on the unlinked node continue by its `m_next`, which is not changed
+    AtomicOffset* link = &buckets.get_buckets()[hash & (buckets.m_bucketCount - 1)];
+    for (Offset offset = link->load(std::memory_order_relaxed); offset != 0; offset = link->load(std::memory_order_relaxed))
+    {
+        Node* const node = m_region.get<Node>(offset);
+        if (node->m_hash == hash && node->get_key() == key)
+        {
+            link->store(node->m_next.load(std::memory_order_relaxed), std::memory_order_release);
+            m_region.get_root(ItemCountRoot).fetch_sub(1, std::memory_order_relaxed);
+            retire_node(node);
+            return true;
+        }
+        link = &node->m_next;
+    }
+
+    return false;
+}
+
+void MappedDataEngine::enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const
+{
+    EpochReclamation::Guard guard;
+
+    // Buckets are walked in bit-reversed order: when the array doubles, the buckets already walked
+    // become exactly the first `2 * position` ones, so no key is visited twice or missed
+    size_t position = 0;
+    size_t bucketCount = 0;
+
+    std::vector<std::pair<const Node*, const ValueBuffer*>> batch;
+    while (true)
+    {
+        batch.clear();
+        {
+            std::shared_lock<std::shared_mutex> lock(m_growProtect);
+
+            BucketArray& buckets = *get_bucket_array();
+            if (bucketCount != 0)
+            {
+                position *= buckets.m_bucketCount / bucketCount;
+            }
+            bucketCount = buckets.m_bucketCount;
+
+            const int indexBitCount = std::countr_zero(bucketCount);
+            const size_t end = std::min(position + EnumerationBatchSize, bucketCount);
+            for (; position < end; ++position)
+            {
+                const size_t bucketIdx = static_cast<size_t>(bit_extra::reverse_bits(position) >> (64 - indexBitCount));
+                for (Offset offset = buckets.get_buckets()[bucketIdx].load(std::memory_order_acquire); offset != 0;)
+                {
+                    const Node* const node = m_region.get<Node>(offset);
+                    batch.emplace_back(node, m_region.get<ValueBuffer>(node->m_value.load(std::memory_order_acquire)));
+                    offset = node->m_next.load(std::memory_order_acquire);
+                }
+            }
+        }
+
+        // Visited without the lock: writers are not blocked by a slow visitor
+        for (const auto& [node, value] : batch)
+        {
+            visitor(node->get_key(), *value);
+        }
+
+        if (position >= bucketCount)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "DataEngine.h"
+#include "MappedRegion.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+
+// Chained hash map whose buckets, nodes and values live in a memory-mapped file (`MappedRegion`).
+// They refer to each other by region offsets, so a restart maps the file and serves the data at once,
+// without loading a snapshot. Only a cleanly closed file is reused; after a crash it is recreated empty
+// and the data comes from the snapshot and the write-ahead log as usual.
+//
+// Not lock-free, see `is_lock_free()`. Lookups are lock-free, but writers lock one of `StripeCount` mutexes
+// selected by the key hash, and growing the bucket array relinks all nodes at once under an exclusive lock
+// which stops writers (about 100 ms for 1M keys). Readers detect a concurrent growth by the sequence counter
+// and retry their search.
+class MappedDataEngine : public DataEngine
+{
+public:
+    explicit MappedDataEngine(const size_t initialCapacity);
+    virtual ~MappedDataEngine() override;
+
+    // Data of a cleanly closed file is kept, see `is_restored()`
+    bool open(const std::string& filename);
+
+    virtual bool is_lock_free() const override;
+    virtual bool is_restored() const override;
+
+protected:
+    using Offset = MappedRegion::Offset;
+    using AtomicOffset = std::atomic<Offset>;
+
+    // Key bytes are stored right after the node. The value is a separate `ValueBuffer` block.
+    struct Node
+    {
+        AtomicOffset                    m_next;
+        AtomicOffset                    m_value;
+        std::uint64_t                   m_hash;     // `Hash()(key)` of this build, see `HashProbeRoot`
+        std::uint32_t                   m_keySize;
+        std::uint32_t                   m_reserved;
+
+        std::string_view get_key() const
+        {
+            return { reinterpret_cast<const char*>(this + 1), m_keySize };
+        }
+    };
+
+    // Bucket heads are stored right after the array header
+    struct BucketArray
+    {
+        std::uint64_t                   m_bucketCount; // always power of 2, not less than `StripeCount`
+
+        AtomicOffset* get_buckets()
+        {
+            return reinterpret_cast<AtomicOffset*>(this + 1);
+        }
+
+        const AtomicOffset* get_buckets() const
+        {
+            return reinterpret_cast<const AtomicOffset*>(this + 1);
+        }
+    };
+
+    // Region roots
+    static constexpr size_t BucketArrayRoot = 0;
+    static constexpr size_t ItemCountRoot = 1;
+    static constexpr size_t ChangeEpochRoot = 2;
+    static constexpr size_t HashProbeRoot = 3;     // nodes are rehashed if `Hash` differs from the one which stored them
+
+    // Same stripe for all keys of a bucket: bucket count is a multiple of it
+    static constexpr size_t StripeCount = 256;
+    // Grow bucket array when average bucket list length reaches this value
+    static constexpr size_t MaxLoadFactor = 1;
+    // Buckets collected under the lock by enumeration before their values are visited
+    static constexpr size_t EnumerationBatchSize = 64;
+
+protected:
+    virtual bool lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const override;
+    virtual void store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch) override;
+    virtual bool remove(const std::string_view key, const size_t hash) override;
+    virtual void enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const override;
+
+    static std::uint64_t get_hash_probe();
+
+    BucketArray* get_bucket_array() const;
+    Offset create_bucket_array(const size_t bucketCount);
+    static size_t get_bucket_array_size(const size_t bucketCount);
+
+    Offset create_value(const std::string_view value, const ChangeEpoch changeEpoch);
+    Offset create_node(const std::string_view key, const size_t hash, const Offset value);
+    Node* find_node(const BucketArray& buckets, const std::string_view key, const size_t hash) const;
+
+    // Deferred deleters find the region by the block address
+    static void retire_value(ValueBuffer* const value);
+    static void retire_node(Node* const node);
+    static void retire_bucket_array(BucketArray* const buckets);
+
+    void grow_bucket_array();
+    // Relinks all nodes into `newBuckets`, recalculating hashes if `rehash` is set
+    void relink_nodes(BucketArray& oldBuckets, BucketArray& newBuckets, const bool rehash);
+
+protected:
+    MappedRegion                    m_region;
+    size_t                          m_initialBucketCount = 0;
+
+    std::array<std::mutex, StripeCount> m_stripeLocks;
+    // Shared by writers and enumeration, exclusive for growing the bucket array
+    mutable std::shared_mutex       m_growProtect;
+    // Odd while nodes are being moved to the new bucket array
+    std::atomic<std::uint64_t>      m_growSequence = 0;
+};
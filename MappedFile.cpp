@@ -0,0 +1,144 @@
+#include "MappedFile.h"
+
+#include "Logger.h"
+
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+    m_file = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        m_file = nullptr;
+        LOG_ERROR << "Failed opening the file for mapping: " << filename << "; error: " << ::GetLastError() << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    if (!::GetFileSizeEx(m_file, &fileSize))
+    {
+        LOG_ERROR << "Failed getting the file size: " << filename << "; error: " << ::GetLastError() << std::endl;
+        close();
+        return false;
+    }
+
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+    if (m_size == 0)
+    {
+        return true; // empty files can not be mapped
+    }
+
+    m_mapping = ::CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr)
+    {
+        LOG_ERROR << "Failed creating the file mapping: " << filename << "; error: " << ::GetLastError() << std::endl;
+        close();
+        return false;
+    }
+
+    m_data = ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_data == nullptr)
+    {
+        LOG_ERROR << "Failed mapping the file: " << filename << "; error: " << ::GetLastError() << std::endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr)
+    {
+        ::UnmapViewOfFile(m_data);
+        m_data = nullptr;
+    }
+    if (m_mapping != nullptr)
+    {
+        ::CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != nullptr)
+    {
+        ::CloseHandle(m_file);
+        m_file = nullptr;
+    }
+    m_size = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG_ERROR << "Failed opening the file for mapping: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat fileStat = {};
+    if (::fstat(fd, &fileStat) != 0)
+    {
+        LOG_ERROR << "Failed getting the file size: " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(fileStat.st_size);
+    if (size == 0)
+    {
+        ::close(fd);
+        return true; // empty files can not be mapped
+    }
+
+    void* const data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+
+    if (data == MAP_FAILED)
+    {
+        LOG_ERROR << "Failed mapping the file: " << filename << std::endl;
+        return false;
+    }
+
+    ::madvise(data, size, MADV_SEQUENTIAL); // only a hint for the read-ahead
+
+    m_data = data;
+    m_size = size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr)
+    {
+        ::munmap(const_cast<void*>(m_data), m_size);
+        m_data = nullptr;
+    }
+    m_size = 0;
+}
+
+#endif
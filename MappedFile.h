@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    // Valid until `close()`
+    std::string_view get_data() const
+    {
+        return { static_cast<const char*>(m_data), m_size };
+    }
+
+protected:
+    const void*         m_data = nullptr;
+    size_t              m_size = 0;
+
+#ifdef _WIN32
+    void*               m_file = nullptr;       // HANDLE
+    void*               m_mapping = nullptr;    // HANDLE
+#endif
+};
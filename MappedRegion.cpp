@@ -0,0 +1,348 @@
+#include "MappedRegion.h"
+
+#include "FileSync.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+namespace
+{
+    std::array<std::atomic<MappedRegion*>, MappedRegion::MaxRegionCount> g_regions = {};
+}
+
+
+MappedRegion::~MappedRegion()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedRegion::open(const std::string& filename)
+{
+    LOG_ERROR << "Memory-mapped regions are not supported on this platform: " << filename << std::endl;
+    return false;
+}
+
+void MappedRegion::close()
+{
+}
+
+bool MappedRegion::grow_file(const std::uint64_t /*end*/)
+{
+    return false;
+}
+
+#else
+
+bool MappedRegion::open(const std::string& filename)
+{
+    close();
+
+    m_filename = filename;
+    m_isRestored = false;
+
+    m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        LOG_ERROR << "Failed opening the file for mapping: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat fileStat = {};
+    if (::fstat(m_fd, &fileStat) != 0)
+    {
+        LOG_ERROR << "Failed getting the file size: " << filename << std::endl;
+        unmap();
+        return false;
+    }
+
+    // Pages beyond the end of the file are not accessed until the file grows over them
+    void* const base = ::mmap(nullptr, MaxRegionSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, m_fd, 0);
+    if (base == MAP_FAILED)
+    {
+        LOG_ERROR << "Failed mapping the file: " << filename << std::endl;
+        unmap();
+        return false;
+    }
+    m_base = static_cast<char*>(base);
+
+    const std::uint64_t fileSize = static_cast<std::uint64_t>(fileStat.st_size);
+    if (fileSize >= HeaderSize)
+    {
+        const Header& header = get_header();
+        m_isRestored = std::memcmp(header.m_signature, Signature, sizeof(Signature)) == 0
+            && header.m_version == Version
+            && header.m_headerSize == HeaderSize
+            && header.m_state == State::Closed
+            && header.m_fileSize.load() == fileSize
+            && header.m_usedSize.load() <= fileSize;
+    }
+
+    if (!m_isRestored)
+    {
+        if (fileSize != 0)
+        {
+            LOG_WARN << "Mapped file was not closed cleanly, it is recreated: " << filename << std::endl;
+        }
+
+        if (!create_file())
+        {
+            unmap();
+            return false;
+        }
+    }
+
+    // Marked before the first modification: a crash from now on leaves the file untrusted
+    get_header().m_state = State::Open;
+    if (!sync_header())
+    {
+        unmap();
+        return false;
+    }
+
+    register_region(this);
+    return true;
+}
+
+void MappedRegion::close()
+{
+    if (m_base == nullptr)
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        return;
+    }
+
+    unregister_region(this);
+
+    // Everything else must be on the disk before the file is marked as closed
+    Header& header = get_header();
+    bool ok = ::msync(m_base, static_cast<size_t>(header.m_fileSize.load()), MS_SYNC) == 0 && ::fsync(m_fd) == 0;
+    if (ok)
+    {
+        header.m_state = State::Closed;
+        ok = sync_header();
+    }
+
+    if (!ok)
+    {
+        LOG_ERROR << "Failed syncing the mapped file, it will be recreated on the next open: " << m_filename << std::endl;
+    }
+
+    unmap();
+}
+
+bool MappedRegion::create_file()
+{
+    // All blocks of an old file are dropped; new pages are zero
+    if (::ftruncate(m_fd, 0) != 0)
+    {
+        LOG_ERROR << "Failed truncating the file: " << m_filename << std::endl;
+        return false;
+    }
+
+    // The header page is not accessible before the file is extended
+    if (!extend_file(0, InitialFileSize))
+    {
+        return false;
+    }
+
+    Header& header = get_header();
+    std::memcpy(header.m_signature, Signature, sizeof(Signature));
+    header.m_version = Version;
+    header.m_headerSize = HeaderSize;
+    header.m_fileSize.store(InitialFileSize);
+    header.m_usedSize.store(HeaderSize);
+
+    return FileSync::sync_directory(m_filename);
+}
+
+bool MappedRegion::grow_file(const std::uint64_t end)
+{
+    std::lock_guard<std::mutex> lock(m_growProtect);
+
+    Header& header = get_header();
+    const std::uint64_t fileSize = header.m_fileSize.load(std::memory_order_relaxed);
+    if (end <= fileSize)
+    {
+        return true; // grown by another thread
+    }
+
+    if (end > MaxRegionSize)
+    {
+        LOG_ERROR << "Mapped file reached its size limit: " << m_filename << std::endl;
+        return false;
+    }
+
+    // Grows by the current size, up to `MaxGrowSize` at once
+    const std::uint64_t pageSize = 4096;
+    const std::uint64_t newSize = std::min((std::max(end, fileSize + std::min(fileSize, MaxGrowSize)) + pageSize - 1) / pageSize * pageSize,
+        MaxRegionSize);
+
+    if (!extend_file(fileSize, newSize))
+    {
+        return false;
+    }
+
+    header.m_fileSize.store(newSize, std::memory_order_release);
+    return true;
+}
+
+bool MappedRegion::extend_file(const std::uint64_t fileSize, const std::uint64_t newSize)
+{
+#ifdef __linux__
+    // Disk blocks are allocated now: a full disk fails here instead of crashing a later write to the mapping
+    const bool ok = ::posix_fallocate(m_fd, static_cast<off_t>(fileSize), static_cast<off_t>(newSize - fileSize)) == 0;
+#else
+    (void)fileSize;
+    const bool ok = ::ftruncate(m_fd, static_cast<off_t>(newSize)) == 0;
+#endif
+    if (!ok)
+    {
+        LOG_ERROR << "Failed growing the mapped file: " << m_filename << "; size: " << newSize << std::endl;
+    }
+    return ok;
+}
+
+bool MappedRegion::sync_header()
+{
+    const bool ok = ::msync(m_base, HeaderSize, MS_SYNC) == 0;
+    if (!ok)
+    {
+        LOG_ERROR << "Failed syncing the file: " << m_filename << std::endl;
+    }
+    return ok;
+}
+
+void MappedRegion::unmap()
+{
+    if (m_base != nullptr)
+    {
+        // The addresses stay reserved: a deferred deleter of a block may come later, and it must not find
+        // another mapping there
+        ::mmap(m_base, MaxRegionSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        m_base = nullptr;
+    }
+
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+#endif
+
+MappedRegion::Offset MappedRegion::allocate(const size_t size)
+{
+    const size_t sizeClass = SizeClassMap::get_size_class(size);
+    if (sizeClass >= SizeClassCount)
+    {
+        throw std::bad_alloc();
+    }
+
+    Header& header = get_header();
+
+    {
+        std::lock_guard<std::mutex> lock(m_freeListLocks[sizeClass]);
+
+        Offset& firstFree = header.m_freeLists[sizeClass];
+        if (firstFree != 0)
+        {
+            const Offset block = firstFree;
+            firstFree = get<FreeBlock>(block)->m_next;
+            return block;
+        }
+    }
+
+    // The used size is moved only when the file is big enough: a failed growth takes no space,
+    // so smaller blocks may still fit later
+    const size_t blockSize = SizeClassMap::get_block_size(sizeClass);
+    Offset block = header.m_usedSize.load(std::memory_order_relaxed);
+    while (true)
+    {
+        const std::uint64_t end = block + blockSize;
+
+        // The file size is read with acquire: the block is accessible after it was extended by another thread
+        if (end > header.m_fileSize.load(std::memory_order_acquire) && !grow_file(end))
+        {
+            throw std::bad_alloc();
+        }
+
+        if (header.m_usedSize.compare_exchange_weak(block, end, std::memory_order_relaxed))
+        {
+            return block;
+        }
+    }
+}
+
+void MappedRegion::deallocate(const Offset offset, const size_t size)
+{
+    const size_t sizeClass = SizeClassMap::get_size_class(size);
+
+    std::lock_guard<std::mutex> lock(m_freeListLocks[sizeClass]);
+
+    Offset& firstFree = get_header().m_freeLists[sizeClass];
+    ::new (get<void>(offset)) FreeBlock{ firstFree };
+    firstFree = offset;
+}
+
+std::atomic<MappedRegion::Offset>& MappedRegion::get_root(const size_t rootIdx) const
+{
+    return get_header().m_roots[rootIdx];
+}
+
+MappedRegion* MappedRegion::from_address(const void* const ptr)
+{
+    const char* const address = static_cast<const char*>(ptr);
+    for (const std::atomic<MappedRegion*>& slot : g_regions)
+    {
+        MappedRegion* const region = slot.load(std::memory_order_acquire);
+        if (region != nullptr && address >= region->m_base && address < region->m_base + MaxRegionSize)
+        {
+            return region;
+        }
+    }
+    return nullptr;
+}
+
+void MappedRegion::register_region(MappedRegion* const region)
+{
+    for (std::atomic<MappedRegion*>& slot : g_regions)
+    {
+        MappedRegion* expected = nullptr;
+        if (slot.compare_exchange_strong(expected, region, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
+
+    // Blocks of this region are not freed by deferred deleters then: they stay allocated in the file
+    LOG_WARN << "Too many mapped regions are open, freed blocks are leaked: " << region->m_filename << std::endl;
+}
+
+void MappedRegion::unregister_region(MappedRegion* const region)
+{
+    for (std::atomic<MappedRegion*>& slot : g_regions)
+    {
+        MappedRegion* expected = region;
+        if (slot.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
+}
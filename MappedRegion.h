@@ -0,0 +1,144 @@
+#pragma once
+
+#include "utils/bit.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+
+// File-backed memory region for persistent data structures. All numbers are native-endian.
+//
+//   Header (one page): signature, state, sizes, root offsets of the owner, free lists
+//   blocks: allocated by `allocate()`, addressed by offsets from the start of the file
+//
+// Objects inside the region refer to each other by offsets, not pointers: the file may be mapped
+// at another address after a restart. Its content is trusted only if the region was closed cleanly:
+// a crash may leave half-done modifications, so such a file is recreated empty by `open()`.
+//
+// The whole `MaxRegionSize` range of addresses is reserved at open, and the file grows inside it,
+// so pointers to blocks stay valid while the region is open.
+// Freed blocks are kept in free lists of their size class, like `Heap` does; they are never returned to the OS.
+class MappedRegion
+{
+public:
+    using Offset = std::uint64_t; // 0 is the null offset: the header is there
+
+    static constexpr size_t RootCount = 8;
+    static constexpr size_t BlockAlignment = 16;
+    static constexpr std::uint64_t MaxRegionSize = std::uint64_t(256) << 30; // address space, not memory
+    static constexpr size_t MaxRegionCount = 16; // open at the same time
+
+public:
+    MappedRegion() = default;
+    ~MappedRegion();
+
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+
+    // Maps the file. Content of a cleanly closed file is kept (`is_restored()`), otherwise the file is recreated empty.
+    // The file is marked as open until `close()`.
+    bool open(const std::string& filename);
+    // Syncs the content to the disk, then marks the file as cleanly closed. Blocks must not be used after it.
+    void close();
+
+    bool is_open() const
+    {
+        return m_base != nullptr;
+    }
+
+    bool is_restored() const
+    {
+        return m_isRestored;
+    }
+
+    // Throws std::bad_alloc if the file can not grow. Can be called by any thread.
+    Offset allocate(const size_t size);
+    // Size must be the same as passed to `allocate()`. Can be called by any thread.
+    void deallocate(const Offset offset, const size_t size);
+
+    template<typename T>
+    T* get(const Offset offset) const
+    {
+        return offset != 0 ? reinterpret_cast<T*>(m_base + offset) : nullptr;
+    }
+
+    Offset get_offset(const void* const ptr) const
+    {
+        return ptr != nullptr ? static_cast<Offset>(static_cast<const char*>(ptr) - m_base) : 0;
+    }
+
+    // Offsets (or other numbers) kept by the owner of the region across restarts. Zero in a new region.
+    std::atomic<Offset>& get_root(const size_t rootIdx) const;
+
+    // Region which contains the block, or nullptr if that region is already closed.
+    // Used by deferred deleters which get only the block address.
+    static MappedRegion* from_address(const void* const ptr);
+
+protected:
+    static constexpr char Signature[8] = { 'K', 'V', 'M', 'A', 'P', '\r', '\n', '\0' };
+    static constexpr std::uint32_t Version = 1;
+
+    static constexpr size_t HeaderSize = 4096;
+    static constexpr std::uint64_t InitialFileSize = std::uint64_t(64) << 20;
+    static constexpr std::uint64_t MaxGrowSize = std::uint64_t(1) << 30;
+
+    // Same classes as `Heap`, up to 8 GiB blocks
+    using SizeClassMap = bit_extra::SizeClasses<BlockAlignment, 1024, 4>;
+    static constexpr size_t SizeClassCount = SizeClassMap::get_class_count(std::uint64_t(1) << 33);
+
+    enum class State : std::uint32_t
+    {
+        Open = 1,       // modified since it was opened: not trusted after a crash
+        Closed = 2,     // all content is synced
+    };
+
+    struct Header
+    {
+        char                        m_signature[sizeof(Signature)];
+        std::uint32_t               m_version;
+        std::uint32_t               m_headerSize;
+        State                       m_state;
+        std::uint32_t               m_reserved;
+        std::atomic<Offset>         m_fileSize;
+        std::atomic<Offset>         m_usedSize;     // blocks are carved from the end
+        std::atomic<Offset>         m_roots[RootCount];
+        Offset                      m_freeLists[SizeClassCount]; // first free block of the class, protected by `m_freeListLocks`
+    };
+
+    // Free block starts with the offset of the next one
+    struct FreeBlock
+    {
+        Offset                      m_next;
+    };
+
+    Header& get_header() const
+    {
+        return *reinterpret_cast<Header*>(m_base);
+    }
+
+    bool create_file();
+    // Extends the file to contain `end` bytes at least
+    bool grow_file(const std::uint64_t end);
+    bool extend_file(const std::uint64_t fileSize, const std::uint64_t newSize);
+    bool sync_header();
+    void unmap();
+
+    static void register_region(MappedRegion* const region);
+    static void unregister_region(MappedRegion* const region);
+
+    static_assert(sizeof(Header) <= HeaderSize);
+    static_assert(std::atomic<Offset>::is_always_lock_free);
+
+protected:
+    std::string                     m_filename;
+    int                             m_fd = -1;
+    char*                           m_base = nullptr;
+    bool                            m_isRestored = false;
+
+    std::mutex                      m_growProtect;
+    std::array<std::mutex, SizeClassCount> m_freeListLocks;
+};
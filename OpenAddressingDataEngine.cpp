@@ -0,0 +1,654 @@
+#include "OpenAddressingDataEngine.h"
+#include "EpochReclamation.h"
+#include "utils/bit.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include <assert.h>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#endif
+
+
+namespace
+{
+    using Tags = std::uint64_t;
+    using BitMask = std::uint32_t; // bit #i corresponds to slot #i of a group
+
+    // Returns slots of the group whose control byte is equal to `value`
+    template<size_t WordCount>
+    BitMask match_control_bytes(const std::atomic<Tags> (&words)[WordCount], const std::uint8_t value)
+    {
+        // Words are loaded one by one: SIMD loads of atomics are not atomic from the language point of view.
+        // Every word is a consistent snapshot of 8 control bytes, that is enough for the probing logic.
+#if defined(__AVX2__)
+        static_assert(WordCount == 4);
+        const __m256i controls = _mm256_set_epi64x(
+            static_cast<long long>(words[3].load(std::memory_order_acquire)),
+            static_cast<long long>(words[2].load(std::memory_order_acquire)),
+            static_cast<long long>(words[1].load(std::memory_order_acquire)),
+            static_cast<long long>(words[0].load(std::memory_order_acquire)));
+        const __m256i matches = _mm256_cmpeq_epi8(controls, _mm256_set1_epi8(static_cast<char>(value)));
+        return static_cast<BitMask>(_mm256_movemask_epi8(matches));
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        static_assert(WordCount == 2);
+        const __m128i controls = _mm_set_epi64x(
+            static_cast<long long>(words[1].load(std::memory_order_acquire)),
+            static_cast<long long>(words[0].load(std::memory_order_acquire)));
+        const __m128i matches = _mm_cmpeq_epi8(controls, _mm_set1_epi8(static_cast<char>(value)));
+        return static_cast<BitMask>(_mm_movemask_epi8(matches));
+#else
+        // Portable SWAR version. A byte above a matching one may be reported falsely.
+        // Control bytes are either zero or have the highest bit set, so zero bytes are always found exactly.
+        // Tag matches are verified by the key comparison anyway.
+        static_assert(WordCount == 1);
+        constexpr Tags lowBitsOfBytes  = 0x0101010101010101ull;
+        constexpr Tags highBitsOfBytes = 0x8080808080808080ull;
+        const Tags diff = words[0].load(std::memory_order_acquire) ^ (lowBitsOfBytes * value);
+        const Tags matches = (diff - lowBitsOfBytes) & ~diff & highBitsOfBytes;
+        // Gather the highest bits of all bytes into the lowest byte
+        return static_cast<BitMask>(((matches >> 7) * 0x0102040810204080ull) >> 56);
+#endif
+    }
+
+    size_t lowest_bit_index(const BitMask mask)
+    {
+        assert(mask != 0);
+#ifdef _MSC_VER
+        unsigned long bitIdx = 0;
+        _BitScanForward(&bitIdx, mask);
+        return bitIdx;
+#else
+        return static_cast<size_t>(__builtin_ctz(mask));
+#endif
+    }
+
+    // Two lowest bits of a slot pointer are used as flags:
+    // "frozen" - the slot belongs to a migrated table and is never changed again;
+    // "dropped" - the erased entry was not copied to the next table, so the slot owns it.
+    constexpr std::uintptr_t FrozenFlag  = 1;
+    constexpr std::uintptr_t DroppedFlag = 2;
+
+    template<typename T>
+    bool is_frozen(T* const ptr)
+    {
+        return (reinterpret_cast<std::uintptr_t>(ptr) & FrozenFlag) != 0;
+    }
+
+    template<typename T>
+    bool is_dropped(T* const ptr)
+    {
+        return (reinterpret_cast<std::uintptr_t>(ptr) & DroppedFlag) != 0;
+    }
+
+    template<typename T>
+    T* get_with_flags(T* const ptr, const std::uintptr_t flags)
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(ptr) | flags);
+    }
+
+    template<typename T>
+    T* get_entry(T* const ptr)
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(FrozenFlag | DroppedFlag));
+    }
+}
+
+
+OpenAddressingDataEngine::Table::Table(const size_t groupCount) :
+    m_groupCount(groupCount),
+    m_controls(std::make_unique<ControlGroup[]>(groupCount)),
+    m_slots(std::make_unique<AtomicEntryPtr[]>(groupCount * GroupSize))
+{
+    assert(groupCount != 0 && (groupCount & (groupCount - 1)) == 0 && "Group count must be power of 2");
+}
+
+OpenAddressingDataEngine::OpenAddressingDataEngine(const size_t initialCapacity) :
+    m_table(new Table(bit_extra::round_up_to_power_of_2(initialCapacity / GroupSize + 1)))
+{
+}
+
+OpenAddressingDataEngine::~OpenAddressingDataEngine()
+{
+    // Tables which are already retired are deleted by EpochReclamation
+    Table* table = m_table.load(std::memory_order_relaxed);
+    while (table != nullptr)
+    {
+        for (size_t slotIdx = 0; slotIdx < table->m_groupCount * GroupSize; ++slotIdx)
+        {
+            Entry* const ptr = table->m_slots[slotIdx].load(std::memory_order_relaxed);
+            Entry* const entry = get_entry(ptr);
+            if (entry == nullptr)
+            {
+                continue;
+            }
+
+            // Frozen slots contain entries owned by the next table, except dropped ones
+            if (!is_frozen(ptr) || is_dropped(ptr))
+            {
+                Entry::destroy(entry);
+            }
+        }
+
+        Table* const current = table;
+        table = table->m_next.load(std::memory_order_relaxed);
+        delete current;
+    }
+}
+
+bool OpenAddressingDataEngine::is_lock_free() const
+{
+    if (!m_successReads.is_lock_free())
+    {
+        return false;
+    }
+
+    if (!m_table.is_lock_free())
+    {
+        return false;
+    }
+
+    if (!EpochReclamation::is_lock_free())
+    {
+        return false;
+    }
+
+    return true;
+}
+
+std::uint8_t OpenAddressingDataEngine::make_tag(const size_t hash)
+{
+    // 7 highest bits of the hash. The highest bit of the tag is always set, so zero means "no tag".
+    constexpr size_t shift = sizeof(size_t) * 8 - 7;
+    return static_cast<std::uint8_t>(0x80 | (hash >> shift));
+}
+
+ValueBuffer* OpenAddressingDataEngine::get_retired_value()
+{
+    // Only its address is used
+    static ValueBuffer retiredValue(0, 0, false);
+    return &retiredValue;
+}
+
+OpenAddressingDataEngine::EntryUniquePtr OpenAddressingDataEngine::create_entry(const size_t hash, const std::string_view key, const std::string_view value,
+    const ChangeEpoch changeEpoch)
+{
+    EntryDeleter* deleter = [](Entry* const ptr)
+    {
+        Entry::destroy(ptr);
+        return;
+    };
+
+    EntryUniquePtr ptrNewEntry = std::unique_ptr<Entry, EntryDeleter*>(Entry::create(key, value, changeEpoch, hash), deleter);
+    return ptrNewEntry;
+}
+
+void OpenAddressingDataEngine::delete_table(Table* const table)
+{
+    // All slots of a retired table are frozen. Entries dropped during migration are owned by this table.
+    for (size_t slotIdx = 0; slotIdx < table->m_groupCount * GroupSize; ++slotIdx)
+    {
+        // Other entries may be already deleted by newer tables, do not touch them
+        Entry* const ptr = table->m_slots[slotIdx].load(std::memory_order_relaxed);
+        if (is_dropped(ptr))
+        {
+            Entry::destroy(get_entry(ptr));
+        }
+    }
+
+    delete table;
+}
+
+OpenAddressingDataEngine::ProbeStatus OpenAddressingDataEngine::find_in_table(const Table& table, const size_t hash, const std::string_view key, Entry*& entry) const
+{
+    const std::uint8_t tag = make_tag(hash);
+    const size_t groupMask = table.m_groupCount - 1;
+
+    auto isMatch = [&hash, &key](Entry* const ptr)
+    {
+        const Entry* const candidate = get_entry(ptr);
+        if (candidate == nullptr || is_dropped(ptr) || candidate->m_hash != hash || candidate->get_key() != key)
+        {
+            return false;
+        }
+        // Only frozen slots may contain retired entries
+        return !is_frozen(ptr) || candidate->load_value() != get_retired_value();
+    };
+
+    size_t groupIdx = hash & groupMask;
+    for (size_t probe = 0; probe < table.m_groupCount; ++probe, groupIdx = (groupIdx + 1) & groupMask)
+    {
+        const ControlGroup& controls = table.m_controls[groupIdx];
+        const AtomicEntryPtr* const slots = &table.m_slots[groupIdx * GroupSize];
+
+        for (BitMask matches = match_control_bytes(controls.m_words, tag); matches != 0; matches &= matches - 1)
+        {
+            Entry* const ptr = slots[lowest_bit_index(matches)].load(std::memory_order_acquire);
+            if (isMatch(ptr))
+            {
+                entry = get_entry(ptr);
+                return ProbeStatus::Found;
+            }
+        }
+
+        // Inserters publish tags of all slots they pass by, so an entry is never placed after a zero control byte
+        if (match_control_bytes(controls.m_words, 0) != 0)
+        {
+            return ProbeStatus::NotFound;
+        }
+    }
+
+    return ProbeStatus::Full;
+}
+
+OpenAddressingDataEngine::ProbeStatus OpenAddressingDataEngine::insert_into_table(Table& table, Entry* const newEntry, Entry*& entry) const
+{
+    const std::uint8_t tag = make_tag(newEntry->m_hash);
+    const size_t groupMask = table.m_groupCount - 1;
+
+    // Slots are checked strictly in the probing order, so two threads never insert the same key twice
+    size_t groupIdx = newEntry->m_hash & groupMask;
+    for (size_t probe = 0; probe < table.m_groupCount; ++probe, groupIdx = (groupIdx + 1) & groupMask)
+    {
+        const ControlGroup& controls = table.m_controls[groupIdx];
+
+        Tags words[GroupSize / sizeof(Tags)] = {};
+        for (size_t wordIdx = 0; wordIdx < std::size(words); ++wordIdx)
+        {
+            words[wordIdx] = controls.m_words[wordIdx].load(std::memory_order_acquire);
+        }
+
+        for (size_t slotInGroupIdx = 0; slotInGroupIdx < GroupSize; ++slotInGroupIdx)
+        {
+            const std::uint8_t slotTag = static_cast<std::uint8_t>(words[slotInGroupIdx / sizeof(Tags)] >> (slotInGroupIdx % sizeof(Tags) * 8));
+            if (slotTag != 0 && slotTag != tag)
+            {
+                continue;
+            }
+
+            const size_t slotIdx = groupIdx * GroupSize + slotInGroupIdx;
+            AtomicEntryPtr& slot = table.m_slots[slotIdx];
+            Entry* ptr = slot.load(std::memory_order_acquire);
+
+            if (ptr == nullptr)
+            {
+                if (slot.compare_exchange_strong(ptr, newEntry, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    publish_tag(table, slotIdx, tag);
+                    table.m_usedSlotCount.fetch_add(1, std::memory_order_relaxed);
+                    entry = newEntry;
+                    return ProbeStatus::Inserted;
+                }
+                // `ptr` contains the new slot value now
+            }
+
+            if (ptr == get_with_flags<Entry>(nullptr, FrozenFlag))
+            {
+                return ProbeStatus::Moved;
+            }
+
+            Entry* const candidate = get_entry(ptr);
+            if (slotTag == 0)
+            {
+                // Insertion into this slot is not finished yet. Help it, readers must not stop probing here.
+                publish_tag(table, slotIdx, make_tag(candidate->m_hash));
+            }
+
+            if (candidate->m_hash == newEntry->m_hash && candidate->get_key() == newEntry->get_key())
+            {
+                if (is_dropped(ptr) || (is_frozen(ptr) && candidate->load_value() == get_retired_value()))
+                {
+                    continue;
+                }
+                entry = candidate;
+                return ProbeStatus::Found;
+            }
+        }
+    }
+
+    return ProbeStatus::Full;
+}
+
+void OpenAddressingDataEngine::publish_tag(Table& table, const size_t slotIdx, const std::uint8_t tag)
+{
+    // Tag of a slot never changes, so publishing the same tag several times is harmless
+    const size_t slotInGroupIdx = slotIdx % GroupSize;
+    std::atomic<Tags>& word = table.m_controls[slotIdx / GroupSize].m_words[slotInGroupIdx / sizeof(Tags)];
+    word.fetch_or(Tags(tag) << (slotInGroupIdx % sizeof(Tags) * 8), std::memory_order_release);
+}
+
+OpenAddressingDataEngine::Entry* OpenAddressingDataEngine::find_entry(Table* table, const size_t hash, const std::string_view key) const
+{
+    while (table != nullptr)
+    {
+        Entry* entry = nullptr;
+        if (find_in_table(*table, hash, key, entry) == ProbeStatus::Found)
+        {
+            return entry;
+        }
+
+        // The key may be already inserted into the next table if this one is being migrated
+        table = table->m_next.load(std::memory_order_acquire);
+    }
+
+    return nullptr;
+}
+
+OpenAddressingDataEngine::Table* OpenAddressingDataEngine::get_table() const
+{
+    migrate_groups();
+    return m_table.load(std::memory_order_acquire);
+}
+
+void OpenAddressingDataEngine::migrate_groups() const
+{
+    for (Table* table = m_table.load(std::memory_order_acquire); table != nullptr; table = table->m_next.load(std::memory_order_acquire))
+    {
+        if (table->m_next.load(std::memory_order_acquire) == nullptr)
+        {
+            return; // the newest table is not migrated anywhere
+        }
+
+        if (table->m_migrateCursor.load(std::memory_order_relaxed) >= table->m_groupCount)
+        {
+            continue; // the rest of groups is being migrated by other threads
+        }
+
+        const size_t begin = table->m_migrateCursor.fetch_add(MigrationBatchSize, std::memory_order_relaxed);
+        if (begin >= table->m_groupCount)
+        {
+            continue;
+        }
+        const size_t end = std::min(begin + MigrationBatchSize, table->m_groupCount);
+
+        for (size_t groupIdx = begin; groupIdx < end; ++groupIdx)
+        {
+            migrate_group(*table, groupIdx);
+        }
+
+        const size_t migratedCount = table->m_migratedGroupCount.fetch_add(end - begin, std::memory_order_acq_rel) + (end - begin);
+        if (migratedCount == table->m_groupCount)
+        {
+            finish_migrations();
+        }
+        return;
+    }
+}
+
+void OpenAddressingDataEngine::migrate_group(Table& table, const size_t groupIdx) const
+{
+    Table* const nextTable = table.m_next.load(std::memory_order_acquire);
+    assert(nextTable != nullptr);
+
+    for (size_t slotIdx = groupIdx * GroupSize; slotIdx < (groupIdx + 1) * GroupSize; ++slotIdx)
+    {
+        AtomicEntryPtr& slot = table.m_slots[slotIdx];
+
+        // Freeze the slot, so nobody can insert into it any more
+        Entry* ptr = slot.load(std::memory_order_acquire);
+        while (!slot.compare_exchange_weak(ptr, get_with_flags(ptr, FrozenFlag), std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+        }
+        assert(!is_frozen(ptr) && "Every group is migrated by a single thread");
+
+        if (ptr == nullptr)
+        {
+            continue;
+        }
+
+        // Drop erased entry. It is deleted together with this table.
+        ValueBuffer* emptyValue = nullptr;
+        if (ptr->m_value.compare_exchange_strong(emptyValue, get_retired_value(), std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            slot.store(get_with_flags(ptr, FrozenFlag | DroppedFlag), std::memory_order_release);
+            continue;
+        }
+
+        Table* target = nextTable;
+        while (true)
+        {
+            Entry* existing = nullptr;
+            const ProbeStatus status = insert_into_table(*target, ptr, existing);
+            if (status == ProbeStatus::Inserted)
+            {
+                break;
+            }
+            assert(status != ProbeStatus::Found && "Key cannot be inserted into the next table while it is present in this one");
+            if (status == ProbeStatus::Found)
+            {
+                break;
+            }
+
+            Table* newerTable = target->m_next.load(std::memory_order_acquire);
+            if (newerTable == nullptr)
+            {
+                grow_table(*target);
+                newerTable = target->m_next.load(std::memory_order_acquire);
+            }
+            target = newerTable;
+        }
+    }
+}
+
+void OpenAddressingDataEngine::finish_migrations() const
+{
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        delete_table(static_cast<Table*>(ptr));
+        return;
+    };
+
+    while (true)
+    {
+        Table* table = m_table.load(std::memory_order_acquire);
+        Table* const nextTable = table->m_next.load(std::memory_order_acquire);
+        if (nextTable == nullptr || table->m_migratedGroupCount.load(std::memory_order_acquire) != table->m_groupCount)
+        {
+            return;
+        }
+
+        if (m_table.compare_exchange_strong(table, nextTable, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            EpochReclamation::retire(table, deleter); // somebody may still use it
+        }
+    }
+}
+
+void OpenAddressingDataEngine::grow_table(Table& table) const
+{
+    if (table.m_next.load(std::memory_order_acquire) != nullptr)
+    {
+        return;
+    }
+
+    // New table is sized by live entries only: erased ones are dropped during migration.
+    // If they fit at half of the maximum load, the table is rehashed at the same size:
+    // erased entries fill it, so set/erase churn does not grow it.
+    const size_t liveCount = static_cast<size_t>(std::max<std::ptrdiff_t>(m_liveCount.load(std::memory_order_relaxed), 0));
+    const size_t requiredSlotCount = liveCount * 100 / (MaxLoadPercent / 2);
+    const size_t slotCount = std::max(requiredSlotCount, table.m_groupCount * GroupSize);
+    const size_t groupCount = bit_extra::round_up_to_power_of_2((slotCount + GroupSize - 1) / GroupSize);
+
+    auto ptrNewTable = std::make_unique<Table>(groupCount);
+
+    Table* expected = nullptr;
+    if (table.m_next.compare_exchange_strong(expected, ptrNewTable.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+        ptrNewTable.release(); // do not own the table any more. Its owner is the previous table now.
+    }
+    // else somebody else has already created the next table
+}
+
+bool OpenAddressingDataEngine::lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const
+{
+    EpochReclamation::Guard guard;
+
+    const Entry* const entry = find_entry(get_table(), hash, key);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    const ValueBuffer* const currentValue = entry->load_value();
+    if (currentValue == nullptr || currentValue == get_retired_value())
+    {
+        return false; // erased
+    }
+
+    visitor(currentValue->get_view());
+    return true;
+}
+
+void OpenAddressingDataEngine::store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch)
+{
+    EpochReclamation::Guard guard;
+
+    Table* table = get_table();
+
+    // Existing entry is updated in place: only the new value is allocated
+    Entry* const existingEntry = find_entry(table, hash, key);
+    if (existingEntry != nullptr && update_value(*existingEntry, value, changeEpoch))
+    {
+        return;
+    }
+
+    EntryUniquePtr ptrNewEntry = create_entry(hash, key, value, changeEpoch);
+
+    while (true)
+    {
+        Entry* entry = nullptr;
+        const ProbeStatus status = insert_into_table(*table, ptrNewEntry.get(), entry);
+
+        if (status == ProbeStatus::Inserted)
+        {
+            ptrNewEntry.release(); // do not own the entry any more. Its owner is the table now.
+            m_liveCount.fetch_add(1, std::memory_order_relaxed);
+
+            const size_t usedSlotCount = table->m_usedSlotCount.load(std::memory_order_relaxed);
+            if (usedSlotCount * 100 > table->m_groupCount * GroupSize * MaxLoadPercent)
+            {
+                grow_table(*table);
+            }
+            return;
+        }
+
+        if (status == ProbeStatus::Found)
+        {
+            if (update_value(*entry, value, changeEpoch))
+            {
+                return; // ptrNewEntry is deallocated automatically here
+            }
+            continue; // entry was dropped by migration right now. Search again, it will be skipped.
+        }
+
+        // Moved or Full
+        Table* nextTable = table->m_next.load(std::memory_order_acquire);
+        if (nextTable == nullptr)
+        {
+            grow_table(*table);
+            nextTable = table->m_next.load(std::memory_order_acquire);
+        }
+        table = nextTable;
+    }
+}
+
+bool OpenAddressingDataEngine::remove(const std::string_view key, const size_t hash)
+{
+    EpochReclamation::Guard guard;
+
+    Entry* const entry = find_entry(get_table(), hash, key);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    // Entry stays in the table until the next migration
+    ValueBuffer* currentValue = entry->load_value();
+    while (currentValue != nullptr && currentValue != get_retired_value())
+    {
+        if (entry->m_value.compare_exchange_strong(currentValue, nullptr, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            m_liveCount.fetch_sub(1, std::memory_order_relaxed);
+            ValueBuffer::retire(currentValue); // somebody may still read it
+            return true;
+        }
+    }
+
+    return false; // already erased
+}
+
+bool OpenAddressingDataEngine::update_value(Entry& entry, const std::string_view value, const ChangeEpoch changeEpoch)
+{
+    ValueBuffer* const newValue = ValueBuffer::create(value, changeEpoch);
+
+    ValueBuffer* currentValue = entry.load_value();
+    while (currentValue != get_retired_value())
+    {
+        if (entry.m_value.compare_exchange_strong(currentValue, newValue, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            if (currentValue == nullptr)
+            {
+                m_liveCount.fetch_add(1, std::memory_order_relaxed); // erased entry is revived
+            }
+            ValueBuffer::retire(currentValue); // somebody may still read it
+            return true;
+        }
+    }
+
+    ValueBuffer::destroy(newValue);
+    return false;
+}
+
+bool OpenAddressingDataEngine::is_visited(const Table* const oldestTable, const Table* const table, const Entry& entry) const
+{
+    for (const Table* olderTable = oldestTable; olderTable != table; olderTable = olderTable->m_next.load(std::memory_order_acquire))
+    {
+        Entry* found = nullptr;
+        if (find_in_table(*olderTable, entry.m_hash, entry.get_key(), found) == ProbeStatus::Found)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void OpenAddressingDataEngine::enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const
+{
+    EpochReclamation::Guard guard;
+
+    Table* const oldestTable = m_table.load(std::memory_order_acquire);
+
+    for (const Table* table = oldestTable; table != nullptr; table = table->m_next.load(std::memory_order_acquire))
+    {
+        for (size_t slotIdx = 0; slotIdx < table->m_groupCount * GroupSize; ++slotIdx)
+        {
+            const Entry* const entry = get_entry(table->m_slots[slotIdx].load(std::memory_order_acquire));
+            if (entry == nullptr)
+            {
+                continue;
+            }
+
+            const ValueBuffer* const currentValue = entry->load_value();
+            if (currentValue == nullptr || currentValue == get_retired_value())
+            {
+                continue; // erased
+            }
+
+            // During migration the same entry may be present in several tables. Visit it only in the oldest one.
+            if (is_visited(oldestTable, table, *entry))
+            {
+                continue;
+            }
+
+            visitor(entry->get_key(), *currentValue);
+        }
+    }
+}
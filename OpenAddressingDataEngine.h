@@ -0,0 +1,135 @@
+#pragma once
+
+#include "DataEngine.h"
+#include "KeyValueNode.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+// Lock-free open-addressing hash map.
+// Every slot has one control byte with a 7-bit hash fingerprint ("tag"). Control bytes of 8-32 slots
+// are compared at once using SIMD, so most of non-matching slots are rejected without touching keys.
+class OpenAddressingDataEngine : public DataEngine
+{
+public:
+    OpenAddressingDataEngine(const size_t initialCapacity);
+    virtual ~OpenAddressingDataEngine() override;
+
+    virtual bool is_lock_free() const override;
+
+protected:
+    // Entries are shared between the old and the new table during migration.
+    // Null value means the entry is erased. It is revived by the next `set()` of the same key.
+    // Erased entries are dropped during migration: they get the special "retired" value then.
+    class Entry : public KeyValueNode<Entry>
+    {
+    public:
+        const size_t                    m_hash; // compared before the key; reused by migration
+
+    public:
+        Entry(const Layout& layout, const size_t hash) :
+            KeyValueNode(layout), m_hash(hash)
+        {
+        }
+    };
+
+    using EntryDeleter = void(Entry* const ptr);
+    using EntryUniquePtr = std::unique_ptr<Entry, EntryDeleter*>;
+    using AtomicEntryPtr = std::atomic<Entry*>;
+    using Tags = std::uint64_t; // one control byte per slot
+
+    // Number of slots probed at once: one AVX2 or SSE2 register, or one 64-bit word without SIMD
+#if defined(__AVX2__)
+    static constexpr size_t GroupSize = 32;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    static constexpr size_t GroupSize = 16;
+#else
+    static constexpr size_t GroupSize = sizeof(Tags);
+#endif
+
+    // Control bytes of a group: zero means empty slot or unfinished insertion, otherwise the slot tag.
+    // Control bytes are kept apart from slots, so a miss is usually decided by the control bytes alone.
+    struct alignas(GroupSize) ControlGroup
+    {
+        std::atomic<Tags>               m_words[GroupSize / sizeof(Tags)] = {};
+    };
+
+    static_assert(sizeof(ControlGroup) == GroupSize);
+
+    // Slot states: nullptr (empty), entry pointer, or entry pointer / nullptr with flags in the lowest bits (frozen).
+    // Frozen slots belong to a table being migrated: they are never changed again.
+    class Table
+    {
+    public:
+        explicit Table(const size_t groupCount);
+
+    public:
+        const size_t                    m_groupCount; // always power of 2
+        std::unique_ptr<ControlGroup[]> m_controls;
+        std::unique_ptr<AtomicEntryPtr[]> m_slots;  // GroupSize slots per control group
+        std::atomic<size_t>             m_usedSlotCount = 0; // erased entries occupy slots too
+
+        // Table we are migrating entries to
+        std::atomic<Table*>             m_next = nullptr;
+        std::atomic<size_t>             m_migrateCursor = 0;
+        std::atomic<size_t>             m_migratedGroupCount = 0;
+    };
+
+    enum class ProbeStatus
+    {
+        Found,      // entry with the key was found
+        NotFound,   // empty control byte was reached
+        Inserted,   // new entry was put into an empty slot
+        Moved,      // frozen empty slot was reached: continue in the next table
+        Full,       // all slots are occupied
+    };
+
+    // Grow table when this percentage of slots is used
+    static constexpr size_t MaxLoadPercent = 80;
+    // Number of groups migrated to the next table by every operation during migration
+    static constexpr size_t MigrationBatchSize = 4;
+
+protected:
+    virtual bool lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const override;
+    virtual void store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch) override;
+    virtual bool remove(const std::string_view key, const size_t hash) override;
+    virtual void enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const override;
+
+    static std::uint8_t make_tag(const size_t hash);
+    static ValueBuffer* get_retired_value();
+
+    EntryUniquePtr create_entry(const size_t hash, const std::string_view key, const std::string_view value, const ChangeEpoch changeEpoch);
+    // Returns false if the entry is retired
+    bool update_value(Entry& entry, const std::string_view value, const ChangeEpoch changeEpoch);
+    static void delete_table(Table* const table);
+
+    // Searches the entry in the table chain starting from `table`. Skips retired entries.
+    Entry* find_entry(Table* table, const size_t hash, const std::string_view key) const;
+    ProbeStatus find_in_table(const Table& table, const size_t hash, const std::string_view key, Entry*& entry) const;
+
+    // Puts `newEntry` into the first empty slot unless the entry with the same key is found
+    ProbeStatus insert_into_table(Table& table, Entry* const newEntry, Entry*& entry) const;
+    static void publish_tag(Table& table, const size_t slotIdx, const std::uint8_t tag);
+
+    Table* get_table() const;
+    void migrate_groups() const;
+    void migrate_group(Table& table, const size_t groupIdx) const;
+    void finish_migrations() const;
+    void grow_table(Table& table) const;
+
+    // Checks whether enumeration has already seen the key in tables older than `table`
+    bool is_visited(const Table* const oldestTable, const Table* const table, const Entry& entry) const;
+
+protected:
+    // The oldest table which is still in use. Newer tables are linked via `Table::m_next`.
+    mutable std::atomic<Table*>     m_table;
+    std::atomic<std::ptrdiff_t>     m_liveCount = 0; // signed: erase may decrement it before set increments
+
+    static_assert(std::atomic<Entry*>::is_always_lock_free);
+    static_assert(std::atomic<Table*>::is_always_lock_free);
+    static_assert(std::atomic<Tags>::is_always_lock_free);
+    static_assert(alignof(Entry) >= 4, "Two lowest bits of entry pointers are used as flags");
+};
@@ -1,12 +1,369 @@
 #include "Persistency.h"
 
+#include "BinarySerializer.h"
 #include "DataEngine.h"
 #include "DataSerializer.h"
+#include "FileSync.h"
 #include "Logger.h"
 
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+#include <vector>
 
-size_t Persistency::initial_load_data(DataEngine& engine, const std::string& databaseFilename)
+#ifndef _WIN32
+#  include <csignal>
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#endif
+
+
+namespace
+{
+    // Set in a forked snapshot process, where only the forking thread exists
+    bool g_isSnapshotProcess = false;
+
+    // A thread started in the forked child could not rely on locks and heaps copied from other threads
+    // in an unknown state, so blocks are compressed by the child's own thread there
+    size_t get_packing_thread_count()
+    {
+        return g_isSnapshotProcess ? 0 : BinarySerializer::Writer::get_default_packing_thread_count();
+    }
+
+    // Sleeps when data is written faster than the limit
+    class IoRateLimiter
+    {
+    public:
+        explicit IoRateLimiter(const size_t bytesPerSecond) :
+            m_bytesPerSecond(bytesPerSecond),
+            m_startTime(std::chrono::steady_clock::now())
+        {
+        }
+
+        void consume(const size_t byteCount)
+        {
+            if (m_bytesPerSecond == 0)
+            {
+                return; // unlimited
+            }
+
+            m_byteCount += byteCount;
+            if (m_byteCount - m_checkedByteCount < CheckGranularity)
+            {
+                return;
+            }
+            m_checkedByteCount = m_byteCount;
+
+            const auto allowedTime = std::chrono::duration<double>(double(m_byteCount) / double(m_bytesPerSecond));
+            const auto elapsedTime = std::chrono::steady_clock::now() - m_startTime;
+            if (allowedTime > elapsedTime)
+            {
+                std::this_thread::sleep_for(allowedTime - elapsedTime);
+            }
+        }
+
+    protected:
+        static constexpr size_t CheckGranularity = 65536; // do not look at the clock for every record
+
+        const size_t                            m_bytesPerSecond;
+        const std::chrono::steady_clock::time_point m_startTime;
+        size_t                                  m_byteCount = 0;
+        size_t                                  m_checkedByteCount = 0;
+    };
+
+    // Items are written while the engine is enumerated: no intermediate document is built
+    template<typename Writer, typename... OpenArgs>
+    std::optional<size_t> write_data(const DataEngine& engine, const std::string& databaseFilename, const char* const writerName,
+        IoRateLimiter& rateLimiter, const OpenArgs... openArgs)
+    {
+        size_t recordCount = 0;
+
+        Writer writer;
+        if (!writer.open(databaseFilename, openArgs...))
+        {
+            LOG_ERROR << writerName << "::open() failed" << std::endl;
+            return std::nullopt;
+        }
+
+        const std::function<DataEngine::EnumerateVisitorProc> visitor =
+            [&writer, &recordCount, &rateLimiter](const std::string_view key, const std::string_view value)
+        {
+            if (writer.add(key, value))
+            {
+                ++recordCount;
+            }
+            rateLimiter.consume(key.size() + value.size());
+            return;
+        };
+
+        engine.enumerate(visitor);
+
+        const bool ok = writer.finish();
+        if (!ok)
+        {
+            LOG_ERROR << writerName << "::finish() failed" << std::endl;
+            return std::nullopt;
+        }
+
+        return recordCount;
+    }
+
+    // Written while the engine is enumerated, like `write_data()`. Erased keys are taken from the engine by the caller.
+    std::optional<size_t> write_delta(const DataEngine& engine, const std::vector<std::string>& erasedKeys,
+        const DataEngine::ChangeEpoch sinceEpoch, const std::string& deltaFilename, const BinarySerializer::SnapshotId baseId,
+        const size_t bytesPerSecond, const BinarySerializer::Compression compression)
+    {
+        const std::string temporaryFilename = deltaFilename + ".tmp";
+
+        IoRateLimiter rateLimiter(bytesPerSecond);
+
+        size_t recordCount = 0;
+
+        BinarySerializer::Writer writer;
+        if (!writer.open_delta(temporaryFilename, baseId, compression, get_packing_thread_count()))
+        {
+            LOG_ERROR << "BinarySerializer::Writer::open_delta() failed" << std::endl;
+            return std::nullopt;
+        }
+
+        // Erased keys go first: a key erased and set again is restored by its value record
+        for (const std::string& key : erasedKeys)
+        {
+            if (writer.add_erased(key))
+            {
+                ++recordCount;
+            }
+            rateLimiter.consume(key.size());
+        }
+
+        const std::function<DataEngine::EnumerateVisitorProc> visitor =
+            [&writer, &recordCount, &rateLimiter](const std::string_view key, const std::string_view value)
+        {
+            if (writer.add(key, value))
+            {
+                ++recordCount;
+            }
+            rateLimiter.consume(key.size() + value.size());
+            return;
+        };
+
+        engine.enumerate_changes(sinceEpoch, visitor);
+
+        if (!writer.finish())
+        {
+            LOG_ERROR << "BinarySerializer::Writer::finish() failed" << std::endl;
+            std::error_code error;
+            std::filesystem::remove(temporaryFilename, error);
+            return std::nullopt;
+        }
+
+        if (!FileSync::replace(temporaryFilename, deltaFilename))
+        {
+            return std::nullopt;
+        }
+
+        return recordCount;
+    }
+
+#ifndef _WIN32
+    // Like Redis BGSAVE: the child has a copy-on-write image of the whole process memory as of the fork,
+    // so the engine it enumerates does not change, and this process keeps modifying its own pages.
+    // Returns what `job` returned in the child.
+    std::optional<size_t> run_in_child_process(const std::function<std::optional<size_t>()>& job)
+    {
+        int pipeFds[2] = {};
+        if (::pipe(pipeFds) != 0)
+        {
+            LOG_ERROR << "Failed creating a pipe for the snapshot process" << std::endl;
+            return std::nullopt;
+        }
+
+        const pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            LOG_ERROR << "Failed forking the snapshot process" << std::endl;
+            ::close(pipeFds[0]);
+            ::close(pipeFds[1]);
+            return std::nullopt;
+        }
+
+        if (pid == 0)
+        {
+            // Only this thread exists in the child: it must not wait for locks held by other threads at the fork.
+            // `_exit()` skips destructors and exit handlers which belong to the parent.
+            ::close(pipeFds[0]);
+            g_isSnapshotProcess = true;
+
+            // The server's handlers would notify the parent through their inherited descriptors
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+
+            std::optional<size_t> recordCount;
+            try
+            {
+                recordCount = job();
+            }
+            catch (...)
+            {
+            }
+
+            const std::uint64_t reportedCount = recordCount.value_or(0);
+            const bool reported = recordCount && ::write(pipeFds[1], &reportedCount, sizeof(reportedCount)) == sizeof(reportedCount);
+            ::_exit(reported ? 0 : 1);
+        }
+
+        ::close(pipeFds[1]);
+
+        std::uint64_t reportedCount = 0;
+        ssize_t readSize = 0;
+        do
+        {
+            readSize = ::read(pipeFds[0], &reportedCount, sizeof(reportedCount));
+        } while (readSize < 0 && errno == EINTR);
+        ::close(pipeFds[0]);
+
+        int status = 0;
+        while (::waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+
+        if (readSize != sizeof(reportedCount) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            LOG_ERROR << "Snapshot process failed; pid: " << pid << std::endl;
+            return std::nullopt;
+        }
+
+        return static_cast<size_t>(reportedCount);
+    }
+#endif
+
+    std::optional<size_t> run_snapshot_job(const Persistency::SnapshotProcess process, const std::function<std::optional<size_t>()>& job)
+    {
+        if (process == Persistency::SnapshotProcess::Current)
+        {
+            return job();
+        }
+
+#ifdef _WIN32
+        LOG_ERROR << "Snapshots in a forked process are not supported on this platform" << std::endl;
+        return std::nullopt;
+#else
+        return run_in_child_process(job);
+#endif
+    }
+
+    // Delta files which are not valid for the database file are not counted
+    size_t count_deltas(const std::string& databaseFilename, const BinarySerializer::SnapshotId baseId, std::uint64_t* const ptrDeltaSize)
+    {
+        size_t deltaCount = 0;
+        for (; ; ++deltaCount)
+        {
+            const std::string deltaFilename = Persistency::get_delta_filename(databaseFilename, deltaCount);
+
+            const std::optional<BinarySerializer::SnapshotInfo> info = BinarySerializer::get_snapshot_info(deltaFilename);
+            if (!info || info->m_kind != BinarySerializer::Kind::Delta || info->m_baseId != baseId)
+            {
+                return deltaCount;
+            }
+
+            if (ptrDeltaSize != nullptr)
+            {
+                std::error_code error;
+                *ptrDeltaSize += std::filesystem::file_size(deltaFilename, error);
+            }
+        }
+    }
+
+    void remove_deltas(const std::string& databaseFilename)
+    {
+        for (size_t deltaIdx = 0; ; ++deltaIdx)
+        {
+            std::error_code error;
+            if (!std::filesystem::remove(Persistency::get_delta_filename(databaseFilename, deltaIdx), error))
+            {
+                return;
+            }
+        }
+    }
+}
+
+
+Persistency::Format Persistency::get_format(const std::string& databaseFilename)
+{
+    return std::filesystem::path(databaseFilename).extension() == ".json" ? Format::Json : Format::Binary;
+}
+
+bool Persistency::is_fork_supported()
 {
+#ifdef _WIN32
+    return false;
+#else
+    return true;
+#endif
+}
+
+std::string Persistency::get_delta_filename(const std::string& databaseFilename, const size_t deltaIdx)
+{
+    return databaseFilename + ".delta." + std::to_string(deltaIdx + 1);
+}
+
+std::optional<size_t> Persistency::initial_load_data(DataEngine& engine, const std::string& databaseFilename, const size_t threadCount)
+{
+    if (BinarySerializer::is_binary_file(databaseFilename))
+    {
+        // Called concurrently: the engine is thread-safe, the counter is shared
+        std::atomic<size_t> binaryRecordCount = 0;
+        auto binaryLoadVisitor = [&engine, &binaryRecordCount](const std::string_view name, const std::string_view value)
+        {
+            engine.set(name, value);
+            binaryRecordCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        };
+
+        const bool ok = BinarySerializer::load(databaseFilename, binaryLoadVisitor, threadCount);
+        if (!ok)
+        {
+            LOG_ERROR << "BinarySerializer::load() failed" << std::endl;
+            return std::nullopt;
+        }
+
+        const std::optional<DeltaChain> deltaChain = get_delta_chain(databaseFilename);
+        const size_t deltaCount = deltaChain ? deltaChain->m_deltaCount : 0;
+
+        // Deltas are applied in order: a later one may set a key erased by an earlier one
+        auto erasedVisitor = [&engine](const std::string_view name)
+        {
+            engine.erase(name);
+            return;
+        };
+
+        for (size_t deltaIdx = 0; deltaIdx < deltaCount; ++deltaIdx)
+        {
+            if (!BinarySerializer::load_delta(get_delta_filename(databaseFilename, deltaIdx), erasedVisitor, binaryLoadVisitor))
+            {
+                LOG_ERROR << "BinarySerializer::load_delta() failed" << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        // A delta with a damaged header ends the chain: changes saved in it and in later deltas would be lost silently.
+        // A valid delta of an older database file is ignored.
+        const std::string nextDeltaFilename = get_delta_filename(databaseFilename, deltaCount);
+        std::error_code error;
+        if (std::filesystem::exists(nextDeltaFilename, error) && !BinarySerializer::get_snapshot_info(nextDeltaFilename))
+        {
+            LOG_ERROR << "Delta snapshot file is damaged: " << nextDeltaFilename << std::endl;
+            return std::nullopt;
+        }
+
+        return binaryRecordCount.load();
+    }
+
     size_t recordCount = 0;
     auto loadVisitor = [&engine, &recordCount](const std::string_view name, const std::string_view value)
     {
@@ -19,31 +376,146 @@ size_t Persistency::initial_load_data(DataEngine& engine, const std::string& dat
     if (!ok)
     {
         LOG_ERROR << "DataSerializer::load() failed" << std::endl;
-        return recordCount;
+        return std::nullopt;
     }
 
     return recordCount;
 }
 
-size_t Persistency::store_data(const DataEngine& engine, const std::string& databaseFilename)
+std::optional<Persistency::DeltaChain> Persistency::get_delta_chain(const std::string& databaseFilename)
 {
-    size_t recordCount = 0;
-    DataSerializer::Document document;
+    const std::optional<BinarySerializer::SnapshotInfo> info = BinarySerializer::get_snapshot_info(databaseFilename);
+    if (!info || info->m_kind != BinarySerializer::Kind::Full)
+    {
+        return std::nullopt;
+    }
+
+    DeltaChain deltaChain;
+    deltaChain.m_baseId = info->m_id;
+
+    std::error_code error;
+    deltaChain.m_baseSize = std::filesystem::file_size(databaseFilename, error);
+
+    deltaChain.m_deltaCount = count_deltas(databaseFilename, deltaChain.m_baseId, &deltaChain.m_deltaSize);
+    return deltaChain;
+}
+
+std::optional<size_t> Persistency::store_data(const DataEngine& engine, const std::string& databaseFilename, const size_t bytesPerSecond,
+    const BinarySerializer::Compression compression)
+{
+    // The previous file stays intact until the new one is complete
+    const std::string temporaryFilename = databaseFilename + ".tmp";
+
+    IoRateLimiter rateLimiter(bytesPerSecond);
 
-    const std::function<DataEngine::EnumerateVisitorProc> visitor =
-        [&document, &recordCount](const std::string_view key, const std::string_view value)
+    const std::optional<size_t> recordCount = get_format(databaseFilename) == Format::Binary
+        ? write_data<BinarySerializer::Writer>(engine, temporaryFilename, "BinarySerializer::Writer", rateLimiter, compression,
+            get_packing_thread_count())
+        : write_data<DataSerializer::Writer>(engine, temporaryFilename, "DataSerializer::Writer", rateLimiter);
+
+    if (!recordCount)
+    {
+        std::error_code error;
+        std::filesystem::remove(temporaryFilename, error);
+        return std::nullopt;
+    }
+
+    // The log is truncated after this, so the new file must be durable first
+    if (!FileSync::replace(temporaryFilename, databaseFilename))
     {
-        document.add(key, value);
+        return std::nullopt;
+    }
+
+    return recordCount;
+}
+
+std::optional<size_t> Persistency::save_snapshot(const DataEngine& engine, const std::string& databaseFilename, WriteAheadLog* const ptrLog,
+    const size_t bytesPerSecond, const SnapshotProcess process, const BinarySerializer::Compression compression)
+{
+    const std::uint64_t checkpoint = ptrLog != nullptr ? ptrLog->get_checkpoint() : 0;
+
+    const std::optional<size_t> recordCount = run_snapshot_job(process, [&engine, &databaseFilename, bytesPerSecond, compression]()
+        {
+            return store_data(engine, databaseFilename, bytesPerSecond, compression);
+        }
+    );
+
+    if (!recordCount)
+    {
+        return std::nullopt;
+    }
+
+    // They refer to the previous database file and are ignored already
+    remove_deltas(databaseFilename);
+
+    // Records logged while the engine was enumerated are kept: the snapshot may have missed them
+    if (ptrLog != nullptr && !ptrLog->truncate(checkpoint))
+    {
+        LOG_ERROR << "WriteAheadLog::truncate() failed" << std::endl;
+    }
+
+    return recordCount;
+}
+
+std::optional<size_t> Persistency::save_delta(DataEngine& engine, const std::string& databaseFilename, DeltaChain& deltaChain,
+    WriteAheadLog& log, const DataEngine::ChangeEpoch sinceEpoch, const size_t bytesPerSecond, const SnapshotProcess process,
+    const BinarySerializer::Compression compression)
+{
+    // Operations logged before the checkpoint have stamped their values with epochs not older than `sinceEpoch`
+    const std::uint64_t checkpoint = log.get_checkpoint();
+
+    // Taken in this process: a forked child would drain only its own copy of the erased key journal
+    const std::vector<std::string> erasedKeys = engine.get_erased_keys(sinceEpoch);
+
+    const std::string deltaFilename = get_delta_filename(databaseFilename, deltaChain.m_deltaCount);
+    const BinarySerializer::SnapshotId baseId = deltaChain.m_baseId;
+
+    const std::optional<size_t> recordCount = run_snapshot_job(process,
+        [&engine, &erasedKeys, sinceEpoch, &deltaFilename, baseId, bytesPerSecond, compression]()
+        {
+            return write_delta(engine, erasedKeys, sinceEpoch, deltaFilename, baseId, bytesPerSecond, compression);
+        }
+    );
+
+    if (!recordCount)
+    {
+        return std::nullopt;
+    }
+
+    std::error_code error;
+    ++deltaChain.m_deltaCount;
+    deltaChain.m_deltaSize += std::filesystem::file_size(deltaFilename, error);
+
+    if (!log.truncate(checkpoint))
+    {
+        LOG_ERROR << "WriteAheadLog::truncate() failed" << std::endl;
+    }
+
+    return recordCount;
+}
+
+size_t Persistency::open_log(DataEngine& engine, WriteAheadLog& log, const std::string& logFilename,
+    const WriteAheadLog::SyncPolicy syncPolicy, const std::chrono::milliseconds syncInterval)
+{
+    size_t recordCount = 0;
+    auto replayVisitor = [&engine, &recordCount](const WriteAheadLog::Operation operation, const std::string_view key, const std::string_view value)
+    {
+        if (operation == WriteAheadLog::Operation::Set)
+        {
+            engine.set(key, value);
+        }
+        else
+        {
+            engine.erase(key);
+        }
         ++recordCount;
         return;
     };
 
-    engine.enumerate(visitor);
-
-    const bool ok = DataSerializer::save(databaseFilename, document);
+    const bool ok = log.open(logFilename, syncPolicy, syncInterval, replayVisitor);
     if (!ok)
     {
-        LOG_ERROR << "DataSerializer::save() failed" << std::endl;
+        LOG_ERROR << "WriteAheadLog::open() failed" << std::endl;
         return recordCount;
     }
 
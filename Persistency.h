@@ -1,14 +1,82 @@
 #pragma once
 
-#include <string>
-
+#include "BinarySerializer.h"
+#include "DataEngine.h"
+#include "WriteAheadLog.h"
 
-class DataEngine;
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
 
 
 class Persistency
 {
 public:
-    static size_t initial_load_data(DataEngine& engine, const std::string& databaseFilename);
-    static size_t store_data(const DataEngine& engine, const std::string& databaseFilename);
+    enum class Format
+    {
+        Json,       // portable, for import and export
+        Binary,     // fast: loaded via memory mapping without intermediate copies
+    };
+
+    // Where a snapshot enumerates the engine
+    enum class SnapshotProcess
+    {
+        Current,    // a thread of this process enumerates the engine while requests modify it
+        Fork,       // a forked child process enumerates its copy-on-write image of the engine: a point-in-time view
+    };
+
+    // Binary database file and delta snapshots saved after it: "<database>.delta.1", "<database>.delta.2", ...
+    // Deltas of an older database file are ignored.
+    struct DeltaChain
+    {
+        BinarySerializer::SnapshotId    m_baseId = 0;
+        std::uint64_t                   m_baseSize = 0;     // bytes
+        size_t                          m_deltaCount = 0;
+        std::uint64_t                   m_deltaSize = 0;    // bytes, of all deltas
+    };
+
+    // Files with ".json" extension are saved in JSON format, other files are binary snapshots
+    static Format get_format(const std::string& databaseFilename);
+
+    // `SnapshotProcess::Fork` needs POSIX `fork()`
+    static bool is_fork_supported();
+
+    // Format of an existing file is detected by its content, so a JSON file can be imported into any file name.
+    // Binary snapshots are inserted by `threadCount` threads; JSON is parsed by a single thread.
+    // Delta snapshots of a binary database file are applied after it.
+    // Returns nothing if a file can not be loaded completely: the engine then holds only a part of the data,
+    // so it must not be saved over the files, and the write-ahead log must not be truncated.
+    static std::optional<size_t> initial_load_data(DataEngine& engine, const std::string& databaseFilename, const size_t threadCount = 1);
+
+    // `deltaIdx` is zero-based
+    static std::string get_delta_filename(const std::string& databaseFilename, const size_t deltaIdx);
+
+    // Returns nothing if the database file is not a binary snapshot: deltas can not be saved for it
+    static std::optional<DeltaChain> get_delta_chain(const std::string& databaseFilename);
+
+    // Writes a temporary file and renames it over the database file, so the previous file is kept
+    // if saving fails. `bytesPerSecond` = 0 means no I/O rate limit. `compression` applies to binary files only.
+    // Returns nothing if the file was not saved completely.
+    static std::optional<size_t> store_data(const DataEngine& engine, const std::string& databaseFilename, const size_t bytesPerSecond = 0,
+        const BinarySerializer::Compression compression = BinarySerializer::Compression::None);
+
+    // Stores the data while the engine keeps serving requests, then drops log records contained in the snapshot.
+    // Delta snapshots of the previous database file are deleted.
+    static std::optional<size_t> save_snapshot(const DataEngine& engine, const std::string& databaseFilename, WriteAheadLog* const ptrLog,
+        const size_t bytesPerSecond = 0, const SnapshotProcess process = SnapshotProcess::Current,
+        const BinarySerializer::Compression compression = BinarySerializer::Compression::None);
+
+    // Saves the next delta of the chain: keys changed since `sinceEpoch` was returned by `DataEngine::advance_change_epoch()`.
+    // The epoch must be advanced before the call. The log is required: records logged during the enumeration
+    // are kept in it, so changes missed by the delta are not lost.
+    static std::optional<size_t> save_delta(DataEngine& engine, const std::string& databaseFilename, DeltaChain& deltaChain,
+        WriteAheadLog& log, const DataEngine::ChangeEpoch sinceEpoch, const size_t bytesPerSecond = 0,
+        const SnapshotProcess process = SnapshotProcess::Current,
+        const BinarySerializer::Compression compression = BinarySerializer::Compression::None);
+
+    // Applies operations logged after the snapshot was saved, then opens the log for new operations.
+    // Returns the number of replayed records.
+    static size_t open_log(DataEngine& engine, WriteAheadLog& log, const std::string& logFilename,
+        const WriteAheadLog::SyncPolicy syncPolicy, const std::chrono::milliseconds syncInterval);
 };
@@ -0,0 +1,10 @@
+#include "ShardedCounter.h"
+
+
+size_t ShardedCounter::assign_current_thread_shard_index()
+{
+    static std::atomic<size_t> nextThreadIndex = 0;
+
+    t_shardIndex = nextThreadIndex.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+    return t_shardIndex;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+// Counter split into cache-line padded shards, so threads incrementing it do not fight for one cache line.
+// Every thread always uses the same shard. Reading sums all shards: the result is not an atomic snapshot,
+// which is fine for statistics.
+class ShardedCounter
+{
+public:
+    using Value = std::uint64_t;
+
+public:
+    void increment()
+    {
+        size_t shardIndex = t_shardIndex;
+        if (shardIndex == NoShardIndex) [[unlikely]]
+        {
+            shardIndex = assign_current_thread_shard_index();
+        }
+        m_shards[shardIndex].m_value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Value load() const
+    {
+        Value sum = 0;
+        for (const Shard& shard : m_shards)
+        {
+            sum += shard.m_value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    bool is_lock_free() const
+    {
+        return m_shards[0].m_value.is_lock_free();
+    }
+
+protected:
+    static constexpr size_t CacheLineSize = 64;
+    static constexpr size_t ShardCount = 64; // threads are spread round-robin between shards
+    static constexpr size_t NoShardIndex = ShardCount;
+
+    struct alignas(CacheLineSize) Shard
+    {
+        std::atomic<Value>      m_value = 0;
+    };
+
+    static size_t assign_current_thread_shard_index();
+
+protected:
+    Shard                       m_shards[ShardCount];
+
+    // Constant-initialized and inline: reading it is a plain TLS access, without a call or an initialization guard
+    static constinit inline thread_local size_t t_shardIndex = NoShardIndex;
+
+    static_assert(std::atomic<Value>::is_always_lock_free);
+};
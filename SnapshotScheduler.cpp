@@ -0,0 +1,145 @@
+#include "SnapshotScheduler.h"
+
+#include "Logger.h"
+#include "Persistency.h"
+
+#include <filesystem>
+#include <optional>
+#include <system_error>
+
+
+SnapshotScheduler::~SnapshotScheduler()
+{
+    stop();
+}
+
+void SnapshotScheduler::start(DataEngine& engine, WriteAheadLog* const ptrLog, const std::string& databaseFilename,
+    const std::chrono::seconds interval, const size_t bytesPerSecond, const size_t maxDeltaCount, const Persistency::SnapshotProcess process,
+    const BinarySerializer::Compression compression)
+{
+    stop();
+
+    m_ptrEngine = &engine;
+    m_ptrLog = ptrLog;
+    m_databaseFilename = databaseFilename;
+    m_interval = interval;
+    m_bytesPerSecond = bytesPerSecond;
+    m_maxDeltaCount = ptrLog != nullptr ? maxDeltaCount : 0;
+    m_process = process;
+    m_compression = compression;
+    m_deltaChain.reset();
+    m_changesSinceEpoch.reset();
+    m_stopping = false;
+
+    m_thread = std::thread(&SnapshotScheduler::run, this);
+}
+
+void SnapshotScheduler::stop()
+{
+    if (!m_thread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_protect);
+        m_stopping = true;
+    }
+    m_stopRequested.notify_all();
+
+    m_thread.join();
+}
+
+SnapshotScheduler::Statistics SnapshotScheduler::get_statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_protect);
+    return m_statistics;
+}
+
+void SnapshotScheduler::run()
+{
+    LOG_INFO << "SnapshotScheduler: run: begin" << std::endl;
+
+    std::unique_lock<std::mutex> lock(m_protect);
+    while (!m_stopRequested.wait_for(lock, m_interval, [this]() { return m_stopping; }))
+    {
+        lock.unlock();
+        save_snapshot();
+        lock.lock();
+    }
+
+    LOG_INFO << "SnapshotScheduler: run: end" << std::endl;
+}
+
+bool SnapshotScheduler::is_delta_allowed() const
+{
+    // The first snapshot after start is full: changes replayed from the log at startup are not in any delta
+    if (m_maxDeltaCount == 0 || !m_changesSinceEpoch || !m_deltaChain)
+    {
+        return false;
+    }
+
+    return m_deltaChain->m_deltaCount < m_maxDeltaCount && m_deltaChain->m_deltaSize * 2 < m_deltaChain->m_baseSize;
+}
+
+void SnapshotScheduler::save_snapshot()
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // Values set from now on belong to the next snapshot. Advanced before the log checkpoint is taken.
+    const DataEngine::ChangeEpoch nextSinceEpoch = m_ptrEngine->advance_change_epoch();
+
+    const bool isDelta = is_delta_allowed();
+
+    std::optional<size_t> recordCount;
+    std::string filename = m_databaseFilename;
+    if (isDelta)
+    {
+        recordCount = Persistency::save_delta(*m_ptrEngine, m_databaseFilename, *m_deltaChain, *m_ptrLog, *m_changesSinceEpoch,
+            m_bytesPerSecond, m_process, m_compression);
+        filename = Persistency::get_delta_filename(m_databaseFilename, m_deltaChain->m_deltaCount - 1);
+    }
+    else
+    {
+        recordCount = Persistency::save_snapshot(*m_ptrEngine, m_databaseFilename, m_ptrLog, m_bytesPerSecond, m_process, m_compression);
+        if (recordCount && m_maxDeltaCount != 0)
+        {
+            m_deltaChain = Persistency::get_delta_chain(m_databaseFilename);
+        }
+    }
+
+    // After a failure the next snapshot includes changes of this one too
+    if (recordCount)
+    {
+        m_changesSinceEpoch = nextSinceEpoch;
+    }
+
+    const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+
+    std::error_code error;
+    const std::uintmax_t fileSize = std::filesystem::file_size(filename, error);
+
+    {
+        std::lock_guard<std::mutex> lock(m_protect);
+        if (recordCount)
+        {
+            ++(isDelta ? m_statistics.m_savedDeltas : m_statistics.m_savedSnapshots);
+            m_statistics.m_lastDurationMs = static_cast<IntegerCounter>(duration.count());
+            m_statistics.m_lastFileSize = error ? 0 : static_cast<IntegerCounter>(fileSize);
+            m_statistics.m_lastRecordCount = *recordCount;
+        }
+        else
+        {
+            ++m_statistics.m_failedSnapshots;
+        }
+    }
+
+    if (recordCount)
+    {
+        LOG_INFO << "SnapshotScheduler: saved " << *recordCount << " records to " << filename << " in " << duration.count() << " ms" << std::endl;
+    }
+    else
+    {
+        LOG_ERROR << "SnapshotScheduler: failed saving the snapshot: " << m_databaseFilename << std::endl;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "DataEngine.h"
+#include "Persistency.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+
+class WriteAheadLog;
+
+
+// Saves snapshots periodically from a background thread while request threads keep working.
+// With the write-ahead log and a binary database file, only keys changed since the previous snapshot
+// are saved as a delta. A full snapshot replaces the deltas when there are too many of them
+// or they take more than a half of the full snapshot size.
+// Snapshots may be written by a forked process from a point-in-time image of the engine.
+class SnapshotScheduler
+{
+public:
+    using IntegerCounter = std::uint64_t;
+
+    struct Statistics
+    {
+        IntegerCounter  m_savedSnapshots    = 0; // full ones
+        IntegerCounter  m_savedDeltas       = 0;
+        IntegerCounter  m_failedSnapshots   = 0;
+        IntegerCounter  m_lastDurationMs    = 0;
+        IntegerCounter  m_lastFileSize      = 0; // bytes
+        IntegerCounter  m_lastRecordCount   = 0;
+    };
+
+public:
+    SnapshotScheduler() = default;
+    ~SnapshotScheduler();
+
+    SnapshotScheduler(const SnapshotScheduler&) = delete;
+    SnapshotScheduler& operator=(const SnapshotScheduler&) = delete;
+
+    // The first snapshot is saved after `interval`. `bytesPerSecond` = 0 means no I/O rate limit.
+    // `maxDeltaCount` = 0 disables delta snapshots; otherwise the engine must track changes.
+    // `compression` applies to full and delta binary snapshots.
+    void start(DataEngine& engine, WriteAheadLog* const ptrLog, const std::string& databaseFilename,
+        const std::chrono::seconds interval, const size_t bytesPerSecond, const size_t maxDeltaCount,
+        const Persistency::SnapshotProcess process = Persistency::SnapshotProcess::Current,
+        const BinarySerializer::Compression compression = BinarySerializer::Compression::None);
+
+    // Waits for the snapshot in progress
+    void stop();
+
+    Statistics get_statistics() const;
+
+protected:
+    void run();
+    void save_snapshot();
+    bool is_delta_allowed() const;
+
+protected:
+    DataEngine*                     m_ptrEngine = nullptr;
+    WriteAheadLog*                  m_ptrLog = nullptr;
+    std::string                     m_databaseFilename;
+    std::chrono::seconds            m_interval = {};
+    size_t                          m_bytesPerSecond = 0;
+    size_t                          m_maxDeltaCount = 0;
+    Persistency::SnapshotProcess    m_process = Persistency::SnapshotProcess::Current;
+    BinarySerializer::Compression   m_compression = BinarySerializer::Compression::None;
+
+    // Used only by the snapshot thread
+    std::optional<Persistency::DeltaChain> m_deltaChain;
+    std::optional<DataEngine::ChangeEpoch> m_changesSinceEpoch; // of the previous snapshot
+
+    std::thread                     m_thread;
+
+    mutable std::mutex              m_protect;          // protects members below
+    std::condition_variable         m_stopRequested;
+    bool                            m_stopping = false;
+    Statistics                      m_statistics;
+};
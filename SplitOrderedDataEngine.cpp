@@ -0,0 +1,477 @@
+#include "SplitOrderedDataEngine.h"
+#include "AllocatorFactory.h"
+#include "EpochReclamation.h"
+#include "utils/bit.h"
+
+#include <algorithm>
+
+#include <assert.h>
+
+
+namespace
+{
+    // The lowest bit of `m_next` pointer marks the node as erased
+
+    template<typename T>
+    bool is_marked(T* const ptr)
+    {
+        return (reinterpret_cast<std::uintptr_t>(ptr) & 1) != 0;
+    }
+
+    template<typename T>
+    T* get_marked(T* const ptr)
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(ptr) | 1);
+    }
+
+    template<typename T>
+    T* get_unmarked(T* const ptr)
+    {
+        return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(ptr) & ~std::uintptr_t(1));
+    }
+
+    size_t clear_highest_bit(const size_t value)
+    {
+        assert(value != 0);
+        size_t highestBit = 1;
+        while ((value >> 1) >= highestBit)
+        {
+            highestBit <<= 1;
+        }
+        return value & ~highestBit;
+    }
+}
+
+
+SplitOrderedDataEngine::BucketTable::BucketTable(const size_t size, BucketTable* const previous) :
+    m_size(size),
+    m_buckets(std::make_unique<AtomicNodePtr[]>(size)),
+    m_previous(previous)
+{
+    assert(size != 0 && (size & (size - 1)) == 0 && "Table size must be power of 2");
+}
+
+SplitOrderedDataEngine::SplitOrderedDataEngine(const size_t initialBucketCount) :
+    m_head(new ListNode(make_sentinel_order_key(0))),
+    m_table(new BucketTable(bit_extra::round_up_to_power_of_2(std::max<size_t>(initialBucketCount, 1))))
+{
+    m_table.load(std::memory_order_relaxed)->m_buckets[0].store(m_head, std::memory_order_relaxed);
+}
+
+SplitOrderedDataEngine::~SplitOrderedDataEngine()
+{
+    // Nodes and tables which are already retired are deleted by EpochReclamation
+    ListNode* node = m_head;
+    while (node != nullptr)
+    {
+        ListNode* current = node;
+        node = get_unmarked(node->m_next.load(std::memory_order_relaxed));
+        delete_node(current);
+    }
+
+    BucketTable* const currentTable = m_table.load(std::memory_order_relaxed);
+    BucketTable* const previousTable = currentTable->m_previous.load(std::memory_order_relaxed);
+    if (previousTable != nullptr)
+    {
+        delete previousTable; // migration was not finished
+    }
+    delete currentTable;
+}
+
+bool SplitOrderedDataEngine::is_lock_free() const
+{
+    if (!m_successReads.is_lock_free())
+    {
+        return false;
+    }
+
+    AtomicNodePtr ptrNode;
+    if (!ptrNode.is_lock_free())
+    {
+        return false;
+    }
+
+    if (!m_table.is_lock_free())
+    {
+        return false;
+    }
+
+    if (!EpochReclamation::is_lock_free())
+    {
+        return false;
+    }
+
+    return true;
+}
+
+SplitOrderedDataEngine::OrderKey SplitOrderedDataEngine::make_data_order_key(const size_t hash)
+{
+    // Regular nodes have the lowest bit set so they always go after the sentinel of their bucket
+    constexpr OrderKey highestBit = OrderKey(1) << 63;
+    return bit_extra::reverse_bits(static_cast<OrderKey>(hash) | highestBit);
+}
+
+SplitOrderedDataEngine::OrderKey SplitOrderedDataEngine::make_sentinel_order_key(const size_t bucketIdx)
+{
+    return bit_extra::reverse_bits(static_cast<OrderKey>(bucketIdx));
+}
+
+SplitOrderedDataEngine::BucketTable* SplitOrderedDataEngine::get_table() const
+{
+    BucketTable* const table = m_table.load(std::memory_order_acquire);
+    migrate_buckets(*table);
+    return table;
+}
+
+SplitOrderedDataEngine::ListNode* SplitOrderedDataEngine::get_bucket(BucketTable& table, const size_t bucketIdx) const
+{
+    ListNode* const sentinel = table.m_buckets[bucketIdx].load(std::memory_order_acquire);
+    if (sentinel != nullptr)
+    {
+        return sentinel;
+    }
+
+    // Bucket might not be migrated yet. Readers are able to see both tables.
+    BucketTable* const previous = table.m_previous.load(std::memory_order_acquire);
+    if (previous != nullptr && bucketIdx < previous->m_size)
+    {
+        ListNode* const oldSentinel = previous->m_buckets[bucketIdx].load(std::memory_order_acquire);
+        if (oldSentinel != nullptr)
+        {
+            return oldSentinel;
+        }
+    }
+
+    return initialize_bucket(table, bucketIdx);
+}
+
+SplitOrderedDataEngine::ListNode* SplitOrderedDataEngine::initialize_bucket(BucketTable& table, const size_t bucketIdx) const
+{
+    assert(bucketIdx != 0 && "Bucket #0 is always initialized");
+
+    ListNode* const parent = get_bucket(table, clear_highest_bit(bucketIdx));
+    ListNode* const sentinel = insert_sentinel(parent, make_sentinel_order_key(bucketIdx));
+
+    ListNode* expected = nullptr;
+    table.m_buckets[bucketIdx].compare_exchange_strong(expected, sentinel, std::memory_order_release, std::memory_order_relaxed);
+    assert(expected == nullptr || expected == sentinel);
+
+    return sentinel;
+}
+
+SplitOrderedDataEngine::ListNode* SplitOrderedDataEngine::insert_sentinel(ListNode* const start, const OrderKey orderKey) const
+{
+    std::unique_ptr<ListNode> ptrNewSentinel;
+
+    while (true)
+    {
+        ListNode* prev = nullptr;
+        ListNode* node = nullptr;
+        if (find_position(start, orderKey, {}, prev, node))
+        {
+            return node; // somebody else has already initialized the same bucket
+        }
+
+        if (!ptrNewSentinel)
+        {
+            ptrNewSentinel = std::make_unique<ListNode>(orderKey);
+        }
+        ptrNewSentinel->m_next.store(node, std::memory_order_relaxed);
+
+        const bool exchanged = prev->m_next.compare_exchange_strong(node, ptrNewSentinel.get(), std::memory_order_release, std::memory_order_relaxed);
+        if (exchanged)
+        {
+            return ptrNewSentinel.release(); // do not own the node any more. Its owner is the list now.
+        }
+        // list was changed right after `prev`, search again
+    }
+}
+
+bool SplitOrderedDataEngine::find_position(ListNode* const start, const OrderKey orderKey, const std::string_view key, ListNode*& prev, ListNode*& node) const
+{
+    assert(start->is_sentinel());
+
+retry:
+    prev = start;
+    node = get_unmarked(prev->m_next.load(std::memory_order_acquire));
+
+    while (node != nullptr)
+    {
+        ListNode* const next = node->m_next.load(std::memory_order_acquire);
+
+        if (is_marked(next))
+        {
+            // `node` is erased: unlink it
+            ListNode* expected = node;
+            if (!prev->m_next.compare_exchange_strong(expected, get_unmarked(next), std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                goto retry; // `prev` was changed or erased itself. Sentinels are never erased, so start again.
+            }
+            retire_node(node);
+            node = get_unmarked(next);
+            continue;
+        }
+
+        if (node->m_orderKey > orderKey)
+        {
+            return false;
+        }
+
+        if (node->m_orderKey == orderKey)
+        {
+            // Sentinels and data nodes never have equal order keys
+            if (node->is_sentinel() || static_cast<const DataNode*>(node)->get_key() == key)
+            {
+                return true;
+            }
+        }
+
+        prev = node;
+        node = next;
+    }
+
+    return false;
+}
+
+void SplitOrderedDataEngine::migrate_buckets(BucketTable& table) const
+{
+    BucketTable* const previous = table.m_previous.load(std::memory_order_acquire);
+    if (previous == nullptr)
+    {
+        return;
+    }
+
+    const size_t begin = table.m_migrateCursor.fetch_add(MigrationBatchSize, std::memory_order_relaxed);
+    if (begin >= previous->m_size)
+    {
+        return; // the rest of buckets is being migrated by other threads
+    }
+    const size_t end = std::min(begin + MigrationBatchSize, previous->m_size);
+
+    for (size_t idx = begin; idx < end; ++idx)
+    {
+        ListNode* const sentinel = previous->m_buckets[idx].load(std::memory_order_acquire);
+        if (sentinel != nullptr)
+        {
+            ListNode* expected = nullptr;
+            table.m_buckets[idx].compare_exchange_strong(expected, sentinel, std::memory_order_release, std::memory_order_relaxed);
+        }
+    }
+
+    const size_t migratedCount = table.m_migratedCount.fetch_add(end - begin, std::memory_order_acq_rel) + (end - begin);
+    if (migratedCount == previous->m_size)
+    {
+        table.m_previous.store(nullptr, std::memory_order_release);
+        retire_table(previous); // somebody may still use it
+    }
+}
+
+void SplitOrderedDataEngine::grow_table(BucketTable& table)
+{
+    if (table.m_previous.load(std::memory_order_acquire) != nullptr)
+    {
+        return; // previous growing is not finished yet
+    }
+
+    auto ptrNewTable = std::make_unique<BucketTable>(table.m_size * 2, &table);
+
+    BucketTable* expected = &table;
+    const bool exchanged = m_table.compare_exchange_strong(expected, ptrNewTable.get(), std::memory_order_acq_rel, std::memory_order_relaxed);
+    if (exchanged)
+    {
+        ptrNewTable.release(); // do not own the table any more. Its owner is the engine now.
+    }
+    // else somebody else has already replaced the table
+}
+
+void SplitOrderedDataEngine::retire_node(ListNode* const node)
+{
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        delete_node(static_cast<ListNode*>(ptr));
+        return;
+    };
+
+    EpochReclamation::retire(node, deleter);
+}
+
+void SplitOrderedDataEngine::retire_table(BucketTable* const table)
+{
+    EpochReclamation::Deleter* deleter = [](void* const ptr)
+    {
+        delete static_cast<BucketTable*>(ptr);
+        return;
+    };
+
+    EpochReclamation::retire(table, deleter);
+}
+
+bool SplitOrderedDataEngine::lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const
+{
+    const OrderKey orderKey = make_data_order_key(hash);
+
+    EpochReclamation::Guard guard;
+
+    BucketTable* const table = get_table();
+    const ListNode* node = get_bucket(*table, hash & (table->m_size - 1));
+
+    while (node != nullptr && node->m_orderKey <= orderKey)
+    {
+        const ListNode* const next = node->m_next.load(std::memory_order_acquire);
+
+        if (node->m_orderKey == orderKey && !is_marked(next))
+        {
+            const DataNode* const dataNode = static_cast<const DataNode*>(node);
+            if (dataNode->get_key() == key)
+            {
+                visitor(dataNode->load_value()->get_view());
+                return true;
+            }
+        }
+
+        node = get_unmarked(next);
+    }
+
+    return false;
+}
+
+SplitOrderedDataEngine::NodeUniquePtr SplitOrderedDataEngine::create_node(const OrderKey orderKey, const std::string_view key, const std::string_view value,
+    const ChangeEpoch changeEpoch)
+{
+    NodeDeleter* deleter = [](DataNode* const ptr)
+    {
+        DataNode::destroy(ptr);
+        return;
+    };
+
+    NodeUniquePtr ptrNewNode = std::unique_ptr<DataNode, NodeDeleter*>(DataNode::create(key, value, changeEpoch, orderKey), deleter);
+    return ptrNewNode;
+}
+
+void SplitOrderedDataEngine::delete_node(ListNode* const node)
+{
+    if (node->is_sentinel())
+    {
+        delete node;
+    }
+    else
+    {
+        DataNode::destroy(static_cast<DataNode*>(node));
+    }
+}
+
+void SplitOrderedDataEngine::store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch)
+{
+    const OrderKey orderKey = make_data_order_key(hash);
+
+    EpochReclamation::Guard guard;
+
+    BucketTable* const table = get_table();
+    ListNode* const bucket = get_bucket(*table, hash & (table->m_size - 1));
+
+    // Node is created only when the key is not found: updates allocate just the new value
+    NodeUniquePtr ptrNewNode(nullptr, nullptr);
+
+    while (true)
+    {
+        ListNode* prev = nullptr;
+        ListNode* node = nullptr;
+        if (find_position(bucket, orderKey, key, prev, node))
+        {
+            DataNode* const dataNode = static_cast<DataNode*>(node);
+            ValueBuffer* const oldValue = dataNode->m_value.exchange(ValueBuffer::create(value, changeEpoch), std::memory_order_acq_rel);
+            ValueBuffer::retire(oldValue); // somebody may still read it
+
+            // If `remove` has marked the node meanwhile, the new value went away with it: insert the key again
+            if (!is_marked(node->m_next.load(std::memory_order_acquire)))
+            {
+                return; // ptrNewNode is deallocated automatically here
+            }
+            continue;
+        }
+
+        if (!ptrNewNode)
+        {
+            ptrNewNode = create_node(orderKey, key, value, changeEpoch);
+        }
+
+        ptrNewNode->m_next.store(node, std::memory_order_relaxed);
+
+        const bool exchanged = prev->m_next.compare_exchange_strong(node, ptrNewNode.get(), std::memory_order_release, std::memory_order_relaxed);
+        if (exchanged)
+        {
+            // we have put the element into its sorted position in the list
+            ptrNewNode.release(); // do not own the node any more. Its owner is the list now.
+            break;
+        }
+        // list was changed right after `prev` or `prev` was erased, search again
+    }
+
+    const std::ptrdiff_t elementCount = m_elementCount.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (elementCount > static_cast<std::ptrdiff_t>(table->m_size * MaxLoadFactor))
+    {
+        grow_table(*table);
+    }
+}
+
+bool SplitOrderedDataEngine::remove(const std::string_view key, const size_t hash)
+{
+    const OrderKey orderKey = make_data_order_key(hash);
+
+    EpochReclamation::Guard guard;
+
+    BucketTable* const table = get_table();
+    ListNode* const bucket = get_bucket(*table, hash & (table->m_size - 1));
+
+    ListNode* prev = nullptr;
+    ListNode* node = nullptr;
+    if (!find_position(bucket, orderKey, key, prev, node))
+    {
+        return false;
+    }
+
+    // Logical deletion: mark `m_next` pointer of the node
+    ListNode* next = node->m_next.load(std::memory_order_acquire);
+    do
+    {
+        if (is_marked(next))
+        {
+            return false; // somebody else has erased it
+        }
+    } while (!node->m_next.compare_exchange_weak(next, get_marked(next), std::memory_order_acq_rel, std::memory_order_acquire));
+
+    m_elementCount.fetch_sub(1, std::memory_order_relaxed);
+
+    // Physical deletion: unlink the node from the list
+    ListNode* expected = node;
+    if (prev->m_next.compare_exchange_strong(expected, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+    {
+        retire_node(node);
+    }
+    else
+    {
+        find_position(bucket, orderKey, key, prev, node); // it unlinks all marked nodes on its way
+    }
+
+    return true;
+}
+
+void SplitOrderedDataEngine::enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const
+{
+    EpochReclamation::Guard guard;
+
+    const ListNode* node = m_head;
+
+    while (node != nullptr)
+    {
+        const ListNode* const next = node->m_next.load(std::memory_order_acquire);
+
+        if (!node->is_sentinel() && !is_marked(next))
+        {
+            const DataNode* const dataNode = static_cast<const DataNode*>(node);
+            visitor(dataNode->get_key(), *dataNode->load_value());
+        }
+
+        node = get_unmarked(next);
+    }
+}
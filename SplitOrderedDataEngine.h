@@ -0,0 +1,135 @@
+#pragma once
+
+#include "AllocatorFactory.h"
+#include "DataEngine.h"
+#include "KeyValueNode.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+// Lock-free hash map: split-ordered list with online growing bucket array
+class SplitOrderedDataEngine : public DataEngine
+{
+public:
+    SplitOrderedDataEngine(const size_t initialBucketCount);
+    virtual ~SplitOrderedDataEngine() override;
+
+    virtual bool is_lock_free() const override;
+
+protected:
+    // All nodes of all buckets are stored in a single list sorted by "split-order" key
+    // (bit-reversed hash). Every bucket points to its own sentinel node inside this list.
+    // So growing the bucket array never moves nodes: new buckets are just new sentinels
+    // inserted between already existing nodes.
+    // Erased nodes are first marked by setting the lowest bit of their `m_next` pointer
+    // and then unlinked. Unlinked nodes are deleted via epoch-based reclamation.
+    using OrderKey = std::uint64_t;
+
+    class ListNode
+    {
+    public:
+        // For data nodes it is the cached key hash: searches compare it first
+        // and compare keys only when it matches. Nodes are never rehashed.
+        const OrderKey                  m_orderKey;
+        std::atomic<ListNode*>          m_next = nullptr;
+
+        static_assert(std::atomic<ListNode*>::is_always_lock_free);
+
+    public:
+        explicit ListNode(const OrderKey orderKey) :
+            m_orderKey(orderKey)
+        {
+        }
+
+        // Sentinels are small fixed-size blocks: they are taken from the current thread heap as data nodes are.
+        // Data nodes are created by `KeyValueNode::create()` and never use these operators.
+        static void* operator new(const size_t size)
+        {
+            return AllocatorFactory::get_allocator<char>().allocate(size);
+        }
+
+        static void operator delete(void* const ptr, const size_t size)
+        {
+            AllocatorFactory::get_allocator<char>().deallocate(static_cast<char*>(ptr), size);
+        }
+
+        bool is_sentinel() const
+        {
+            return (m_orderKey & 1) == 0;
+        }
+    };
+
+    class DataNode : public ListNode, public KeyValueNode<DataNode>
+    {
+    public:
+        DataNode(const Layout& layout, const OrderKey orderKey) :
+            ListNode(orderKey), KeyValueNode(layout)
+        {
+        }
+    };
+
+    using AtomicNodePtr = std::atomic<ListNode*>;
+    using NodeDeleter = void(DataNode* const ptr);
+    using NodeUniquePtr = std::unique_ptr<DataNode, NodeDeleter*>;
+
+    class BucketTable
+    {
+    public:
+        explicit BucketTable(const size_t size, BucketTable* const previous = nullptr);
+
+    public:
+        const size_t                        m_size; // always power of 2
+        std::unique_ptr<AtomicNodePtr[]>    m_buckets;
+
+        // Table we are migrating buckets from. It is reset to nullptr when migration is finished.
+        std::atomic<BucketTable*>           m_previous = nullptr;
+        std::atomic<size_t>                 m_migrateCursor = 0;
+        std::atomic<size_t>                 m_migratedCount = 0;
+    };
+
+    // Grow bucket array when average bucket list length reaches this value
+    static constexpr size_t MaxLoadFactor = 1;
+    // Number of buckets copied from the previous table by every operation during migration
+    static constexpr size_t MigrationBatchSize = 16;
+
+protected:
+    virtual bool lookup(const std::string_view key, const size_t hash, const std::function<ReadVisitorProc>& visitor) const override;
+    virtual void store(const std::string_view key, const size_t hash, const std::string_view value, const ChangeEpoch changeEpoch) override;
+    virtual bool remove(const std::string_view key, const size_t hash) override;
+    virtual void enumerate_values(const std::function<EnumerateValuesVisitorProc>& visitor) const override;
+
+    static OrderKey make_data_order_key(const size_t hash);
+    static OrderKey make_sentinel_order_key(const size_t bucketIdx);
+
+    NodeUniquePtr create_node(const OrderKey orderKey, const std::string_view key, const std::string_view value, const ChangeEpoch changeEpoch);
+    static void delete_node(ListNode* const node);
+
+    static void retire_node(ListNode* const node);
+    static void retire_table(BucketTable* const table);
+
+    BucketTable* get_table() const;
+    ListNode* get_bucket(BucketTable& table, const size_t bucketIdx) const;
+    ListNode* initialize_bucket(BucketTable& table, const size_t bucketIdx) const;
+    ListNode* insert_sentinel(ListNode* const start, const OrderKey orderKey) const;
+
+    // Searches the list after the `start` sentinel for the node with given order key (and key for data nodes).
+    // Unlinks marked nodes on its way. Returns true if the node is found; it is stored in `node` then.
+    // Otherwise `node` is the first node with a greater order key. Anyway `prev` is the node just before `node`.
+    bool find_position(ListNode* const start, const OrderKey orderKey, const std::string_view key, ListNode*& prev, ListNode*& node) const;
+
+    void migrate_buckets(BucketTable& table) const;
+    void grow_table(BucketTable& table);
+
+protected:
+    // Head of the list. It is the sentinel node of the bucket #0
+    ListNode* const                     m_head;
+
+    mutable std::atomic<BucketTable*>   m_table;
+    std::atomic<std::ptrdiff_t>         m_elementCount = 0; // signed: erase may decrement it before set increments
+
+    static_assert(AtomicNodePtr::is_always_lock_free);
+    static_assert(std::atomic<BucketTable*>::is_always_lock_free);
+};
@@ -0,0 +1,653 @@
+#include "WriteAheadLog.h"
+
+#include "DataEngine.h"
+#include "FileSync.h"
+#include "Logger.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <bit>
+#include <bitset>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+
+
+#ifdef _MSC_VER
+#pragma warning( disable : 4996 ) // warning C4996: 'fopen': This function or variable may be unsafe.
+#endif
+
+
+static_assert(std::endian::native == std::endian::little, "Log format is little-endian. Add byte swapping for other platforms");
+
+
+namespace
+{
+    constexpr size_t RecordChecksumOffset = sizeof(Crc32c::Value);
+
+    // Locks the selected key stripes in the index order, so batches with common keys never deadlock
+    template <size_t LockCount>
+    class KeyLocks
+    {
+    public:
+        KeyLocks(std::array<std::mutex, LockCount>& locks, const std::bitset<LockCount>& lockMask) :
+            m_locks(locks),
+            m_lockMask(lockMask)
+        {
+            for (size_t lockIdx = 0; lockIdx < LockCount; ++lockIdx)
+            {
+                if (m_lockMask[lockIdx])
+                {
+                    m_locks[lockIdx].lock();
+                }
+            }
+        }
+
+        ~KeyLocks()
+        {
+            for (size_t lockIdx = 0; lockIdx < LockCount; ++lockIdx)
+            {
+                if (m_lockMask[lockIdx])
+                {
+                    m_locks[lockIdx].unlock();
+                }
+            }
+        }
+
+        KeyLocks(const KeyLocks&) = delete;
+        KeyLocks& operator=(const KeyLocks&) = delete;
+
+    private:
+        std::array<std::mutex, LockCount>&  m_locks;
+        const std::bitset<LockCount>        m_lockMask;
+    };
+}
+
+
+WriteAheadLog::WriteAheadLog() :
+    m_file(nullptr)
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    close();
+}
+
+
+bool WriteAheadLog::open(const std::string& filename, const SyncPolicy syncPolicy, const std::chrono::milliseconds syncInterval,
+    const std::function<ReplayVisitorProc>& replayVisitor)
+{
+    close();
+
+    m_filename = filename;
+    m_syncPolicy = syncPolicy;
+    m_syncInterval = syncInterval;
+
+    m_appendedSequence = 0;
+    m_committedSequence = 0;
+    m_fileStartSequence = 0;
+    m_committedFileSize = sizeof(FileHeader);
+    m_droppedRanges.clear();
+    m_needsRecovery = false;
+    m_hasUnsyncedRecords = false;
+
+    bool created = true;
+    if (std::filesystem::exists(filename))
+    {
+        MappedFile mappedFile;
+        if (!mappedFile.open(filename))
+        {
+            return false;
+        }
+
+        const std::string_view data = mappedFile.get_data();
+
+        // A shorter file was being created when the process crashed: nothing was logged yet
+        if (data.size() >= sizeof(FileHeader))
+        {
+            FileHeader header = {};
+            std::memcpy(&header, data.data(), sizeof(header));
+
+            if (std::memcmp(header.m_signature, Signature, sizeof(Signature)) != 0)
+            {
+                LOG_ERROR << "File is not a write-ahead log: " << filename << std::endl;
+                return false;
+            }
+
+            if (header.m_version != Version || header.m_headerSize != sizeof(FileHeader))
+            {
+                LOG_ERROR << "Unsupported write-ahead log version: " << header.m_version << "; file: " << filename << std::endl;
+                return false;
+            }
+
+            const size_t validSize = sizeof(FileHeader) + replay(data.substr(sizeof(FileHeader)), replayVisitor);
+            mappedFile.close();
+
+            if (validSize < data.size())
+            {
+                LOG_WARN << "Write-ahead log has an incomplete record at the end, " << data.size() - validSize
+                    << " bytes are dropped: " << filename << std::endl;
+
+                std::error_code error;
+                std::filesystem::resize_file(filename, validSize, error);
+                if (error)
+                {
+                    LOG_ERROR << "Failed truncating the file: " << filename << "; error: " << error.message() << std::endl;
+                    return false;
+                }
+            }
+
+            m_appendedSequence = validSize - sizeof(FileHeader);
+            m_committedSequence = m_appendedSequence;
+            m_committedFileSize = validSize;
+            created = false;
+        }
+    }
+
+    if (created)
+    {
+        std::lock_guard<std::mutex> lock(m_protect);
+        if (!create())
+        {
+            return false;
+        }
+    }
+    else
+    {
+        m_file.m_file = std::fopen(filename.c_str(), "ab");
+        if (m_file.m_file == nullptr)
+        {
+            LOG_ERROR << "Failed opening the file for writing: " << filename << std::endl;
+            return false;
+        }
+    }
+
+    m_isOpen = true;
+
+    if (m_syncPolicy == SyncPolicy::Interval)
+    {
+        m_stopFlusher = false;
+        m_flusher = std::thread(&WriteAheadLog::run_flusher, this);
+    }
+
+    return true;
+}
+
+void WriteAheadLog::close()
+{
+    if (!is_open())
+    {
+        m_file.close();
+        return;
+    }
+
+    if (m_flusher.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_protect);
+            m_stopFlusher = true;
+        }
+        m_flusherWake.notify_all();
+        m_commitDone.notify_all();
+        m_flusher.join();
+    }
+
+    // Writers are finished: their records are committed or dropped. The end of a failed commit is cut off.
+    if ((!m_needsRecovery || recover_file()) && std::fflush(m_file.m_file) == 0)
+    {
+        FileSync::sync(m_file.m_file, m_filename);
+    }
+
+    m_file.close();
+    m_pendingBuffer.clear();
+    m_isOpen = false;
+}
+
+bool WriteAheadLog::set(DataEngine& engine, const std::string_view key, const std::string_view value)
+{
+    Change change = { Operation::Set, key, value };
+    return apply(engine, std::span<Change>(&change, 1));
+}
+
+bool WriteAheadLog::erase(DataEngine& engine, const std::string_view key, bool& erased)
+{
+    Change change = { Operation::Erase, key, {} };
+    const bool ok = apply(engine, std::span<Change>(&change, 1));
+    erased = change.m_erased;
+    return ok;
+}
+
+bool WriteAheadLog::apply(DataEngine& engine, const std::span<Change> changes)
+{
+    // Without the key locks two writers of the same key could log and apply in different orders,
+    // and the replay would restore a value different from the one the engine has.
+    // They are held until the changes are applied: readers see a value only after it is committed.
+    // With `SyncPolicy::Always` that includes the fsync, so writers of other keys sharing a stripe wait for it too.
+    std::bitset<KeyLockCount> keyLockMask;
+    for (const Change& change : changes)
+    {
+        keyLockMask.set(std::hash<std::string_view>()(change.m_key) % KeyLockCount);
+    }
+    const KeyLocks<KeyLockCount> keyLocks(m_keyLocks, keyLockMask);
+
+    std::uint64_t sequence = 0;
+    if (!append(changes, sequence) || !wait_for_commit(sequence))
+    {
+        return false;
+    }
+
+    for (Change& change : changes)
+    {
+        if (change.m_operation == Operation::Set)
+        {
+            engine.set(change.m_key, change.m_value);
+        }
+        else
+        {
+            change.m_erased = engine.erase(change.m_key);
+        }
+    }
+
+    return true;
+}
+
+std::uint64_t WriteAheadLog::get_checkpoint()
+{
+    std::uint64_t checkpoint = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_protect);
+        checkpoint = m_appendedSequence;
+    }
+
+    // Operations logged before the checkpoint may still be committing and applying under their key locks.
+    // Taking every key lock in turn waits for them without stopping all writers at once.
+    for (std::mutex& keyLock : m_keyLocks)
+    {
+        std::lock_guard<std::mutex> lock(keyLock);
+    }
+
+    return checkpoint;
+}
+
+bool WriteAheadLog::truncate(const std::uint64_t checkpoint)
+{
+    // The copy is made without the lock, so another truncation must not replace the file meanwhile
+    const std::lock_guard<std::mutex> truncateLock(m_truncateProtect);
+
+    std::unique_lock<std::mutex> lock(m_protect);
+
+    // Records before the checkpoint are committed by their writers
+    m_commitDone.wait(lock, [this, checkpoint]() { return m_committedSequence >= checkpoint || !is_open(); });
+
+    if (!is_open())
+    {
+        return false;
+    }
+
+    if (checkpoint <= m_fileStartSequence)
+    {
+        return true;
+    }
+
+    // Committed records are flushed to the file, and commits only append after them. A part of a failed commit
+    // after them is not copied.
+    const size_t tailOffset = static_cast<size_t>(get_file_offset(checkpoint));
+    const size_t copiedFileSize = static_cast<size_t>(m_committedFileSize);
+    lock.unlock();
+
+    // Writers keep committing while the bulk of the tail is copied and synced
+    const std::string newFilename = m_filename + ".tmp";
+    {
+        MappedFile mappedFile;
+        if (!mappedFile.open(m_filename))
+        {
+            return false; // the old log is still valid
+        }
+
+        const std::string_view tail = mappedFile.get_data().substr(tailOffset, copiedFileSize - tailOffset);
+        stdlib_extra::FileOwner file(std::fopen(newFilename.c_str(), "wb"));
+
+        FileHeader header = {};
+        std::memcpy(header.m_signature, Signature, sizeof(Signature));
+        header.m_version = Version;
+        header.m_headerSize = sizeof(FileHeader);
+
+        if (file.m_file == nullptr
+            || std::fwrite(&header, sizeof(header), 1, file.m_file) != 1
+            || std::fwrite(tail.data(), 1, tail.size(), file.m_file) != tail.size()
+            || std::fflush(file.m_file) != 0
+            || !FileSync::sync(file.m_file, newFilename))
+        {
+            LOG_ERROR << "Failed writing the file: " << newFilename << std::endl;
+            return false;
+        }
+    }
+
+    // Writers are blocked only while the records committed meanwhile are appended and the file is replaced
+    lock.lock();
+    m_commitDone.wait(lock, [this]() { return !m_committing; });
+
+    if (!is_open())
+    {
+        return false;
+    }
+
+    const size_t newFileSize = sizeof(FileHeader) + static_cast<size_t>(m_committedFileSize) - tailOffset;
+    {
+        MappedFile mappedFile;
+        stdlib_extra::FileOwner file(std::fopen(newFilename.c_str(), "ab"));
+        if (!mappedFile.open(m_filename) || file.m_file == nullptr)
+        {
+            LOG_ERROR << "Failed opening the file for writing: " << newFilename << std::endl;
+            return false;
+        }
+
+        const std::string_view committed = mappedFile.get_data().substr(copiedFileSize, static_cast<size_t>(m_committedFileSize) - copiedFileSize);
+        if (std::fwrite(committed.data(), 1, committed.size(), file.m_file) != committed.size()
+            || std::fflush(file.m_file) != 0
+            || !FileSync::sync(file.m_file, newFilename))
+        {
+            LOG_ERROR << "Failed writing the file: " << newFilename << std::endl;
+            return false;
+        }
+    }
+
+    m_file.close();
+
+    std::error_code error;
+    std::filesystem::rename(newFilename, m_filename, error);
+    if (error)
+    {
+        LOG_ERROR << "Failed replacing the file: " << m_filename << "; error: " << error.message() << std::endl;
+    }
+    else
+    {
+        m_fileStartSequence = checkpoint;
+        m_committedFileSize = newFileSize;
+        m_needsRecovery = false; // a part of a failed commit was not copied
+        m_hasUnsyncedRecords = false; // the new file is synced
+
+        // Dropped records before the checkpoint are not in the file any more
+        std::erase_if(m_droppedRanges, [checkpoint](const DroppedRange& range) { return range.m_end <= checkpoint; });
+        for (DroppedRange& range : m_droppedRanges)
+        {
+            range.m_begin = std::max(range.m_begin, checkpoint);
+        }
+
+        FileSync::sync_directory(m_filename);
+    }
+
+    // Appending continues to the new file, or to the old one if it was not replaced
+    m_file.m_file = std::fopen(m_filename.c_str(), "ab");
+    if (m_file.m_file == nullptr)
+    {
+        LOG_ERROR << "Failed opening the file for writing: " << m_filename << std::endl;
+        m_needsRecovery = true; // the next commit opens it again
+        return false;
+    }
+
+    return !error;
+}
+
+bool WriteAheadLog::create()
+{
+    m_file.close();
+    m_pendingBuffer.clear();
+
+    m_file.m_file = std::fopen(m_filename.c_str(), "wb");
+    if (m_file.m_file == nullptr)
+    {
+        LOG_ERROR << "Failed opening the file for writing: " << m_filename << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.m_signature, Signature, sizeof(Signature));
+    header.m_version = Version;
+    header.m_headerSize = sizeof(FileHeader);
+
+    if (std::fwrite(&header, sizeof(header), 1, m_file.m_file) != 1 || std::fflush(m_file.m_file) != 0 || !FileSync::sync(m_file.m_file, m_filename)
+        || !FileSync::sync_directory(m_filename))
+    {
+        LOG_ERROR << "Failed writing the file: " << m_filename << std::endl;
+        m_file.close();
+        return false;
+    }
+
+    m_fileStartSequence = m_appendedSequence;
+    m_committedFileSize = sizeof(FileHeader);
+    return true;
+}
+
+size_t WriteAheadLog::replay(const std::string_view data, const std::function<ReplayVisitorProc>& replayVisitor)
+{
+    size_t offset = 0;
+    while (data.size() - offset >= sizeof(RecordHeader))
+    {
+        RecordHeader header = {};
+        std::memcpy(&header, data.data() + offset, sizeof(header));
+
+        const size_t recordSize = sizeof(header) + size_t(header.m_keySize) + header.m_valueSize;
+        if (data.size() - offset < recordSize)
+        {
+            break;
+        }
+
+        const Crc32c::Value checksum = Crc32c::calculate(data.data() + offset + RecordChecksumOffset, recordSize - RecordChecksumOffset);
+        if (checksum != header.m_checksum || (header.m_operation != Operation::Set && header.m_operation != Operation::Erase))
+        {
+            break;
+        }
+
+        const std::string_view key = data.substr(offset + sizeof(header), header.m_keySize);
+        const std::string_view value = data.substr(offset + sizeof(header) + header.m_keySize, header.m_valueSize);
+        replayVisitor(header.m_operation, key, value);
+
+        offset += recordSize;
+    }
+    return offset;
+}
+
+bool WriteAheadLog::append(const std::span<const Change> changes, std::uint64_t& sequence)
+{
+    // Calculated outside of the lock
+    std::vector<RecordHeader> headers(changes.size());
+    for (size_t changeIdx = 0; changeIdx < changes.size(); ++changeIdx)
+    {
+        const Change& change = changes[changeIdx];
+        const std::string_view value = change.m_operation == Operation::Set ? change.m_value : std::string_view();
+        if (change.m_key.size() > std::numeric_limits<std::uint32_t>::max() || value.size() > std::numeric_limits<std::uint32_t>::max())
+        {
+            LOG_ERROR << "Record is too big for the write-ahead log; key: " << change.m_key.substr(0, 64) << std::endl;
+            return false;
+        }
+
+        RecordHeader& header = headers[changeIdx];
+        header.m_keySize = static_cast<std::uint32_t>(change.m_key.size());
+        header.m_valueSize = static_cast<std::uint32_t>(value.size());
+        header.m_operation = change.m_operation;
+
+        Crc32c::Value checksum = Crc32c::calculate(reinterpret_cast<const char*>(&header) + RecordChecksumOffset, sizeof(header) - RecordChecksumOffset);
+        checksum = Crc32c::update(checksum, change.m_key.data(), change.m_key.size());
+        checksum = Crc32c::update(checksum, value.data(), value.size());
+        header.m_checksum = checksum;
+    }
+
+    // Records of a batch are appended together, so they are committed or dropped together
+    std::lock_guard<std::mutex> lock(m_protect);
+
+    if (!is_open())
+    {
+        return false;
+    }
+
+    for (size_t changeIdx = 0; changeIdx < changes.size(); ++changeIdx)
+    {
+        const Change& change = changes[changeIdx];
+        const RecordHeader& header = headers[changeIdx];
+
+        const char* const headerBytes = reinterpret_cast<const char*>(&header);
+        m_pendingBuffer.insert(m_pendingBuffer.end(), headerBytes, headerBytes + sizeof(header));
+        m_pendingBuffer.insert(m_pendingBuffer.end(), change.m_key.begin(), change.m_key.end());
+        m_pendingBuffer.insert(m_pendingBuffer.end(), change.m_value.data(), change.m_value.data() + header.m_valueSize);
+
+        m_appendedSequence += sizeof(header) + header.m_keySize + header.m_valueSize;
+    }
+
+    sequence = m_appendedSequence;
+    return true;
+}
+
+bool WriteAheadLog::wait_for_commit(const std::uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(m_protect);
+
+    while (m_committedSequence < sequence)
+    {
+        if (m_committing)
+        {
+            // Records appended meanwhile are committed together by the next committing thread
+            m_commitDone.wait(lock);
+            continue;
+        }
+
+        m_committing = true;
+        m_commitBuffer.swap(m_pendingBuffer);
+        const std::uint64_t commitSequence = m_appendedSequence;
+
+        lock.unlock();
+        const bool ok = write_records(m_commitBuffer);
+        const size_t commitSize = m_commitBuffer.size();
+        m_commitBuffer.clear(); // the capacity is kept for the next commit
+        lock.lock();
+
+        finish_commit(ok, commitSequence, commitSize);
+    }
+
+    return !is_dropped(sequence);
+}
+
+bool WriteAheadLog::write_records(const std::vector<char>& buffer)
+{
+    return (!m_needsRecovery || recover_file()) && write_and_sync(buffer);
+}
+
+bool WriteAheadLog::recover_file()
+{
+    // A part of the failed commit may be in the file: it is cut off. The stream is reopened,
+    // its buffer may still hold the failed bytes.
+    m_file.close();
+
+    std::error_code error;
+    std::filesystem::resize_file(m_filename, m_committedFileSize, error);
+    if (error)
+    {
+        LOG_ERROR << "Failed truncating the file: " << m_filename << "; error: " << error.message() << std::endl;
+        return false;
+    }
+
+    m_file.m_file = std::fopen(m_filename.c_str(), "ab");
+    if (m_file.m_file == nullptr)
+    {
+        LOG_ERROR << "Failed opening the file for writing: " << m_filename << std::endl;
+        return false;
+    }
+
+    LOG_INFO << "Write-ahead log is recovered after a failed write: " << m_filename << std::endl;
+    return true;
+}
+
+bool WriteAheadLog::write_and_sync(const std::vector<char>& buffer)
+{
+    if (std::fwrite(buffer.data(), 1, buffer.size(), m_file.m_file) != buffer.size() || std::fflush(m_file.m_file) != 0)
+    {
+        LOG_ERROR << "Failed writing the file: " << m_filename << std::endl;
+        return false;
+    }
+
+    // With `SyncPolicy::Interval` the flusher thread syncs the file
+    return m_syncPolicy != SyncPolicy::Always || FileSync::sync(m_file.m_file, m_filename);
+}
+
+void WriteAheadLog::finish_commit(const bool ok, const std::uint64_t commitSequence, const size_t commitSize)
+{
+    m_committing = false;
+
+    if (ok)
+    {
+        m_committedSequence = commitSequence;
+        m_committedFileSize += commitSize;
+        m_needsRecovery = false;
+        m_hasUnsyncedRecords = m_hasUnsyncedRecords || (m_syncPolicy == SyncPolicy::Interval && commitSize != 0);
+    }
+    else
+    {
+        // Records appended during the failed commit would follow the failed ones in the file: they are dropped too.
+        // Their writers get an error and do not apply them.
+        if (m_appendedSequence > m_committedSequence)
+        {
+            m_droppedRanges.push_back({ m_committedSequence, m_appendedSequence });
+        }
+        m_committedSequence = m_appendedSequence;
+        m_pendingBuffer.clear();
+        m_needsRecovery = true;
+    }
+
+    m_commitDone.notify_all();
+}
+
+bool WriteAheadLog::is_dropped(const std::uint64_t sequence) const
+{
+    return std::any_of(m_droppedRanges.begin(), m_droppedRanges.end(), [sequence](const DroppedRange& range)
+        {
+            return range.m_begin < sequence && sequence <= range.m_end;
+        }
+    );
+}
+
+std::uint64_t WriteAheadLog::get_file_offset(const std::uint64_t sequence) const
+{
+    std::uint64_t offset = sizeof(FileHeader) + (sequence - m_fileStartSequence);
+    for (const DroppedRange& range : m_droppedRanges)
+    {
+        if (range.m_begin < sequence)
+        {
+            offset -= std::min(sequence, range.m_end) - range.m_begin;
+        }
+    }
+    return offset;
+}
+
+void WriteAheadLog::run_flusher()
+{
+    std::unique_lock<std::mutex> lock(m_protect);
+
+    while (!m_stopFlusher)
+    {
+        m_flusherWake.wait_for(lock, m_syncInterval, [this]() { return m_stopFlusher; });
+
+        // The file is used by one thread at a time
+        m_commitDone.wait(lock, [this]() { return !m_committing || m_stopFlusher; });
+        if (m_stopFlusher || !m_hasUnsyncedRecords || m_file.m_file == nullptr)
+        {
+            continue; // `close()` syncs the rest
+        }
+
+        m_committing = true;
+        m_hasUnsyncedRecords = false;
+
+        lock.unlock();
+        const bool ok = FileSync::sync(m_file.m_file, m_filename);
+        lock.lock();
+
+        m_committing = false;
+        if (!ok)
+        {
+            m_hasUnsyncedRecords = true; // tried again after the interval
+        }
+        m_commitDone.notify_all();
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "Crc32c.h"
+#include "utils/stdlib.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+class DataEngine;
+
+
+// Append-only log of modifications made after the last snapshot. All numbers are little-endian.
+//
+//   FileHeader
+//   records: { RecordHeader, key bytes, value bytes } * N
+//
+// Writer threads append records to a shared buffer. One of the waiting threads writes the whole buffer
+// and syncs it (group commit), so a single fsync acknowledges all records appended meanwhile.
+// Operations are applied to the engine only after their records are committed, so readers never see
+// a value which may be lost. A torn record at the end of the file (crash during a write) is dropped on open.
+// A failed commit drops its records and the ones appended meanwhile: the file is cut back to the last
+// committed record by the next commit, so the log recovers once the disk error is gone.
+class WriteAheadLog
+{
+public:
+    enum class Operation : std::uint32_t
+    {
+        Set = 1,
+        Erase = 2,
+    };
+
+    enum class SyncPolicy
+    {
+        Always,     // every group commit is synced before writes are acknowledged
+        Interval,   // synced by a background thread once per interval: a power failure may lose the last interval
+        Never,      // the OS decides: only a process crash is survived
+    };
+
+    using ReplayVisitorProc = void(const Operation operation, const std::string_view key, const std::string_view value);
+
+    struct Change
+    {
+        Operation                   m_operation = Operation::Set;
+        std::string_view            m_key;
+        std::string_view            m_value;            // `Operation::Set` only
+        bool                        m_erased = false;   // result of `Operation::Erase`
+    };
+
+public:
+    WriteAheadLog();
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Replays records of an existing log in the order they were written, then opens it for appending
+    bool open(const std::string& filename, const SyncPolicy syncPolicy, const std::chrono::milliseconds syncInterval,
+        const std::function<ReplayVisitorProc>& replayVisitor);
+    void close();
+
+    bool is_open() const
+    {
+        return m_isOpen;
+    }
+
+    // Log the operation, wait until the record is committed according to the sync policy, then modify the engine.
+    // Operations on the same key are logged in the order they are applied.
+    // False means the record was not written: the engine is not modified.
+    bool set(DataEngine& engine, const std::string_view key, const std::string_view value);
+    bool erase(DataEngine& engine, const std::string_view key, bool& erased);
+
+    // Logs the changes with a single commit, then applies them in order. Keys of all changes are locked together,
+    // so a batch of pipelined requests waits for one commit instead of one per request.
+    // False means none of the changes was written or applied.
+    bool apply(DataEngine& engine, const std::span<Change> changes);
+
+    // Position in the log: operations logged before it are already applied to the engine.
+    // Taken right before a snapshot is started.
+    std::uint64_t get_checkpoint();
+
+    // Drops records before the checkpoint once a snapshot containing them is saved.
+    // The rest of the log is copied to a new file which replaces the old one atomically. Writers are blocked
+    // only while the records committed during the copy are appended to it.
+    bool truncate(const std::uint64_t checkpoint);
+
+protected:
+    static constexpr char Signature[8] = { 'K', 'V', 'W', 'A', 'L', '\r', '\n', '\0' };
+    static constexpr std::uint32_t Version = 1;
+
+    static constexpr size_t KeyLockCount = 64;
+
+    struct FileHeader
+    {
+        char                        m_signature[sizeof(Signature)];
+        std::uint32_t               m_version;
+        std::uint32_t               m_headerSize;
+    };
+
+    struct RecordHeader
+    {
+        Crc32c::Value               m_checksum; // of the following fields, the key and the value
+        std::uint32_t               m_keySize;
+        std::uint32_t               m_valueSize;
+        Operation                   m_operation;
+    };
+
+    // Sequences of records dropped by a failed commit: (m_begin, m_end]. They have no bytes in the file.
+    struct DroppedRange
+    {
+        std::uint64_t               m_begin;
+        std::uint64_t               m_end;
+    };
+
+    // Returns size of the valid part of the file
+    static size_t replay(const std::string_view data, const std::function<ReplayVisitorProc>& replayVisitor);
+
+    bool create();
+
+    bool append(const std::span<const Change> changes, std::uint64_t& sequence);
+    bool wait_for_commit(const std::uint64_t sequence);
+
+    // Called by the committing thread. Cuts off records of a failed commit first.
+    bool write_records(const std::vector<char>& buffer);
+    bool recover_file();
+    bool write_and_sync(const std::vector<char>& buffer);
+    void finish_commit(const bool ok, const std::uint64_t commitSequence, const size_t commitSize);
+
+    bool is_dropped(const std::uint64_t sequence) const;
+    // Position of the record ending at `sequence` in the file
+    std::uint64_t get_file_offset(const std::uint64_t sequence) const;
+
+    // Syncs written records once per interval for `SyncPolicy::Interval`
+    void run_flusher();
+
+    static_assert(sizeof(FileHeader) == 16);
+    static_assert(sizeof(RecordHeader) == 16);
+
+protected:
+    stdlib_extra::FileOwner         m_file;                 // used by the committing thread
+    std::string                     m_filename;
+    SyncPolicy                      m_syncPolicy = SyncPolicy::Always;
+    std::chrono::milliseconds       m_syncInterval = {};
+    bool                            m_isOpen = false;
+    std::thread                     m_flusher;
+
+    std::array<std::mutex, KeyLockCount> m_keyLocks;
+    std::mutex                      m_truncateProtect;      // one truncation at a time
+
+    std::mutex                      m_protect;              // protects members below
+    std::condition_variable         m_commitDone;
+    std::condition_variable         m_flusherWake;
+    std::vector<char>               m_pendingBuffer;        // records appended since the last commit
+    std::vector<char>               m_commitBuffer;         // written by the committing thread, reused
+    std::uint64_t                   m_appendedSequence = 0; // bytes appended since open, never decreases
+    std::uint64_t                   m_committedSequence = 0;
+    std::uint64_t                   m_fileStartSequence = 0; // sequence of the first record in the file
+    std::uint64_t                   m_committedFileSize = 0;
+    std::vector<DroppedRange>       m_droppedRanges;        // after `m_fileStartSequence`, in the sequence order
+    bool                            m_committing = false;   // the file is used by a committing or syncing thread
+    bool                            m_needsRecovery = false; // the file may have a part of a failed commit at the end
+    bool                            m_hasUnsyncedRecords = false;
+    bool                            m_stopFlusher = false;
+};
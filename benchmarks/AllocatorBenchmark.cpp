@@ -0,0 +1,117 @@
+#include "BenchmarkUtils.h"
+
+#include "AllocatorFactory.h"
+#include "DataEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Allocation through the thread heaps of AllocatorFactory, and engine sets which allocate their nodes there.
+// Every pass starts new threads, so heaps of exited threads are handed over as in a thread pool restart.
+//
+//   AllocatorBenchmark [--allocations=<count>] [--sets=<per thread>] [--runs=<count>]
+
+namespace
+{
+    constexpr size_t BlockSize = 73; // a typical node with an inline key and value
+
+    template<typename Allocator>
+    double measure_allocations(const size_t allocationCount, double& freeTime)
+    {
+        std::vector<char*> blocks(allocationCount);
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (char*& block : blocks)
+        {
+            Allocator allocator = Allocator();
+            block = allocator.allocate(BlockSize);
+            block[0] = 1;
+        }
+        const std::chrono::steady_clock::time_point allocated = std::chrono::steady_clock::now();
+        for (char* const block : blocks)
+        {
+            Allocator allocator = Allocator();
+            allocator.deallocate(block, BlockSize);
+        }
+        const std::chrono::steady_clock::time_point freed = std::chrono::steady_clock::now();
+
+        freeTime = std::chrono::duration<double, std::nano>(freed - allocated).count() / static_cast<double>(allocationCount);
+        return std::chrono::duration<double, std::nano>(allocated - start).count() / static_cast<double>(allocationCount);
+    }
+
+    struct ThreadHeapAllocator : SeparateHeapAllocator<char>
+    {
+        ThreadHeapAllocator() :
+            SeparateHeapAllocator<char>(AllocatorFactory::get_allocator<char>())
+        {
+        }
+    };
+
+    void print_allocations(const char* const name, const size_t allocationCount, const size_t runCount,
+        double (*measure)(const size_t, double&))
+    {
+        double bestAllocateTime = std::numeric_limits<double>::max();
+        double bestFreeTime = std::numeric_limits<double>::max();
+        for (size_t runIdx = 0; runIdx < runCount; ++runIdx)
+        {
+            double freeTime = 0;
+            bestAllocateTime = std::min(bestAllocateTime, measure(allocationCount, freeTime));
+            bestFreeTime = std::min(bestFreeTime, freeTime);
+        }
+        std::printf("%-28s allocate %6.1f ns, free %6.1f ns\n", name, bestAllocateTime, bestFreeTime);
+    }
+
+    // New keys in the first pass, replaced values in the second one
+    void print_sets(const char* const name, const DataEngine::Implementation implementation, const size_t threadCount,
+        const size_t setCount, const size_t runCount)
+    {
+        double bestInsertTime = std::numeric_limits<double>::max();
+        double bestReplaceTime = std::numeric_limits<double>::max();
+        for (size_t runIdx = 0; runIdx < runCount; ++runIdx)
+        {
+            const std::unique_ptr<DataEngine> ptrEngine = DataEngine::create(implementation);
+
+            const auto set_keys = [&](size_t threadIdx)
+            {
+                for (size_t keyIdx = 0; keyIdx < setCount; ++keyIdx)
+                {
+                    const std::string key = "key_" + std::to_string(threadIdx) + "_" + std::to_string(keyIdx);
+                    ptrEngine->set(key, "value of the key");
+                }
+            };
+
+            const double totalCount = static_cast<double>(threadCount * setCount);
+            bestInsertTime = std::min(bestInsertTime, benchmark_utils::run_threads(threadCount, set_keys) / totalCount);
+            bestReplaceTime = std::min(bestReplaceTime, benchmark_utils::run_threads(threadCount, set_keys) / totalCount);
+        }
+        std::printf("%-16s threads %3zu: insert %7.1f ns, replace %7.1f ns per set\n",
+            name, threadCount, bestInsertTime, bestReplaceTime);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    const size_t allocationCount = benchmark_utils::get_option(argc, argv, "allocations", 1'000'000);
+    const size_t setCount = benchmark_utils::get_option(argc, argv, "sets", 250'000);
+    const size_t runCount = benchmark_utils::get_option(argc, argv, "runs", 3);
+
+    std::printf("CPUs: %u; best of %zu runs\n", std::thread::hardware_concurrency(), runCount);
+
+    print_allocations("std::allocator", allocationCount, runCount, &measure_allocations<std::allocator<char>>);
+    print_allocations("AllocatorFactory", allocationCount, runCount, &measure_allocations<ThreadHeapAllocator>);
+
+    // Wall time per set of all threads
+    for (const size_t threadCount : benchmark_utils::get_thread_counts())
+    {
+        print_sets("split-ordered", DataEngine::Implementation::SplitOrderedList, threadCount, setCount, runCount);
+        print_sets("open-addressing", DataEngine::Implementation::OpenAddressing, threadCount, setCount, runCount);
+    }
+    return 0;
+}
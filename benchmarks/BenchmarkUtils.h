@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace benchmark_utils
+{
+    // Runs `proc(threadIdx)` in `threadCount` threads started together. Returns the wall time in nanoseconds.
+    template<typename Proc>
+    double run_threads(const size_t threadCount, const Proc& proc)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (size_t threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+        {
+            threads.emplace_back([&proc, threadIdx]() { proc(threadIdx); });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Best of several runs: the least disturbed by other processes
+    template<typename Proc>
+    double get_best_time(const size_t runCount, const Proc& proc)
+    {
+        double bestTime = std::numeric_limits<double>::max();
+        for (size_t runIdx = 0; runIdx < runCount; ++runIdx)
+        {
+            bestTime = std::min(bestTime, static_cast<double>(proc()));
+        }
+        return bestTime;
+    }
+
+    // 1, 2, 4, ... up to twice the number of CPUs
+    inline std::vector<size_t> get_thread_counts()
+    {
+        const size_t cpuCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<size_t> threadCounts;
+        for (size_t threadCount = 1; threadCount <= 2 * cpuCount || threadCount <= 4; threadCount *= 2)
+        {
+            threadCounts.push_back(threadCount);
+        }
+        return threadCounts;
+    }
+
+    // Value of a "--name=value" argument
+    inline size_t get_option(const int argc, char** const argv, const std::string_view name, const size_t defaultValue)
+    {
+        const std::string prefix = "--" + std::string(name) + "=";
+        for (int argIdx = 1; argIdx < argc; ++argIdx)
+        {
+            const std::string_view arg = argv[argIdx];
+            if (arg.substr(0, prefix.size()) == prefix)
+            {
+                return std::strtoull(argv[argIdx] + prefix.size(), nullptr, 10);
+            }
+        }
+        return defaultValue;
+    }
+}
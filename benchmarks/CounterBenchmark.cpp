@@ -0,0 +1,69 @@
+#include "BenchmarkUtils.h"
+
+#include "ShardedCounter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+
+// Read statistics of DataEngine: a single atomic counter versus ShardedCounter, incremented by N threads.
+// Contention of the single counter shows up only with several CPUs.
+//
+//   CounterBenchmark [--increments=<per thread>] [--runs=<count>]
+
+namespace
+{
+    struct alignas(64) SingleCounter
+    {
+        std::atomic<std::uint64_t>  m_value = 0;
+    };
+}
+
+
+int main(int argc, char** argv)
+{
+    const size_t incrementCount = benchmark_utils::get_option(argc, argv, "increments", 20'000'000);
+    const size_t runCount = benchmark_utils::get_option(argc, argv, "runs", 5);
+
+    std::printf("CPUs: %u; increments per thread: %zu; best of %zu runs\n",
+        std::thread::hardware_concurrency(), incrementCount, runCount);
+
+    for (const size_t threadCount : benchmark_utils::get_thread_counts())
+    {
+        const double singleTime = benchmark_utils::get_best_time(runCount, [&]()
+            {
+                SingleCounter counter;
+                return benchmark_utils::run_threads(threadCount, [&](size_t)
+                    {
+                        for (size_t incrementIdx = 0; incrementIdx < incrementCount; ++incrementIdx)
+                        {
+                            counter.m_value.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                );
+            }
+        );
+
+        const double shardedTime = benchmark_utils::get_best_time(runCount, [&]()
+            {
+                ShardedCounter counter;
+                return benchmark_utils::run_threads(threadCount, [&](size_t)
+                    {
+                        for (size_t incrementIdx = 0; incrementIdx < incrementCount; ++incrementIdx)
+                        {
+                            counter.increment();
+                        }
+                    }
+                );
+            }
+        );
+
+        // Wall time per increment of all threads: lower is better, and it drops with threads if they scale
+        const double totalCount = static_cast<double>(threadCount * incrementCount);
+        std::printf("threads %3zu: single atomic %6.2f ns, sharded %6.2f ns per increment\n",
+            threadCount, singleTime / totalCount, shardedTime / totalCount);
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "BenchmarkUtils.h"
+
+#include "BinaryServer.h"
+
+#ifdef _MSC_VER
+#  include <SDKDDKVer.h>
+#endif
+#include <boost/asio.hpp>
+#ifdef __linux__
+#  include <netinet/tcp.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <string>
+#include <string_view>
+
+
+// Sends the same request mix to the HTTP API or to the binary protocol of a running server.
+// Every thread uses its own connection and sends `depth` binary requests before reading their responses.
+//
+//   LoadGenerator [--binary] [--port=<port>] [--threads=<count>] [--requests=<per thread>] [--depth=<pipelined requests>]
+//       [--keys=<key range>] [--writes=<percent>]
+
+namespace
+{
+    struct Options
+    {
+        bool            m_binary = false;
+        std::uint16_t   m_port = 8000;
+        size_t          m_threadCount = 1;
+        size_t          m_requestCount = 100'000;
+        size_t          m_depth = 1;
+        size_t          m_keyCount = 100'000;
+        size_t          m_writePercent = 10;
+    };
+
+    std::atomic<size_t> g_okCount = 0;
+    std::atomic<size_t> g_notFoundCount = 0;
+    std::atomic<size_t> g_errorCount = 0;
+
+    void count_status(const bool ok, const bool notFound)
+    {
+        (ok ? g_okCount : notFound ? g_notFoundCount : g_errorCount).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_http_request(std::string& requests, const bool write, const std::string& key, const std::string& value)
+    {
+        if (write)
+        {
+            const std::string body = "{\"value\": \"" + value + "\"}";
+            requests += "POST /api/records/" + key + " HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        }
+        else
+        {
+            requests += "GET /api/records/" + key + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        }
+    }
+
+    void add_binary_request(std::string& requests, const bool write, const std::string& key, const std::string& value)
+    {
+        BinaryServer::RequestHeader header = {};
+        header.m_command = write ? BinaryServer::Command::Set : BinaryServer::Command::Get;
+        header.m_keySize = static_cast<std::uint32_t>(key.size());
+        header.m_valueSize = write ? static_cast<std::uint32_t>(value.size()) : 0;
+
+        requests.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        requests += key;
+        if (write)
+        {
+            requests += value;
+        }
+    }
+
+#ifdef __linux__
+    using QuickAck = boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>;
+#endif
+
+    void read_http_response(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& input)
+    {
+#ifdef __linux__
+        // Crow does not disable Nagle's algorithm: its response body waits for the ACK of the headers,
+        // which Linux delays by up to 40 ms. The flag is reset by the kernel, so it is set before every read.
+        socket.set_option(QuickAck(true));
+#endif
+        const size_t headerSize = boost::asio::read_until(socket, input, "\r\n\r\n");
+        const std::string_view header(static_cast<const char*>(input.data().data()), headerSize);
+
+        // "HTTP/1.1 200 OK"
+        const int status = std::atoi(std::string(header.substr(9, 3)).c_str());
+
+        size_t bodySize = 0;
+        const size_t lengthPos = header.find("Content-Length: ");
+        if (lengthPos != std::string_view::npos)
+        {
+            bodySize = std::strtoull(header.data() + lengthPos + 16, nullptr, 10);
+        }
+        input.consume(headerSize);
+
+        if (input.size() < bodySize)
+        {
+            boost::asio::read(socket, input, boost::asio::transfer_exactly(bodySize - input.size()));
+        }
+        input.consume(bodySize);
+
+        count_status(status == 200, status == 404);
+    }
+
+    void read_binary_response(boost::asio::ip::tcp::socket& socket, boost::asio::streambuf& input)
+    {
+        BinaryServer::ResponseHeader header = {};
+        if (input.size() < sizeof(header))
+        {
+            boost::asio::read(socket, input, boost::asio::transfer_exactly(sizeof(header) - input.size()));
+        }
+        std::memcpy(&header, input.data().data(), sizeof(header));
+        input.consume(sizeof(header));
+
+        if (input.size() < header.m_valueSize)
+        {
+            boost::asio::read(socket, input, boost::asio::transfer_exactly(header.m_valueSize - input.size()));
+        }
+        input.consume(header.m_valueSize);
+
+        count_status(header.m_status == BinaryServer::Status::Ok, header.m_status == BinaryServer::Status::NotFound);
+    }
+
+    void run_connection(const Options& options, const size_t threadIdx)
+    {
+        boost::asio::io_context ioContext;
+        boost::asio::ip::tcp::socket socket(ioContext);
+        socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), options.m_port));
+        socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+        std::mt19937 random(static_cast<std::mt19937::result_type>(1234 + threadIdx));
+        boost::asio::streambuf input;
+        std::string requests;
+
+        for (size_t sentCount = 0; sentCount < options.m_requestCount; )
+        {
+            const size_t batchSize = std::min(options.m_depth, options.m_requestCount - sentCount);
+
+            requests.clear();
+            for (size_t requestIdx = 0; requestIdx < batchSize; ++requestIdx)
+            {
+                // Reads miss half of the time: they cover twice the written key range
+                const bool write = random() % 100 < options.m_writePercent;
+                const std::string key = "name_" + std::to_string(random() % (write ? options.m_keyCount : 2 * options.m_keyCount));
+                const std::string value = "value_" + std::to_string(random());
+
+                if (options.m_binary)
+                {
+                    add_binary_request(requests, write, key, value);
+                }
+                else
+                {
+                    add_http_request(requests, write, key, value);
+                }
+            }
+            boost::asio::write(socket, boost::asio::buffer(requests));
+
+            for (size_t requestIdx = 0; requestIdx < batchSize; ++requestIdx)
+            {
+                if (options.m_binary)
+                {
+                    read_binary_response(socket, input);
+                }
+                else
+                {
+                    read_http_response(socket, input);
+                }
+            }
+            sentCount += batchSize;
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int argIdx = 1; argIdx < argc; ++argIdx)
+    {
+        options.m_binary = options.m_binary || std::string_view(argv[argIdx]) == "--binary";
+    }
+    options.m_port = static_cast<std::uint16_t>(benchmark_utils::get_option(argc, argv, "port", options.m_binary ? 8001 : 8000));
+    options.m_threadCount = benchmark_utils::get_option(argc, argv, "threads", options.m_threadCount);
+    options.m_requestCount = benchmark_utils::get_option(argc, argv, "requests", options.m_requestCount);
+    options.m_depth = std::max<size_t>(benchmark_utils::get_option(argc, argv, "depth", options.m_depth), 1);
+    options.m_keyCount = std::max<size_t>(benchmark_utils::get_option(argc, argv, "keys", options.m_keyCount), 1);
+    options.m_writePercent = benchmark_utils::get_option(argc, argv, "writes", options.m_writePercent);
+
+    // Crow 1.0 starts writing a response while the previous one is still written, so pipelined responses get mixed up
+    if (!options.m_binary && options.m_depth > 1)
+    {
+        std::fprintf(stderr, "HTTP requests are not pipelined: the depth is 1\n");
+        options.m_depth = 1;
+    }
+
+    const double time = benchmark_utils::run_threads(options.m_threadCount, [&options](const size_t threadIdx)
+        {
+            try
+            {
+                run_connection(options, threadIdx);
+            }
+            catch (const std::exception& error)
+            {
+                std::fprintf(stderr, "connection %zu failed: %s\n", threadIdx, error.what());
+                g_errorCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    );
+
+    const size_t totalCount = options.m_threadCount * options.m_requestCount;
+    std::printf("%s, connections %zu, depth %zu: %zu requests in %.3f s = %.0f req/s (ok %zu, not found %zu, errors %zu)\n",
+        options.m_binary ? "binary" : "HTTP", options.m_threadCount, options.m_depth, totalCount, time / 1e9,
+        static_cast<double>(totalCount) / (time / 1e9), g_okCount.load(), g_notFoundCount.load(), g_errorCount.load());
+
+    return g_errorCount.load() == 0 ? 0 : 1;
+}
@@ -4,6 +4,8 @@ import http.client
 import json
 import multiprocessing
 import random
+import socket
+import struct
 import sys
 import time
 import urllib.parse
@@ -14,6 +16,7 @@ import urllib.parse
 
 CONNECT_HOST = '127.0.0.1'
 CONNECT_PORT = 8000
+CONNECT_BINARY_PORT = 8001
 
 MAX_COUNT_OF_DB_RECORDS = 1_000_000
 
@@ -24,9 +27,16 @@ PERCENT_OF_NOT_FOUND_READS = 100 - PERCENT_OF_WRITES - PERCENT_OF_FOUND_READS
 COUNT_OF_OPERATIONS_PER_PROCESS = 10_000
 COUNT_OF_PROCESSES = multiprocessing.cpu_count()
 
-arg1 = sys.argv[1] if len(sys.argv) > 1 else ''
+LOG_EVERY_REQUEST = '--no-logs' not in sys.argv[1:]
 
-LOG_EVERY_REQUEST = arg1 != '--no-logs'
+# Binary protocol: requests are sent in batches without waiting for responses
+USE_BINARY_PROTOCOL = '--binary' in sys.argv[1:]
+BINARY_PIPELINE_DEPTH = 64
+
+BINARY_COMMAND_GET = 1
+BINARY_COMMAND_SET = 2
+BINARY_STATUS_OK = 0
+BINARY_STATUS_NOT_FOUND = 1
 
 WRITE_VALUE_NAMES = [
     *[f'name_{x}' for x in range(MAX_COUNT_OF_DB_RECORDS)],
@@ -105,6 +115,46 @@ def one_request(conn: http.client.HTTPConnection) -> None:
         print(f'REPLY_BODY: {body}')
 
 
+def receive_exactly(sock: socket.socket, size: int) -> bytes:
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError('Connection was closed by the server')
+        data += chunk
+    return bytes(data)
+
+
+def binary_request_batch(sock: socket.socket, request_count: int) -> None:
+    requests = bytearray()
+    commands = []
+    for _ in range(request_count):
+        writing = (random.randint(1, 100) <= PERCENT_OF_WRITES)
+        name = random.choice(WRITE_VALUE_NAMES).encode(encoding='utf8')
+        value = f'val_{random.randint(1000, 1_000_000_000)}'.encode(encoding='utf8') if writing else b''
+        command = BINARY_COMMAND_SET if writing else BINARY_COMMAND_GET
+
+        if LOG_EVERY_REQUEST:
+            print(f'{"SET" if writing else "GET"} {name} {value}')
+
+        requests += struct.pack('<BxxxII', command, len(name), len(value)) + name + value
+        commands.append(command)
+
+    sock.sendall(requests)
+
+    for command in commands:
+        status, value_size = struct.unpack('<BxxxI', receive_exactly(sock, 8))
+        value = receive_exactly(sock, value_size)
+
+        if LOG_EVERY_REQUEST:
+            print(f'REPLY: {status} {value}')
+
+        if command == BINARY_COMMAND_SET:
+            assert status == BINARY_STATUS_OK
+        else:
+            assert status in (BINARY_STATUS_OK, BINARY_STATUS_NOT_FOUND)
+
+
 def main() -> None:
     print('main: begin')
 
@@ -112,15 +162,24 @@ def main() -> None:
 
     operation_count = COUNT_OF_OPERATIONS_PER_PROCESS
 
-    conn = http.client.HTTPConnection(host=CONNECT_HOST, port=CONNECT_PORT)
-    print('HTTP connection was established')
+    if USE_BINARY_PROTOCOL:
+        conn = socket.create_connection((CONNECT_HOST, CONNECT_BINARY_PORT))
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        print('Binary protocol connection was established')
+    else:
+        conn = http.client.HTTPConnection(host=CONNECT_HOST, port=CONNECT_PORT)
+        print('HTTP connection was established')
 
     begin = time.perf_counter()
 
-    for i in range(operation_count):
-        one_request(conn)
-        if (i + 1) % 1000 == 0:
-            print(f'STATS: Finished {i + 1} requests')
+    if USE_BINARY_PROTOCOL:
+        for i in range(0, operation_count, BINARY_PIPELINE_DEPTH):
+            binary_request_batch(conn, min(BINARY_PIPELINE_DEPTH, operation_count - i))
+    else:
+        for i in range(operation_count):
+            one_request(conn)
+            if (i + 1) % 1000 == 0:
+                print(f'STATS: Finished {i + 1} requests')
 
     end = time.perf_counter()
     elapsed = max(end - begin, 0.001)
@@ -1,37 +1,234 @@
+#include "BinaryServer.h"
+#include "Crc32c.h"
 #include "DataEngine.h"
 #include "HttpServer.h"
 #include "Logger.h"
 #include "Persistency.h"
+#include "SnapshotScheduler.h"
+#include "WriteAheadLog.h"
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <future>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
 
 
+namespace
+{
+    bool parse_number(const std::string_view text, size_t& value)
+    {
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return error == std::errc() && end == text.data() + text.size();
+    }
+}
+
+
 int main(const int argc, const char* const* const argv)
 {
     const Logger::LogLevel logLevel = Logger::LogLevel::Debug;
     Logger::SetLogLevel(logLevel);
 
     LOG_INFO << "main: begin" << std::endl;
-    const std::string arg1 = argc > 1 ? argv[1] : "";
+
+    bool noLogs = false;
+    bool useBloomFilter = false;
+    size_t bloomFilterItemCount = BloomFilter::DefaultExpectedItemCount;
+    constexpr std::string_view BloomFilterOption = "--bloom-filter=";
+    std::string databaseFilename = "database.json"; // ".json" extension selects JSON format, otherwise binary
+    constexpr std::string_view DatabaseOption = "--database=";
+    size_t loadThreadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    constexpr std::string_view LoadThreadsOption = "--load-threads=";
+    bool useLog = true;
+    WriteAheadLog::SyncPolicy logSyncPolicy = WriteAheadLog::SyncPolicy::Always;
+    size_t snapshotIntervalSeconds = 300; // 0 disables background snapshots
+    constexpr std::string_view SnapshotIntervalOption = "--snapshot-interval=";
+    size_t snapshotRateLimitMiB = 64; // per second, 0 means no limit
+    constexpr std::string_view SnapshotRateLimitOption = "--snapshot-rate-limit=";
+    bool useSnapshotFork = false;
+    auto snapshotCompression = BinarySerializer::Compression::None;
+    size_t binaryListenPort = 8001; // 0 disables the binary protocol
+    constexpr std::string_view BinaryPortOption = "--binary-port=";
+    DataEngine::Implementation engineImplementation = DataEngine::Implementation::SplitOrderedList;
+    for (int argIdx = 1; argIdx < argc; ++argIdx)
+    {
+        const std::string_view arg = argv[argIdx];
+        if (arg == "--no-logs")
+        {
+            noLogs = true;
+        }
+        else if (arg == "--engine=split-ordered-list")
+        {
+            engineImplementation = DataEngine::Implementation::SplitOrderedList;
+        }
+        else if (arg == "--engine=open-addressing")
+        {
+            engineImplementation = DataEngine::Implementation::OpenAddressing;
+        }
+        else if (arg == "--engine=mapped")
+        {
+            engineImplementation = DataEngine::Implementation::Mapped;
+        }
+        else if (arg == "--bloom-filter")
+        {
+            useBloomFilter = true;
+        }
+        else if (arg.starts_with(BloomFilterOption))
+        {
+            const std::string_view value = arg.substr(BloomFilterOption.size());
+            useBloomFilter = parse_number(value, bloomFilterItemCount) && bloomFilterItemCount != 0;
+            if (!useBloomFilter)
+            {
+                LOG_WARN << "main: invalid number of Bloom filter keys: " << value << std::endl;
+            }
+        }
+        else if (arg.starts_with(DatabaseOption))
+        {
+            databaseFilename = arg.substr(DatabaseOption.size());
+        }
+        else if (arg.starts_with(LoadThreadsOption))
+        {
+            const std::string_view value = arg.substr(LoadThreadsOption.size());
+            if (!parse_number(value, loadThreadCount) || loadThreadCount == 0)
+            {
+                LOG_WARN << "main: invalid number of load threads: " << value << std::endl;
+                loadThreadCount = 1;
+            }
+        }
+        else if (arg == "--no-wal")
+        {
+            useLog = false;
+        }
+        else if (arg == "--wal-sync=always")
+        {
+            logSyncPolicy = WriteAheadLog::SyncPolicy::Always;
+        }
+        else if (arg == "--wal-sync=interval")
+        {
+            logSyncPolicy = WriteAheadLog::SyncPolicy::Interval;
+        }
+        else if (arg == "--wal-sync=never")
+        {
+            logSyncPolicy = WriteAheadLog::SyncPolicy::Never;
+        }
+        else if (arg.starts_with(SnapshotIntervalOption))
+        {
+            const std::string_view value = arg.substr(SnapshotIntervalOption.size());
+            if (!parse_number(value, snapshotIntervalSeconds))
+            {
+                LOG_WARN << "main: invalid snapshot interval: " << value << std::endl;
+            }
+        }
+        else if (arg.starts_with(SnapshotRateLimitOption))
+        {
+            const std::string_view value = arg.substr(SnapshotRateLimitOption.size());
+            if (!parse_number(value, snapshotRateLimitMiB))
+            {
+                LOG_WARN << "main: invalid snapshot rate limit: " << value << std::endl;
+            }
+        }
+        else if (arg == "--snapshot-fork")
+        {
+            useSnapshotFork = true;
+        }
+        else if (arg == "--snapshot-compression=none")
+        {
+            snapshotCompression = BinarySerializer::Compression::None;
+        }
+        else if (arg == "--snapshot-compression=lz4")
+        {
+            snapshotCompression = BinarySerializer::Compression::Lz4;
+        }
+        else if (arg.starts_with(BinaryPortOption))
+        {
+            const std::string_view value = arg.substr(BinaryPortOption.size());
+            if (!parse_number(value, binaryListenPort) || binaryListenPort > std::numeric_limits<std::uint16_t>::max())
+            {
+                LOG_WARN << "main: invalid binary protocol port: " << value << std::endl;
+                binaryListenPort = 0;
+            }
+        }
+        else
+        {
+            LOG_WARN << "main: unknown argument: " << arg << std::endl;
+        }
+    }
 
     // =========================================================
     // ===   Configuration:
     // =========================================================
 
-    const size_t        expectedElementCount = 1000 * 1000;
-    const size_t        hashMapBucketCount = expectedElementCount * 2;
+    const size_t        hashMapInitialCapacity = DataEngine::DefaultInitialCapacity; // grows automatically
     const std::string   listenHost = "127.0.0.1";
     const std::uint16_t listenPort = 8000;
-    const std::string   databaseFilename = "database.json";
-    const bool          logEachRequest = arg1 != "--no-logs";
+    const size_t        serverThreadCount = std::max(std::thread::hardware_concurrency(), 1u); // for the binary protocol
+    const bool          logEachRequest = !noLogs;
+    const std::string   logFilename = databaseFilename + ".wal";
+    const std::string   mappedFilename = databaseFilename + ".mapped"; // for `--engine=mapped`
+    const auto          logSyncInterval = std::chrono::milliseconds(1000); // for `--wal-sync=interval`
+    const size_t        snapshotBytesPerSecond = snapshotRateLimitMiB * 1024 * 1024;
+    const size_t        snapshotMaxDeltaCount = 8; // between full snapshots; deltas need the log and the binary format
+    const bool          isMappedEngine = engineImplementation == DataEngine::Implementation::Mapped;
+    // A forked child would see the shared mapping change, not a point-in-time copy
+    const auto          snapshotProcess = useSnapshotFork && Persistency::is_fork_supported() && !isMappedEngine
+                                            ? Persistency::SnapshotProcess::Fork : Persistency::SnapshotProcess::Current;
+    const bool          useDeltaSnapshots = useLog && snapshotIntervalSeconds != 0 && snapshotMaxDeltaCount != 0
+                                            && Persistency::get_format(databaseFilename) == Persistency::Format::Binary;
 
     // =========================================================
 
-    DataEngine engine(hashMapBucketCount);
+    std::error_code mappedFileError;
+    if (!isMappedEngine && std::filesystem::exists(mappedFilename, mappedFileError))
+    {
+        // Modifications made by another engine would make it stale. Its data is in the snapshot and the log too.
+        LOG_WARN << "main: the mapped engine file is deleted, it would be stale after running another engine: "
+            << mappedFilename << std::endl;
+        if (!std::filesystem::remove(mappedFilename, mappedFileError))
+        {
+            LOG_ERROR << "main: the mapped engine file can not be deleted: " << mappedFilename << "; " << mappedFileError.message() << std::endl;
+            return 1;
+        }
+    }
+
+    const std::unique_ptr<DataEngine> ptrEngine = DataEngine::create(engineImplementation, hashMapInitialCapacity, mappedFilename);
+    if (!ptrEngine)
+    {
+        LOG_ERROR << "main: engine can not be created" << std::endl;
+        return 1;
+    }
+    DataEngine& engine = *ptrEngine;
+
+    if (useBloomFilter)
+    {
+        engine.enable_bloom_filter(bloomFilterItemCount);
+        LOG_INFO << "main: Bloom filter is enabled for " << bloomFilterItemCount << " keys" << std::endl;
+    }
+
+    if (useDeltaSnapshots)
+    {
+        engine.enable_change_tracking();
+    }
+
+    if (snapshotCompression != BinarySerializer::Compression::None && Persistency::get_format(databaseFilename) != Persistency::Format::Binary)
+    {
+        LOG_WARN << "main: snapshot compression applies to binary database files only" << std::endl;
+    }
+
+    if (useSnapshotFork && isMappedEngine)
+    {
+        LOG_WARN << "main: snapshots of the mapped engine can not be saved by a forked process" << std::endl;
+    }
+    else if (useSnapshotFork && snapshotProcess != Persistency::SnapshotProcess::Fork)
+    {
+        LOG_WARN << "main: snapshots can not be saved by a forked process on this platform" << std::endl;
+    }
 
     const bool lock_free = engine.is_lock_free();
     if (lock_free)
@@ -43,22 +240,82 @@ int main(const int argc, const char* const* const argv)
         LOG_WARN << "main: WARNING! Engine implementation IS NOT LOCK-FREE!" << std::endl;
     }
 
-    LOG_INFO << "main: load data..." << std::endl;
-    const size_t loadedRecordCount = Persistency::initial_load_data(engine, databaseFilename);
-    LOG_INFO << "main: loaded " << loadedRecordCount << " DB records from file " << databaseFilename << std::endl;
+    LOG_INFO << "main: checksums are calculated " << (Crc32c::is_hardware_accelerated() ? "by SSE4.2 instructions" : "by a lookup table") << std::endl;
+
+    if (engine.is_restored())
+    {
+        // Records of the write-ahead log are applied already too; replaying them again is harmless
+        LOG_INFO << "main: data is restored from file " << mappedFilename << std::endl;
+    }
+    else
+    {
+        LOG_INFO << "main: load data..." << std::endl;
+        const std::optional<size_t> loadedRecordCount = Persistency::initial_load_data(engine, databaseFilename, loadThreadCount);
+        if (!loadedRecordCount)
+        {
+            // Snapshots and the log would replace the files with the partial data
+            LOG_ERROR << "main: data can not be loaded from file " << databaseFilename << "; fix or remove the file" << std::endl;
+            return 1;
+        }
+        LOG_INFO << "main: loaded " << *loadedRecordCount << " DB records from file " << databaseFilename << std::endl;
+    }
+
+    WriteAheadLog log;
+    if (useLog)
+    {
+        const size_t replayedRecordCount = Persistency::open_log(engine, log, logFilename, logSyncPolicy, logSyncInterval);
+        LOG_INFO << "main: replayed " << replayedRecordCount << " write-ahead log records from file " << logFilename << std::endl;
+
+        if (!log.is_open())
+        {
+            LOG_ERROR << "main: write-ahead log can not be opened, modifications would not be durable" << std::endl;
+            return 1;
+        }
+    }
 
     {
         LOG_INFO << "main: listening connections: begin" << std::endl;
 
+        WriteAheadLog* const ptrLog = log.is_open() ? &log : nullptr;
+
+        SnapshotScheduler snapshotScheduler;
+        if (snapshotIntervalSeconds != 0)
+        {
+            snapshotScheduler.start(engine, ptrLog, databaseFilename, std::chrono::seconds(snapshotIntervalSeconds), snapshotBytesPerSecond,
+                useDeltaSnapshots ? snapshotMaxDeltaCount : 0, snapshotProcess, snapshotCompression);
+        }
+
+        // Served by its own threads while the HTTP server runs
+        BinaryServer binaryServer;
+        if (binaryListenPort != 0 && !binaryServer.start(listenHost, static_cast<std::uint16_t>(binaryListenPort), engine, ptrLog,
+            serverThreadCount))
+        {
+            LOG_ERROR << "main: binary protocol is not available, only HTTP requests are served" << std::endl;
+        }
+
         HttpServer server;
-        server.run(listenHost, listenPort, engine, logEachRequest);
+        server.run(listenHost, listenPort, engine, ptrLog, snapshotScheduler, logEachRequest);
+
+        binaryServer.stop();
+        snapshotScheduler.stop();
 
         LOG_INFO << "main: listening connections: end" << std::endl;
     }
 
     LOG_INFO << "main: save data to file before process exit..." << std::endl;
-    const size_t savedRecordCount = Persistency::store_data(engine, databaseFilename);
-    LOG_INFO << "main: saved " << savedRecordCount << " DB records to file " << databaseFilename << std::endl;
+    // The write-ahead log is truncated after the snapshot is saved
+    const std::optional<size_t> savedRecordCount = Persistency::save_snapshot(engine, databaseFilename, log.is_open() ? &log : nullptr,
+        0, Persistency::SnapshotProcess::Current, snapshotCompression);
+    if (savedRecordCount)
+    {
+        LOG_INFO << "main: saved " << *savedRecordCount << " DB records to file " << databaseFilename << std::endl;
+    }
+    else
+    {
+        LOG_ERROR << "main: failed saving DB records, the write-ahead log is kept" << std::endl;
+    }
+
+    log.close();
 
     LOG_INFO << "main: end" << std::endl;
 
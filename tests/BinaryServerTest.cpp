@@ -0,0 +1,262 @@
+#include "TestUtils.h"
+
+#include "BinaryServer.h"
+#include "DataEngine.h"
+#include "WriteAheadLog.h"
+
+#ifdef _MSC_VER
+#  include <SDKDDKVer.h>
+#endif
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace
+{
+    using Command = BinaryServer::Command;
+    using Status = BinaryServer::Status;
+
+    constexpr const char* Host = "127.0.0.1";
+
+    struct Response
+    {
+        Status                      m_status = Status::InternalError;
+        std::string                 m_value;
+    };
+
+    // Starts the server on the first free port after `FirstPort`
+    std::uint16_t start_server(BinaryServer& server, DataEngine& engine, WriteAheadLog* const ptrLog)
+    {
+        constexpr std::uint16_t FirstPort = 20000;
+        constexpr std::uint16_t PortCount = 200;
+
+        for (std::uint16_t port = FirstPort; port < FirstPort + PortCount; ++port)
+        {
+            if (server.start(Host, port, engine, ptrLog, 2))
+            {
+                return port;
+            }
+        }
+
+        CHECK(false);
+        return 0;
+    }
+
+    std::string make_request(const Command command, const std::string_view key, const std::string_view value = {})
+    {
+        BinaryServer::RequestHeader header = {};
+        header.m_command = command;
+        header.m_keySize = static_cast<std::uint32_t>(key.size());
+        header.m_valueSize = static_cast<std::uint32_t>(value.size());
+
+        std::string request(sizeof(header), '\0');
+        std::memcpy(request.data(), &header, sizeof(header));
+        request += key;
+        request += value;
+        return request;
+    }
+
+    class Client
+    {
+    public:
+        explicit Client(const std::uint16_t port) :
+            m_socket(m_ioContext)
+        {
+            m_socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address(Host), port));
+        }
+
+        void send(const std::string_view requests)
+        {
+            boost::asio::write(m_socket, boost::asio::buffer(requests.data(), requests.size()));
+        }
+
+        Response receive()
+        {
+            BinaryServer::ResponseHeader header = {};
+            boost::asio::read(m_socket, boost::asio::buffer(&header, sizeof(header)));
+
+            Response response;
+            response.m_status = header.m_status;
+            response.m_value.resize(header.m_valueSize);
+            boost::asio::read(m_socket, boost::asio::buffer(response.m_value));
+            return response;
+        }
+
+        Response call(const Command command, const std::string_view key, const std::string_view value = {})
+        {
+            send(make_request(command, key, value));
+            return receive();
+        }
+
+        // True if the server closed the connection
+        bool is_closed()
+        {
+            char byte = 0;
+            boost::system::error_code error;
+            boost::asio::read(m_socket, boost::asio::buffer(&byte, 1), error);
+            return error == boost::asio::error::eof || error == boost::asio::error::connection_reset;
+        }
+
+    protected:
+        boost::asio::io_context         m_ioContext;
+        boost::asio::ip::tcp::socket    m_socket;
+    };
+
+    void check_response(const Response& response, const Status status, const std::string_view value = {})
+    {
+        CHECK(response.m_status == status);
+        CHECK(response.m_value == value);
+    }
+
+    void test_requests(const std::uint16_t port)
+    {
+        Client client(port);
+
+        check_response(client.call(Command::Get, "key"), Status::NotFound);
+        check_response(client.call(Command::Set, "key", "value"), Status::Ok);
+        check_response(client.call(Command::Get, "key"), Status::Ok, "value");
+        check_response(client.call(Command::Set, "key", ""), Status::Ok);
+        check_response(client.call(Command::Get, "key"), Status::Ok, "");
+        check_response(client.call(Command::Erase, "key"), Status::Ok);
+        check_response(client.call(Command::Erase, "key"), Status::NotFound);
+
+        const std::string bigValue(2 << 20, 'b'); // bigger than the read buffer
+        check_response(client.call(Command::Set, "big", bigValue), Status::Ok);
+        check_response(client.call(Command::Get, "big"), Status::Ok, bigValue);
+    }
+
+    void test_bad_requests(const std::uint16_t port)
+    {
+        Client client(port);
+
+        check_response(client.call(Command::Get, ""), Status::BadRequest);
+        check_response(client.call(Command::Set, "", "value"), Status::BadRequest);
+        check_response(client.call(Command::Get, "key", "value"), Status::BadRequest);
+        check_response(client.call(Command::Erase, "key", "value"), Status::BadRequest);
+        check_response(client.call(static_cast<Command>(9), "key"), Status::BadRequest);
+
+        // The connection is still usable
+        check_response(client.call(Command::Set, "key", "value"), Status::Ok);
+    }
+
+    // Responses come in the request order, and each request sees the modifications of the previous ones
+    void test_pipelined_requests(const std::uint16_t port)
+    {
+        constexpr size_t KeyCount = 2000;
+
+        Client client(port);
+
+        std::string requests;
+        for (size_t keyIdx = 0; keyIdx < KeyCount; ++keyIdx)
+        {
+            requests += make_request(Command::Set, "pipelined_" + std::to_string(keyIdx), std::to_string(keyIdx));
+        }
+        requests += make_request(Command::Get, "pipelined_7");
+        requests += make_request(Command::Erase, "pipelined_7");
+        requests += make_request(Command::Get, "pipelined_7");
+        requests += make_request(Command::Set, "pipelined_7", "again");
+        requests += make_request(Command::Erase, "missing");
+        requests += make_request(Command::Get, "pipelined_7");
+        requests += make_request(Command::Get, "", "bad");
+        client.send(requests);
+
+        for (size_t keyIdx = 0; keyIdx < KeyCount; ++keyIdx)
+        {
+            check_response(client.receive(), Status::Ok);
+        }
+        check_response(client.receive(), Status::Ok, "7");
+        check_response(client.receive(), Status::Ok);
+        check_response(client.receive(), Status::NotFound);
+        check_response(client.receive(), Status::Ok);
+        check_response(client.receive(), Status::NotFound);
+        check_response(client.receive(), Status::Ok, "again");
+        check_response(client.receive(), Status::BadRequest);
+
+        // Responses bigger than the output limit
+        const std::string value(300000, 'v');
+        requests = make_request(Command::Set, "value", value);
+        for (int requestIdx = 0; requestIdx < 10; ++requestIdx)
+        {
+            requests += make_request(Command::Get, "value");
+        }
+        client.send(requests);
+        check_response(client.receive(), Status::Ok);
+        for (int requestIdx = 0; requestIdx < 10; ++requestIdx)
+        {
+            check_response(client.receive(), Status::Ok, value);
+        }
+    }
+
+    void test_oversize_request_closes_connection(const std::uint16_t port)
+    {
+        {
+            Client client(port);
+            BinaryServer::RequestHeader header = {};
+            header.m_command = Command::Set;
+            header.m_keySize = 10;
+            header.m_valueSize = BinaryServer::MaxRequestSize;
+            client.send(std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)));
+            CHECK(client.is_closed());
+        }
+
+        // Sizes which overflow 32 bits when added
+        {
+            Client client(port);
+            BinaryServer::RequestHeader header = {};
+            header.m_command = Command::Set;
+            header.m_keySize = 0xFFFFFFFFu;
+            header.m_valueSize = 0xFFFFFFFFu;
+            client.send(std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)));
+            CHECK(client.is_closed());
+        }
+
+        // Other connections are not affected
+        Client client(port);
+        check_response(client.call(Command::Set, "key", "value"), Status::Ok);
+    }
+
+    void run_tests(WriteAheadLog* const ptrLog)
+    {
+        const std::unique_ptr<DataEngine> ptrEngine = DataEngine::create(DataEngine::Implementation::SplitOrderedList);
+
+        BinaryServer server;
+        const std::uint16_t port = start_server(server, *ptrEngine, ptrLog);
+
+        RUN_TEST(test_requests, port);
+        RUN_TEST(test_bad_requests, port);
+        RUN_TEST(test_pipelined_requests, port);
+        RUN_TEST(test_oversize_request_closes_connection, port);
+
+        server.stop();
+    }
+}
+
+
+int main()
+{
+    run_tests(nullptr);
+
+    // Modifications are committed to the log by the write threads
+    const test_utils::TemporaryDirectory directory("BinaryServerTest");
+    const std::string logFilename = directory.get_file("db.wal");
+    {
+        WriteAheadLog log;
+        CHECK(log.open(logFilename, WriteAheadLog::SyncPolicy::Always, std::chrono::milliseconds(0), [](auto, auto, auto) {}));
+        run_tests(&log);
+    }
+
+    size_t recordCount = 0;
+    WriteAheadLog log;
+    CHECK(log.open(logFilename, WriteAheadLog::SyncPolicy::Never, std::chrono::milliseconds(0),
+        [&recordCount](auto, auto, auto) { ++recordCount; }));
+    CHECK(recordCount > 2000);
+    return 0;
+}
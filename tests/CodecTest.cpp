@@ -0,0 +1,184 @@
+#include "TestUtils.h"
+
+#include "Crc32c.h"
+#include "Lz4.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+    // Bitwise definition of CRC-32C: the table and the hardware versions must match it
+    Crc32c::Value reference_crc32c(const void* const data, const size_t size)
+    {
+        const unsigned char* const bytes = static_cast<const unsigned char*>(data);
+
+        std::uint32_t crc = 0xFFFFFFFFu;
+        for (size_t byteIdx = 0; byteIdx < size; ++byteIdx)
+        {
+            crc ^= bytes[byteIdx];
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+            }
+        }
+        return ~crc;
+    }
+
+    std::string make_random_bytes(std::mt19937& random, const size_t size)
+    {
+        std::string bytes(size, '\0');
+        for (char& byte : bytes)
+        {
+            byte = static_cast<char>(random());
+        }
+        return bytes;
+    }
+
+    // Words from a small vocabulary: compressible like typical keys and values
+    std::string make_text(std::mt19937& random, const size_t size)
+    {
+        static const char* const Words[] = { "user", "name", "value", "key", "session", "0001", "{\"id\":", "true", "  " };
+
+        std::string text;
+        while (text.size() < size)
+        {
+            text += Words[random() % std::size(Words)];
+        }
+        text.resize(size);
+        return text;
+    }
+
+    void check_lz4_round_trip(const std::string& block)
+    {
+        std::vector<char> compressed(Lz4::get_max_compressed_size(block.size()));
+        const size_t compressedSize = Lz4::compress(block.data(), block.size(), compressed.data(), compressed.size());
+        CHECK(compressedSize != 0);
+        CHECK(compressedSize <= Lz4::get_max_compressed_size(block.size()));
+
+        std::string decompressed(block.size(), '\0');
+        CHECK(Lz4::decompress(compressed.data(), compressedSize, decompressed.data(), decompressed.size()));
+        CHECK(decompressed == block);
+
+        // The size is part of the block contract
+        if (!block.empty())
+        {
+            std::string shorter(block.size() - 1, '\0');
+            CHECK(!Lz4::decompress(compressed.data(), compressedSize, shorter.data(), shorter.size()));
+        }
+    }
+
+    void test_crc32c_known_values()
+    {
+        CHECK(Crc32c::calculate("", 0) == 0);
+        CHECK(Crc32c::calculate("123456789", 9) == 0xE3069283u);
+
+        const std::string zeros(32, '\0');
+        CHECK(Crc32c::calculate(zeros.data(), zeros.size()) == 0x8A9136AAu);
+    }
+
+    void test_crc32c_matches_reference()
+    {
+        std::mt19937 random(1);
+        const std::string data = make_random_bytes(random, 4096 + 64);
+
+        // All alignments and the tails of the 8-byte loops
+        for (size_t offset = 0; offset < 16; ++offset)
+        {
+            for (size_t size = 0; size < 300; size += 1 + size / 16)
+            {
+                CHECK(Crc32c::calculate(data.data() + offset, size) == reference_crc32c(data.data() + offset, size));
+            }
+        }
+
+        CHECK(Crc32c::calculate(data.data(), data.size()) == reference_crc32c(data.data(), data.size()));
+    }
+
+    void test_crc32c_update()
+    {
+        std::mt19937 random(2);
+        const std::string data = make_random_bytes(random, 1000);
+
+        for (size_t split = 0; split <= data.size(); split += 37)
+        {
+            const Crc32c::Value head = Crc32c::calculate(data.data(), split);
+            CHECK(Crc32c::update(head, data.data() + split, data.size() - split) == Crc32c::calculate(data.data(), data.size()));
+        }
+    }
+
+    void test_lz4_round_trips()
+    {
+        std::mt19937 random(3);
+
+        check_lz4_round_trip({});
+        check_lz4_round_trip("a");
+        check_lz4_round_trip("abcdefghijkl");
+        check_lz4_round_trip(std::string(100000, 'x'));     // overlapping matches
+        check_lz4_round_trip(std::string(70000, '\0') + "tail");
+
+        for (const size_t size : { 5, 13, 64, 1000, 65535, 65536, 65537, 200000, 1 << 20 })
+        {
+            check_lz4_round_trip(make_random_bytes(random, size));
+            check_lz4_round_trip(make_text(random, size));
+        }
+
+        // A repeated block farther than the maximum match offset
+        const std::string block = make_random_bytes(random, 70000);
+        check_lz4_round_trip(block + block);
+    }
+
+    void test_lz4_compresses()
+    {
+        std::mt19937 random(4);
+        const std::string text = make_text(random, 65536);
+
+        std::vector<char> compressed(Lz4::get_max_compressed_size(text.size()));
+        const size_t compressedSize = Lz4::compress(text.data(), text.size(), compressed.data(), compressed.size());
+        CHECK(compressedSize != 0 && compressedSize < text.size() * 3 / 4);
+
+        // Does not fit
+        CHECK(Lz4::compress(text.data(), text.size(), compressed.data(), compressedSize - 1) == 0);
+    }
+
+    void test_lz4_corrupted_input()
+    {
+        std::mt19937 random(5);
+        const std::string text = make_text(random, 10000);
+
+        std::vector<char> compressed(Lz4::get_max_compressed_size(text.size()));
+        const size_t compressedSize = Lz4::compress(text.data(), text.size(), compressed.data(), compressed.size());
+        CHECK(compressedSize != 0);
+
+        std::string decompressed(text.size(), '\0');
+        CHECK(!Lz4::decompress(compressed.data(), compressedSize - 1, decompressed.data(), decompressed.size()));
+
+        // Any result is allowed except reading or writing out of bounds
+        for (int attempt = 0; attempt < 2000; ++attempt)
+        {
+            std::vector<char> damaged(compressed.begin(), compressed.begin() + static_cast<std::ptrdiff_t>(compressedSize));
+            damaged[random() % damaged.size()] = static_cast<char>(random());
+            Lz4::decompress(damaged.data(), damaged.size(), decompressed.data(), decompressed.size());
+        }
+
+        const std::string garbage = make_random_bytes(random, 5000);
+        Lz4::decompress(garbage.data(), garbage.size(), decompressed.data(), decompressed.size());
+    }
+}
+
+
+int main()
+{
+    std::printf("CRC-32C hardware acceleration: %s\n", Crc32c::is_hardware_accelerated() ? "yes" : "no");
+
+    RUN_TEST(test_crc32c_known_values);
+    RUN_TEST(test_crc32c_matches_reference);
+    RUN_TEST(test_crc32c_update);
+    RUN_TEST(test_lz4_round_trips);
+    RUN_TEST(test_lz4_compresses);
+    RUN_TEST(test_lz4_corrupted_input);
+    return 0;
+}
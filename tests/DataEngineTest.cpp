@@ -0,0 +1,495 @@
+#include "TestUtils.h"
+
+#include "DataEngine.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    struct EngineKind
+    {
+        DataEngine::Implementation  m_implementation;
+        const char*                 m_name;
+    };
+
+    const EngineKind EngineKinds[] = {
+        { DataEngine::Implementation::SplitOrderedList, "split-ordered-list" },
+        { DataEngine::Implementation::OpenAddressing, "open-addressing" },
+#ifndef _WIN32
+        { DataEngine::Implementation::Mapped, "mapped" },
+#endif
+    };
+
+    std::unique_ptr<DataEngine> create_engine(const EngineKind& kind, const test_utils::TemporaryDirectory& directory,
+        const size_t initialCapacity = 16)
+    {
+        std::unique_ptr<DataEngine> ptrEngine = DataEngine::create(kind.m_implementation, initialCapacity, directory.get_file("engine.mapped"));
+        CHECK(ptrEngine != nullptr);
+        return ptrEngine;
+    }
+
+    std::optional<std::string> get_value(const DataEngine& engine, const std::string_view key)
+    {
+        const std::optional<DataEngine::String> value = engine.get(key);
+        if (!value)
+        {
+            return std::nullopt;
+        }
+        return std::string(value->data(), value->size());
+    }
+
+    std::map<std::string, std::string> get_content(const DataEngine& engine)
+    {
+        std::map<std::string, std::string> content;
+        engine.enumerate([&content](const std::string_view key, const std::string_view value)
+            {
+                CHECK(content.emplace(key, value).second); // every key is visited once
+            }
+        );
+        return content;
+    }
+
+    std::string make_key(const size_t keyIdx)
+    {
+        return "key_" + std::to_string(keyIdx);
+    }
+
+    void test_basic_operations(const EngineKind& kind)
+    {
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+
+        CHECK(!engine.get("missing"));
+        CHECK(!engine.erase("missing"));
+
+        engine.set("a", "1");
+        engine.set("b", "");
+        CHECK(get_value(engine, "a") == "1");
+        CHECK(get_value(engine, "b") == "");
+
+        // Overwritten by longer and shorter values
+        engine.set("a", std::string(5000, 'x'));
+        CHECK(get_value(engine, "a") == std::string(5000, 'x'));
+        engine.set("a", "2");
+        CHECK(get_value(engine, "a") == "2");
+
+        std::string readValue;
+        CHECK(engine.read("a", [&readValue](const std::string_view value) { readValue = value; }));
+        CHECK(readValue == "2");
+        CHECK(!engine.read("c", [](const std::string_view) { CHECK(false); }));
+
+        CHECK(engine.erase("a"));
+        CHECK(!engine.erase("a"));
+        CHECK(!engine.get("a"));
+
+        // Keys are binary strings
+        const std::string binaryKey("k\0ey", 4);
+        engine.set(binaryKey, "binary");
+        CHECK(get_value(engine, binaryKey) == "binary");
+        CHECK(!engine.get("k"));
+
+        const std::map<std::string, std::string> content = get_content(engine);
+        CHECK(content.size() == 2 && content.at("b").empty() && content.at(binaryKey) == "binary");
+    }
+
+    // Starts small, so the table grows several times
+    void test_growth_and_erase(const EngineKind& kind)
+    {
+        constexpr size_t KeyCount = 50000;
+
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+
+        for (size_t keyIdx = 0; keyIdx < KeyCount; ++keyIdx)
+        {
+            engine.set(make_key(keyIdx), "value_" + std::to_string(keyIdx));
+        }
+
+        for (size_t keyIdx = 0; keyIdx < KeyCount; keyIdx += 3)
+        {
+            CHECK(engine.erase(make_key(keyIdx)));
+        }
+
+        for (size_t keyIdx = 0; keyIdx < KeyCount; ++keyIdx)
+        {
+            const std::optional<std::string> value = get_value(engine, make_key(keyIdx));
+            CHECK(keyIdx % 3 == 0 ? !value : value == "value_" + std::to_string(keyIdx));
+        }
+
+        const std::map<std::string, std::string> content = get_content(engine);
+        CHECK(content.size() == KeyCount - (KeyCount + 2) / 3);
+    }
+
+    // Erased slots are reused or cleaned up: a bounded live set does not grow the table forever
+    void test_churn(const EngineKind& kind)
+    {
+        constexpr size_t LiveKeyCount = 1000;
+        constexpr size_t RoundCount = 200;
+
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+
+        for (size_t round = 0; round < RoundCount; ++round)
+        {
+            for (size_t keyIdx = 0; keyIdx < LiveKeyCount; ++keyIdx)
+            {
+                engine.set(make_key(round * LiveKeyCount + keyIdx), "v");
+            }
+            if (round != 0)
+            {
+                for (size_t keyIdx = 0; keyIdx < LiveKeyCount; ++keyIdx)
+                {
+                    CHECK(engine.erase(make_key((round - 1) * LiveKeyCount + keyIdx)));
+                }
+            }
+        }
+
+        CHECK(get_content(engine).size() == LiveKeyCount);
+        CHECK(get_value(engine, make_key((RoundCount - 1) * LiveKeyCount)) == "v");
+    }
+
+    void test_change_tracking(const EngineKind& kind)
+    {
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+        engine.enable_change_tracking();
+
+        engine.set("old", "1");
+        engine.set("changed", "1");
+        engine.set("erased", "1");
+
+        const DataEngine::ChangeEpoch sinceEpoch = engine.advance_change_epoch();
+        engine.set("changed", "2");
+        engine.set("new", "3");
+        CHECK(engine.erase("erased"));
+
+        std::map<std::string, std::string> changes;
+        engine.enumerate_changes(sinceEpoch, [&changes](const std::string_view key, const std::string_view value)
+            {
+                changes.emplace(key, value);
+            }
+        );
+        CHECK(changes.size() == 2 && changes.at("changed") == "2" && changes.at("new") == "3");
+
+        const std::vector<std::string> erasedKeys = engine.get_erased_keys(sinceEpoch);
+        CHECK(erasedKeys.size() == 1 && erasedKeys[0] == "erased");
+    }
+
+    // Keys erased by several threads while the journal is taken are all returned, each once
+    void test_concurrent_erase_tracking(const EngineKind& kind)
+    {
+        constexpr size_t EraserCount = 4;
+        constexpr size_t KeyCount = 5000;
+
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+        engine.enable_change_tracking();
+
+        for (size_t keyIdx = 0; keyIdx < EraserCount * KeyCount; ++keyIdx)
+        {
+            engine.set(make_key(keyIdx), "v");
+        }
+        const DataEngine::ChangeEpoch sinceEpoch = engine.advance_change_epoch();
+
+        std::atomic<bool> stop = false;
+        std::thread reader([&]()
+            {
+                while (!stop.load())
+                {
+                    engine.get_erased_keys(sinceEpoch);
+                }
+            }
+        );
+
+        std::vector<std::thread> erasers;
+        for (size_t eraserIdx = 0; eraserIdx < EraserCount; ++eraserIdx)
+        {
+            erasers.emplace_back([&engine, eraserIdx]()
+                {
+                    for (size_t keyIdx = eraserIdx * KeyCount; keyIdx < (eraserIdx + 1) * KeyCount; ++keyIdx)
+                    {
+                        CHECK(engine.erase(make_key(keyIdx)));
+                    }
+                }
+            );
+        }
+
+        for (std::thread& eraser : erasers)
+        {
+            eraser.join();
+        }
+        stop = true;
+        reader.join();
+
+        const std::vector<std::string> erasedKeys = engine.get_erased_keys(sinceEpoch);
+        CHECK(std::set<std::string>(erasedKeys.begin(), erasedKeys.end()).size() == EraserCount * KeyCount);
+        CHECK(erasedKeys.size() == EraserCount * KeyCount);
+
+        // Keys erased before the next epoch are forgotten
+        CHECK(engine.get_erased_keys(engine.advance_change_epoch()).empty());
+    }
+
+    void test_bloom_filter(const EngineKind& kind)
+    {
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+        engine.enable_bloom_filter(10000);
+
+        for (size_t keyIdx = 0; keyIdx < 5000; ++keyIdx)
+        {
+            engine.set(make_key(keyIdx), "v");
+        }
+        CHECK(engine.erase(make_key(0)));
+
+        // No false negatives
+        for (size_t keyIdx = 1; keyIdx < 5000; ++keyIdx)
+        {
+            CHECK(get_value(engine, make_key(keyIdx)) == "v");
+        }
+        CHECK(!engine.get(make_key(0)));
+
+        for (size_t keyIdx = 5000; keyIdx < 10000; ++keyIdx)
+        {
+            CHECK(!engine.get(make_key(keyIdx)));
+        }
+
+        const DataEngine::BloomFilterStatistics statistics = engine.get_bloom_filter_statistics();
+        CHECK(statistics.m_enabled);
+        CHECK(statistics.m_rejectedReads > 4000);
+    }
+
+    // Every thread owns a range of keys and knows their final values. All threads also modify shared keys
+    // with values which name the key, and one thread enumerates the engine meanwhile.
+    void test_concurrent_stress(const EngineKind& kind)
+    {
+        constexpr size_t WriterCount = 4;
+        constexpr size_t OwnKeyCount = 2000;
+        constexpr size_t SharedKeyCount = 100;
+        constexpr size_t OperationCount = 40000;
+
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+
+        std::atomic<bool> stop = false;
+        std::atomic<size_t> badValues = 0;
+
+        const auto is_valid_shared_value = [](const std::string_view key, const std::string_view value)
+        {
+            return value.starts_with(key) && value.size() > key.size() && value[key.size()] == '=';
+        };
+
+        std::vector<std::map<std::string, std::string>> expectedContents(WriterCount);
+        std::vector<std::thread> writers;
+        for (size_t writerIdx = 0; writerIdx < WriterCount; ++writerIdx)
+        {
+            writers.emplace_back([&, writerIdx]()
+                {
+                    std::map<std::string, std::string>& expectedContent = expectedContents[writerIdx];
+                    std::uint32_t random = static_cast<std::uint32_t>(writerIdx) + 1;
+
+                    for (size_t operationIdx = 0; operationIdx < OperationCount; ++operationIdx)
+                    {
+                        random = random * 1103515245u + 12345u;
+                        const std::uint32_t choice = random >> 8;
+
+                        if (choice % 4 == 0)
+                        {
+                            const std::string key = "shared_" + std::to_string(choice / 4 % SharedKeyCount);
+                            if (choice % 3 == 0)
+                            {
+                                engine.erase(key);
+                            }
+                            else
+                            {
+                                engine.set(key, key + "=" + std::string(choice % 200, 'v'));
+                            }
+
+                            const std::optional<std::string> value = get_value(engine, key);
+                            if (value && !is_valid_shared_value(key, *value))
+                            {
+                                ++badValues;
+                            }
+                            continue;
+                        }
+
+                        const std::string key = "own_" + std::to_string(writerIdx) + "_" + std::to_string(choice % OwnKeyCount);
+                        if (choice % 5 == 0)
+                        {
+                            CHECK(engine.erase(key) == (expectedContent.erase(key) != 0));
+                        }
+                        else
+                        {
+                            const std::string value = std::to_string(operationIdx) + std::string(choice % 50, 'x');
+                            engine.set(key, value);
+                            expectedContent[key] = value;
+                        }
+                    }
+                }
+            );
+        }
+
+        std::thread enumerator([&]()
+            {
+                while (!stop.load())
+                {
+                    engine.enumerate([&](const std::string_view key, const std::string_view value)
+                        {
+                            if (key.starts_with("shared_") && !is_valid_shared_value(key, value))
+                            {
+                                ++badValues;
+                            }
+                        }
+                    );
+                }
+            }
+        );
+
+        for (std::thread& writer : writers)
+        {
+            writer.join();
+        }
+        stop = true;
+        enumerator.join();
+
+        CHECK(badValues.load() == 0);
+
+        std::map<std::string, std::string> expectedContent;
+        for (const std::map<std::string, std::string>& writerContent : expectedContents)
+        {
+            expectedContent.insert(writerContent.begin(), writerContent.end());
+        }
+
+        std::map<std::string, std::string> content = get_content(engine);
+        std::erase_if(content, [](const auto& item) { return item.first.starts_with("shared_"); });
+        CHECK(content == expectedContent);
+    }
+
+    // Every round sets a key while another thread erases it. The erased value never comes back,
+    // and a set which starts after the erase has returned stays visible.
+    void test_concurrent_set_and_erase(const EngineKind& kind)
+    {
+        constexpr size_t RoundCount = 20000;
+        constexpr std::string_view Key = "key";
+
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine(kind, directory);
+        DataEngine& engine = *ptrEngine;
+
+        std::atomic<size_t> startedRound = 0;
+        std::atomic<size_t> erasedRound = 0;
+
+        std::thread eraser([&]()
+            {
+                for (size_t round = 1; round <= RoundCount; ++round)
+                {
+                    while (startedRound.load() != round)
+                    {
+                        std::this_thread::yield();
+                    }
+                    CHECK(engine.erase(Key));
+                    erasedRound.store(round);
+                }
+            }
+        );
+
+        for (size_t round = 1; round <= RoundCount; ++round)
+        {
+            const std::string value = "set in round " + std::to_string(round);
+            engine.set(Key, "old");
+
+            startedRound.store(round);
+            if (round % 4 == 0)
+            {
+                std::this_thread::yield(); // lets the erase finish first in some rounds
+            }
+            const bool startedAfterErase = erasedRound.load() == round;
+            engine.set(Key, value);
+
+            while (erasedRound.load() != round)
+            {
+                std::this_thread::yield();
+            }
+
+            const std::optional<std::string> currentValue = get_value(engine, Key);
+            CHECK(!currentValue || currentValue == value);
+            CHECK(!startedAfterErase || currentValue == value);
+            CHECK(get_content(engine).size() == (currentValue ? 1 : 0));
+        }
+
+        eraser.join();
+    }
+
+#ifndef _WIN32
+    void test_mapped_reopen()
+    {
+        const test_utils::TemporaryDirectory directory("DataEngineTest");
+        const std::string filename = directory.get_file("engine.mapped");
+
+        {
+            const std::unique_ptr<DataEngine> ptrEngine = DataEngine::create(DataEngine::Implementation::Mapped, 16, filename);
+            CHECK(ptrEngine != nullptr && !ptrEngine->is_restored());
+
+            for (size_t keyIdx = 0; keyIdx < 10000; ++keyIdx)
+            {
+                ptrEngine->set(make_key(keyIdx), std::string(keyIdx % 100, 'v'));
+            }
+            CHECK(ptrEngine->erase(make_key(0)));
+        }
+
+        {
+            const std::unique_ptr<DataEngine> ptrEngine = DataEngine::create(DataEngine::Implementation::Mapped, 16, filename);
+            CHECK(ptrEngine != nullptr && ptrEngine->is_restored());
+
+            CHECK(!ptrEngine->get(make_key(0)));
+            for (size_t keyIdx = 1; keyIdx < 10000; ++keyIdx)
+            {
+                CHECK(get_value(*ptrEngine, make_key(keyIdx)) == std::string(keyIdx % 100, 'v'));
+            }
+            CHECK(get_content(*ptrEngine).size() == 9999);
+
+            // Blocks freed by the previous run are reused
+            ptrEngine->set("new", "value");
+            CHECK(get_value(*ptrEngine, "new") == "value");
+        }
+    }
+#endif
+}
+
+
+int main()
+{
+    for (const EngineKind& kind : EngineKinds)
+    {
+        std::printf("engine: %s\n", kind.m_name);
+
+        RUN_TEST(test_basic_operations, kind);
+        RUN_TEST(test_growth_and_erase, kind);
+        RUN_TEST(test_churn, kind);
+        RUN_TEST(test_change_tracking, kind);
+        RUN_TEST(test_concurrent_erase_tracking, kind);
+        RUN_TEST(test_bloom_filter, kind);
+        RUN_TEST(test_concurrent_stress, kind);
+        RUN_TEST(test_concurrent_set_and_erase, kind);
+    }
+
+#ifndef _WIN32
+    RUN_TEST(test_mapped_reopen);
+#endif
+    return 0;
+}
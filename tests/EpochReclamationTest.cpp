@@ -0,0 +1,218 @@
+#include "TestUtils.h"
+
+#include "EpochReclamation.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    constexpr std::uint64_t LiveMagic = 0x4C49564543454C4Cull;
+    constexpr std::uint64_t DeletedMagic = 0xDEADDEADDEADDEADull;
+
+    struct Node
+    {
+        std::atomic<std::uint64_t>  m_magic = LiveMagic;
+        std::atomic<bool>*          m_ptrDeleted = nullptr;
+        std::uint64_t               m_value = 0;
+    };
+
+    std::atomic<size_t> g_deletedCount = 0;
+
+    void delete_node(void* const ptr)
+    {
+        Node* const node = static_cast<Node*>(ptr);
+        node->m_magic.store(DeletedMagic, std::memory_order_relaxed);
+        if (node->m_ptrDeleted != nullptr)
+        {
+            node->m_ptrDeleted->store(true, std::memory_order_relaxed);
+        }
+        delete node;
+        ++g_deletedCount;
+    }
+
+    // Signals between the test thread and a reader
+    class Event
+    {
+    public:
+        void set()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_protect);
+                m_isSet = true;
+            }
+            m_condition.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_protect);
+            m_condition.wait(lock, [this]() { return m_isSet; });
+        }
+
+    protected:
+        std::mutex                  m_protect;
+        std::condition_variable     m_condition;
+        bool                        m_isSet = false;
+    };
+
+    void test_guard_delays_deletion()
+    {
+        constexpr size_t ObjectCount = 1000; // many epoch advance attempts
+
+        std::vector<std::atomic<bool>> deleted(ObjectCount);
+
+        Event guardTaken;
+        Event retired;
+        std::thread reader([&]()
+            {
+                const EpochReclamation::Guard guard;
+                guardTaken.set();
+                retired.wait();
+            }
+        );
+
+        guardTaken.wait();
+        for (size_t objectIdx = 0; objectIdx < ObjectCount; ++objectIdx)
+        {
+            Node* const node = new Node();
+            node->m_ptrDeleted = &deleted[objectIdx];
+            EpochReclamation::retire(node, delete_node);
+        }
+
+        // The reader could still see every object retired while it holds the guard
+        for (const std::atomic<bool>& isDeleted : deleted)
+        {
+            CHECK(!isDeleted.load());
+        }
+
+        retired.set();
+        reader.join();
+
+        // Once the reader has left, later retirements advance the epoch and delete them
+        for (size_t objectIdx = 0; objectIdx < ObjectCount; ++objectIdx)
+        {
+            EpochReclamation::retire(new Node(), delete_node);
+        }
+
+        for (const std::atomic<bool>& isDeleted : deleted)
+        {
+            CHECK(isDeleted.load());
+        }
+    }
+
+    void test_nested_guards()
+    {
+        std::atomic<bool> deleted = false;
+
+        Event guardTaken;
+        Event retired;
+        std::thread reader([&]()
+            {
+                const EpochReclamation::Guard outerGuard;
+                {
+                    const EpochReclamation::Guard innerGuard;
+                }
+                // Still protected by the outer guard
+                guardTaken.set();
+                retired.wait();
+            }
+        );
+
+        guardTaken.wait();
+        Node* const node = new Node();
+        node->m_ptrDeleted = &deleted;
+        EpochReclamation::retire(node, delete_node);
+
+        for (size_t objectIdx = 0; objectIdx < 1000; ++objectIdx)
+        {
+            EpochReclamation::retire(new Node(), delete_node);
+        }
+        CHECK(!deleted.load());
+
+        retired.set();
+        reader.join();
+
+        for (size_t objectIdx = 0; objectIdx < 1000; ++objectIdx)
+        {
+            EpochReclamation::retire(new Node(), delete_node);
+        }
+        CHECK(deleted.load());
+    }
+
+    // Readers dereference the current node while writers replace and retire it
+    void test_concurrent_readers_and_writers()
+    {
+        constexpr size_t WriterCount = 2;
+        constexpr size_t ReaderCount = 2;
+        constexpr size_t ReplacementCount = 100000;
+
+        std::atomic<Node*> current = new Node();
+        std::atomic<bool> stop = false;
+        std::atomic<size_t> badReads = 0;
+
+        std::vector<std::thread> readers;
+        for (size_t readerIdx = 0; readerIdx < ReaderCount; ++readerIdx)
+        {
+            readers.emplace_back([&]()
+                {
+                    while (!stop.load(std::memory_order_relaxed))
+                    {
+                        const EpochReclamation::Guard guard;
+                        const Node* const node = current.load(std::memory_order_acquire);
+                        if (node->m_magic.load(std::memory_order_relaxed) != LiveMagic)
+                        {
+                            ++badReads;
+                        }
+                    }
+                }
+            );
+        }
+
+        std::vector<std::thread> writers;
+        for (size_t writerIdx = 0; writerIdx < WriterCount; ++writerIdx)
+        {
+            writers.emplace_back([&]()
+                {
+                    for (size_t replacementIdx = 0; replacementIdx < ReplacementCount; ++replacementIdx)
+                    {
+                        Node* const node = new Node();
+                        node->m_value = replacementIdx;
+                        Node* const previous = current.exchange(node, std::memory_order_acq_rel);
+                        EpochReclamation::retire(previous, delete_node);
+                    }
+                }
+            );
+        }
+
+        for (std::thread& writer : writers)
+        {
+            writer.join();
+        }
+        stop = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+
+        CHECK(badReads.load() == 0);
+        CHECK(g_deletedCount.load() > 0); // reclamation keeps up
+        delete current.load();
+    }
+}
+
+
+int main()
+{
+    CHECK(EpochReclamation::is_lock_free());
+
+    RUN_TEST(test_guard_delays_deletion);
+    RUN_TEST(test_nested_guards);
+    RUN_TEST(test_concurrent_readers_and_writers);
+    return 0;
+}
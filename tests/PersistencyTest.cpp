@@ -0,0 +1,396 @@
+#include "TestUtils.h"
+
+#include "BinarySerializer.h"
+#include "DataEngine.h"
+#include "Persistency.h"
+#include "WriteAheadLog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#  include <csignal>
+#  include <sys/resource.h>
+#endif
+
+
+namespace
+{
+    using Operation = WriteAheadLog::Operation;
+    using SyncPolicy = WriteAheadLog::SyncPolicy;
+
+    std::unique_ptr<DataEngine> create_engine()
+    {
+        return DataEngine::create(DataEngine::Implementation::SplitOrderedList);
+    }
+
+    std::map<std::string, std::string> get_content(const DataEngine& engine)
+    {
+        std::map<std::string, std::string> content;
+        engine.enumerate([&content](const std::string_view key, const std::string_view value) { content.emplace(key, value); });
+        return content;
+    }
+
+    // Replays the log into a new engine
+    std::map<std::string, std::string> replay_log(const std::string& filename, size_t* const ptrRecordCount = nullptr)
+    {
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+
+        WriteAheadLog log;
+        const size_t recordCount = Persistency::open_log(*ptrEngine, log, filename, SyncPolicy::Never, std::chrono::milliseconds(0));
+        CHECK(log.is_open());
+
+        if (ptrRecordCount != nullptr)
+        {
+            *ptrRecordCount = recordCount;
+        }
+        return get_content(*ptrEngine);
+    }
+
+    std::map<std::string, std::string> load_database(const std::string& filename)
+    {
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        CHECK(Persistency::initial_load_data(*ptrEngine, filename, 2));
+        return get_content(*ptrEngine);
+    }
+
+    void fill_engine(DataEngine& engine, const size_t keyCount)
+    {
+        for (size_t keyIdx = 0; keyIdx < keyCount; ++keyIdx)
+        {
+            engine.set("key_" + std::to_string(keyIdx), "value " + std::to_string(keyIdx * 7) + std::string(keyIdx % 50, 'v'));
+        }
+    }
+
+    void test_log_replay()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.wal");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        {
+            WriteAheadLog log;
+            CHECK(log.open(filename, SyncPolicy::Always, std::chrono::milliseconds(0), [](auto, auto, auto) { CHECK(false); }));
+
+            CHECK(log.set(*ptrEngine, "a", "1"));
+            CHECK(log.set(*ptrEngine, "b", "2"));
+            CHECK(log.set(*ptrEngine, "a", "3"));
+
+            bool erased = false;
+            CHECK(log.erase(*ptrEngine, "b", erased) && erased);
+            CHECK(log.erase(*ptrEngine, "missing", erased) && !erased);
+
+            // Changes of a batch are applied in order
+            std::vector<WriteAheadLog::Change> changes = {
+                { Operation::Set, "c", "4" },
+                { Operation::Set, "d", "5" },
+                { Operation::Erase, "c", {} },
+            };
+            CHECK(log.apply(*ptrEngine, changes));
+            CHECK(changes[2].m_erased);
+        }
+
+        size_t recordCount = 0;
+        CHECK(replay_log(filename, &recordCount) == get_content(*ptrEngine));
+        CHECK(recordCount == 8);
+    }
+
+    void test_log_torn_record()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.wal");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        {
+            WriteAheadLog log;
+            CHECK(log.open(filename, SyncPolicy::Never, std::chrono::milliseconds(0), [](auto, auto, auto) {}));
+            CHECK(log.set(*ptrEngine, "a", "1"));
+            CHECK(log.set(*ptrEngine, "b", "2"));
+        }
+
+        // A crash during the last write
+        std::filesystem::resize_file(filename, std::filesystem::file_size(filename) - 1);
+
+        size_t recordCount = 0;
+        const std::map<std::string, std::string> content = replay_log(filename, &recordCount);
+        CHECK(recordCount == 1 && content.size() == 1 && content.at("a") == "1");
+
+        // The torn record was cut off, so appended records are readable
+        {
+            WriteAheadLog log;
+            CHECK(log.open(filename, SyncPolicy::Never, std::chrono::milliseconds(0), [](auto, auto, auto) {}));
+            CHECK(log.set(*ptrEngine, "c", "3"));
+        }
+        CHECK(replay_log(filename, &recordCount).size() == 2 && recordCount == 2);
+    }
+
+    void test_log_truncate()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.wal");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        WriteAheadLog log;
+        CHECK(log.open(filename, SyncPolicy::Always, std::chrono::milliseconds(0), [](auto, auto, auto) {}));
+
+        CHECK(log.set(*ptrEngine, "before", "1"));
+        const std::uint64_t checkpoint = log.get_checkpoint();
+        CHECK(log.set(*ptrEngine, "after", "2"));
+
+        CHECK(log.truncate(checkpoint));
+        CHECK(log.truncate(checkpoint)); // nothing to drop
+        CHECK(log.set(*ptrEngine, "later", "3"));
+        log.close();
+
+        size_t recordCount = 0;
+        const std::map<std::string, std::string> content = replay_log(filename, &recordCount);
+        CHECK(recordCount == 2 && content.size() == 2 && content.at("after") == "2" && content.at("later") == "3");
+    }
+
+    void test_log_concurrent_writers()
+    {
+        constexpr size_t WriterCount = 4;
+        constexpr size_t OperationCount = 2000;
+
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.wal");
+
+        for (const SyncPolicy syncPolicy : { SyncPolicy::Always, SyncPolicy::Interval, SyncPolicy::Never })
+        {
+            std::filesystem::remove(filename);
+
+            const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+            {
+                WriteAheadLog log;
+                CHECK(log.open(filename, syncPolicy, std::chrono::milliseconds(5), [](auto, auto, auto) {}));
+
+                std::vector<std::thread> writers;
+                for (size_t writerIdx = 0; writerIdx < WriterCount; ++writerIdx)
+                {
+                    writers.emplace_back([&log, &ptrEngine, writerIdx]()
+                        {
+                            for (size_t operationIdx = 0; operationIdx < OperationCount; ++operationIdx)
+                            {
+                                // Writers share keys: the log order must match the order applied to the engine
+                                const std::string key = "key_" + std::to_string(operationIdx % 300);
+                                CHECK(log.set(*ptrEngine, key, std::to_string(writerIdx) + "_" + std::to_string(operationIdx)));
+
+                                bool erased = false;
+                                if (operationIdx % 7 == 0)
+                                {
+                                    CHECK(log.erase(*ptrEngine, key, erased));
+                                }
+                            }
+                        }
+                    );
+                }
+
+                // Snapshots truncate the log concurrently
+                for (int truncateIdx = 0; truncateIdx < 5; ++truncateIdx)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    CHECK(log.truncate(log.get_checkpoint()));
+                }
+
+                for (std::thread& writer : writers)
+                {
+                    writer.join();
+                }
+            }
+
+            // Records before the last checkpoint were dropped, so the replay holds only keys written after it.
+            // The last record of each of them must match the engine.
+            const std::map<std::string, std::string> replayed = replay_log(filename);
+            for (const auto& [key, value] : replayed)
+            {
+                const std::optional<DataEngine::String> engineValue = ptrEngine->get(key);
+                CHECK(engineValue && std::string_view(*engineValue) == value);
+            }
+        }
+    }
+
+#ifndef _WIN32
+    void set_file_size_limit(const rlim_t limit)
+    {
+        const rlimit fileSizeLimit = { limit, RLIM_INFINITY };
+        CHECK(::setrlimit(RLIMIT_FSIZE, &fileSizeLimit) == 0);
+    }
+
+    // A failed write is reported to its writer, does not modify the engine, and does not stop the log
+    void test_log_recovers_after_failed_write()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.wal");
+
+        std::signal(SIGXFSZ, SIG_IGN); // writes over the limit fail with `EFBIG` instead
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        WriteAheadLog log;
+        CHECK(log.open(filename, SyncPolicy::Always, std::chrono::milliseconds(0), [](auto, auto, auto) {}));
+
+        CHECK(log.set(*ptrEngine, "a", "1"));
+        const std::uint64_t checkpoint = log.get_checkpoint();
+        CHECK(log.set(*ptrEngine, "b", "2"));
+
+        set_file_size_limit(std::filesystem::file_size(filename) + 20);
+        CHECK(!log.set(*ptrEngine, "c", std::string(100, 'x')));
+        set_file_size_limit(RLIM_INFINITY);
+
+        CHECK(!ptrEngine->get("c"));
+        CHECK(std::filesystem::file_size(filename) > 0);
+
+        CHECK(log.set(*ptrEngine, "d", "4"));
+
+        // The dropped record is not counted when the checkpoint is located in the file
+        CHECK(log.truncate(checkpoint));
+        CHECK(log.set(*ptrEngine, "e", "5"));
+        log.close();
+
+        size_t recordCount = 0;
+        const std::map<std::string, std::string> content = replay_log(filename, &recordCount);
+        CHECK(recordCount == 3);
+        CHECK(content == (std::map<std::string, std::string>{ { "b", "2" }, { "d", "4" }, { "e", "5" } }));
+    }
+#endif
+
+    void test_snapshot_round_trip()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        fill_engine(*ptrEngine, 30000);
+        ptrEngine->set("empty", "");
+        ptrEngine->set("big", std::string(3 << 20, 'b')); // bigger than a block
+
+        for (const BinarySerializer::Compression compression : { BinarySerializer::Compression::None, BinarySerializer::Compression::Lz4 })
+        {
+            const std::string filename = directory.get_file("db.bin");
+            CHECK(Persistency::store_data(*ptrEngine, filename, 0, compression) == 30002);
+            CHECK(BinarySerializer::is_binary_file(filename));
+            CHECK(load_database(filename) == get_content(*ptrEngine));
+        }
+
+        const std::string jsonFilename = directory.get_file("db.json");
+        CHECK(Persistency::store_data(*ptrEngine, jsonFilename) == 30002);
+        CHECK(load_database(jsonFilename) == get_content(*ptrEngine));
+    }
+
+    void test_damaged_snapshot()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.bin");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        fill_engine(*ptrEngine, 1000);
+        CHECK(Persistency::store_data(*ptrEngine, filename));
+
+        // A flipped byte in the payload
+        {
+            std::FILE* const file = std::fopen(filename.c_str(), "r+b");
+            CHECK(file != nullptr);
+            CHECK(std::fseek(file, 100, SEEK_SET) == 0);
+            const int byte = std::fgetc(file);
+            CHECK(std::fseek(file, 100, SEEK_SET) == 0);
+            std::fputc(byte ^ 0x40, file);
+            std::fclose(file);
+        }
+
+        const std::unique_ptr<DataEngine> ptrLoadedEngine = create_engine();
+        CHECK(!Persistency::initial_load_data(*ptrLoadedEngine, filename));
+
+        // A missing file is an empty database
+        CHECK(Persistency::initial_load_data(*ptrLoadedEngine, directory.get_file("missing.bin")) == 0);
+    }
+
+    void test_delta_snapshots()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.bin");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        DataEngine& engine = *ptrEngine;
+        engine.enable_change_tracking();
+
+        WriteAheadLog log;
+        CHECK(log.open(directory.get_file("db.wal"), SyncPolicy::Never, std::chrono::milliseconds(0), [](auto, auto, auto) {}));
+
+        fill_engine(engine, 5000);
+        DataEngine::ChangeEpoch sinceEpoch = engine.advance_change_epoch();
+        CHECK(Persistency::save_snapshot(engine, filename, &log));
+
+        std::optional<Persistency::DeltaChain> deltaChain = Persistency::get_delta_chain(filename);
+        CHECK(deltaChain && deltaChain->m_deltaCount == 0);
+
+        for (size_t deltaIdx = 0; deltaIdx < 3; ++deltaIdx)
+        {
+            bool erased = false;
+            for (size_t keyIdx = deltaIdx * 100; keyIdx < deltaIdx * 100 + 50; ++keyIdx)
+            {
+                CHECK(log.set(engine, "key_" + std::to_string(keyIdx), "changed in delta " + std::to_string(deltaIdx)));
+                CHECK(log.erase(engine, "key_" + std::to_string(keyIdx + 1000), erased) && erased);
+            }
+            // Erased and set again in the same delta
+            CHECK(log.erase(engine, "key_4000", erased));
+            CHECK(log.set(engine, "key_4000", "restored " + std::to_string(deltaIdx)));
+            CHECK(log.set(engine, "new_" + std::to_string(deltaIdx), "new"));
+
+            const DataEngine::ChangeEpoch deltaEpoch = sinceEpoch;
+            sinceEpoch = engine.advance_change_epoch();
+            const std::optional<size_t> recordCount = Persistency::save_delta(engine, filename, *deltaChain, log, deltaEpoch, 0,
+                Persistency::SnapshotProcess::Current, BinarySerializer::Compression::Lz4);
+            CHECK(recordCount && *recordCount >= 102);
+            CHECK(deltaChain->m_deltaCount == deltaIdx + 1);
+        }
+
+        CHECK(std::filesystem::exists(Persistency::get_delta_filename(filename, 2)));
+        CHECK(load_database(filename) == get_content(engine));
+
+        // A full snapshot drops the deltas
+        CHECK(Persistency::save_snapshot(engine, filename, &log));
+        CHECK(!std::filesystem::exists(Persistency::get_delta_filename(filename, 0)));
+        CHECK(load_database(filename) == get_content(engine));
+    }
+
+#ifndef _WIN32
+    void test_forked_snapshot()
+    {
+        const test_utils::TemporaryDirectory directory("PersistencyTest");
+        const std::string filename = directory.get_file("db.bin");
+
+        const std::unique_ptr<DataEngine> ptrEngine = create_engine();
+        fill_engine(*ptrEngine, 20000);
+
+        const std::optional<size_t> recordCount = Persistency::save_snapshot(*ptrEngine, filename, nullptr, 0,
+            Persistency::SnapshotProcess::Fork, BinarySerializer::Compression::Lz4);
+        CHECK(recordCount == 20000);
+        CHECK(load_database(filename) == get_content(*ptrEngine));
+    }
+#endif
+}
+
+
+int main()
+{
+    RUN_TEST(test_log_replay);
+    RUN_TEST(test_log_torn_record);
+    RUN_TEST(test_log_truncate);
+    RUN_TEST(test_log_concurrent_writers);
+#ifndef _WIN32
+    RUN_TEST(test_log_recovers_after_failed_write);
+#endif
+    RUN_TEST(test_snapshot_round_trip);
+    RUN_TEST(test_damaged_snapshot);
+    RUN_TEST(test_delta_snapshots);
+#ifndef _WIN32
+    RUN_TEST(test_forked_snapshot);
+#endif
+    return 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <system_error>
+
+
+// Tests are plain executables run by CTest. A failed check prints its location and exits with a non-zero code.
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::fflush(stderr); \
+            std::_Exit(1); \
+        } \
+    } while (false)
+
+// Arguments after the test function are passed to it
+#define RUN_TEST(test, ...) \
+    do \
+    { \
+        test(__VA_ARGS__); \
+        std::printf("%s: ok\n", #test); \
+        std::fflush(stdout); \
+    } while (false)
+
+
+namespace test_utils
+{
+    // Empty directory for the files of a test, deleted with its content at the end
+    class TemporaryDirectory
+    {
+    public:
+        explicit TemporaryDirectory(const std::string& name)
+        {
+            std::random_device random;
+            m_path = std::filesystem::temp_directory_path() / (name + "-" + std::to_string(random()));
+
+            std::error_code error;
+            std::filesystem::remove_all(m_path, error);
+            std::filesystem::create_directories(m_path);
+        }
+
+        ~TemporaryDirectory()
+        {
+            std::error_code error;
+            std::filesystem::remove_all(m_path, error);
+        }
+
+        TemporaryDirectory(const TemporaryDirectory&) = delete;
+        TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+        std::string get_file(const std::string& filename) const
+        {
+            return (m_path / filename).string();
+        }
+
+    protected:
+        std::filesystem::path m_path;
+    };
+}
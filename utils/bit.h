@@ -0,0 +1,69 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace bit_extra
+{
+    // Returns 1 for 0
+    constexpr size_t round_up_to_power_of_2(const size_t value)
+    {
+        return std::bit_ceil(value);
+    }
+
+    constexpr std::uint64_t reverse_bits(std::uint64_t value)
+    {
+        value = ((value >> 1) & 0x5555555555555555ull) | ((value & 0x5555555555555555ull) << 1);
+        value = ((value >> 2) & 0x3333333333333333ull) | ((value & 0x3333333333333333ull) << 2);
+        value = ((value >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((value & 0x0F0F0F0F0F0F0F0Full) << 4);
+        value = ((value >> 8) & 0x00FF00FF00FF00FFull) | ((value & 0x00FF00FF00FF00FFull) << 8);
+        value = ((value >> 16) & 0x0000FFFF0000FFFFull) | ((value & 0x0000FFFF0000FFFFull) << 16);
+        value = (value >> 32) | (value << 32);
+        return value;
+    }
+
+    // Block size classes of the allocators: multiples of `Alignment` up to `MaxFineBlockSize`,
+    // then `CoarseClassesPerDoubling` classes per power of 2, so a block never wastes more
+    // than 1 / `CoarseClassesPerDoubling` of its size
+    template <size_t Alignment, size_t MaxFineBlockSize, size_t CoarseClassesPerDoubling>
+    struct SizeClasses
+    {
+        static_assert(std::has_single_bit(Alignment) && std::has_single_bit(MaxFineBlockSize));
+
+        static constexpr size_t FineClassCount = MaxFineBlockSize / Alignment;
+
+        // Number of classes needed for blocks up to `maxBlockSize`, a power of 2
+        static constexpr size_t get_class_count(const size_t maxBlockSize)
+        {
+            return FineClassCount + CoarseClassesPerDoubling * (std::bit_width(maxBlockSize - 1) - std::bit_width(MaxFineBlockSize - 1));
+        }
+
+        static constexpr size_t get_size_class(const size_t size)
+        {
+            if (size <= MaxFineBlockSize)
+            {
+                return (size + Alignment - 1) / Alignment - (size != 0);
+            }
+
+            // size is in (2^power, 2^(power + 1)]
+            const size_t power = std::bit_width(size - 1) - 1;
+            const size_t step = (size_t(1) << power) / CoarseClassesPerDoubling;
+            const size_t stepIdx = (size - (size_t(1) << power) + step - 1) / step - 1;
+            return FineClassCount + (power - std::bit_width(MaxFineBlockSize - 1)) * CoarseClassesPerDoubling + stepIdx;
+        }
+
+        static constexpr size_t get_block_size(const size_t sizeClass)
+        {
+            if (sizeClass < FineClassCount)
+            {
+                return (sizeClass + 1) * Alignment;
+            }
+
+            const size_t coarseIdx = sizeClass - FineClassCount;
+            const size_t power = std::bit_width(MaxFineBlockSize - 1) + coarseIdx / CoarseClassesPerDoubling;
+            return (size_t(1) << power) + (coarseIdx % CoarseClassesPerDoubling + 1) * ((size_t(1) << power) / CoarseClassesPerDoubling);
+        }
+    };
+}
@@ -81,6 +81,12 @@ namespace std
             return load();
         }
 
+        bool compare_exchange_strong(shared_ptr<T>& expected, shared_ptr<T> desired,
+            memory_order success, memory_order failure) noexcept
+        {
+            return std::atomic_compare_exchange_strong_explicit(&ptr_, &expected, std::move(desired), success, failure);
+        }
+
     private:
         std::shared_ptr<T> ptr_;
     };